@@ -0,0 +1,234 @@
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <SSHConnection.h>
+#include <SFTPSessionPool.h>
+#include <SFTPStream.h>
+#include <Library.h>
+#include <database/SQLite3DB.h>
+#include <database/season/SQLiteSeasonRepository.h>
+#include <database/episode/SQLiteEpisodeRepository.h>
+#include <database/watch_history/SQLiteWatchHistoryRepository.h>
+#include <Log.h>
+#include <SignalHandler.h>
+#include <database/SQLiteMiscRepository.h>
+#include <BlockCache.h>
+#include <DiskCache.h>
+
+#define CLI_BENCHMARK_DEFAULT_MEGABYTES 64 //How much of a file the benchmark reads, if not told otherwise
+#define CLI_BENCHMARK_READ_SIZE 1048576 //Size of each read the benchmark makes
+
+static void print_usage(const char *program)
+{
+    std::cerr << "Usage: " << program << " <command> [options]\n"
+              << "Runs library tasks without the GUI, against the same config.ini and database.db.\n\n"
+              << "Commands:\n"
+              << "  sync [--full]                Syncs the library with the server. --full lists every season, changed or not.\n"
+              << "  thumbnails [--all]           Generates thumbnails for seasons without one. --all regenerates every season's.\n"
+              << "  maintain                     Checks the database, removes orphaned rows, and compacts it.\n"
+              << "  benchmark [file] [megabytes] Times listing the library, and reading a remote file if one's given.\n";
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool run_maintenance(SQLite3DB &database)
+{
+    auto integrity = database.query("PRAGMA integrity_check", {});
+    bool intact = true;
+    for(auto &result : integrity["integrity_check"])
+    {
+        std::string message = result.get<std::string>();
+        intact &= message == "ok";
+        frlog << (message == "ok" ? Log::info : Log::crit) << "Integrity check: " << message << Log::end;
+    }
+    if(!intact)
+    {
+        frlog << Log::crit << "The database is damaged, so it's been left alone. Restore it from a backup, or delete it to start again." << Log::end;
+        return false;
+    }
+
+    //Remove rows left pointing at things which no longer exist, children first
+    auto start = std::chrono::steady_clock::now();
+    database.unsafe_query("DELETE FROM episode WHERE season_id NOT IN (SELECT id FROM season)");
+    database.unsafe_query("DELETE FROM season_thumbnail WHERE season_id NOT IN (SELECT id FROM season)");
+    database.unsafe_query("DELETE FROM watch_history WHERE episode_id NOT IN (SELECT id FROM episode)");
+    frlog << Log::info << "Removed orphaned rows in " << seconds_since(start) << "s" << Log::end;
+
+    //Refresh the query planner's statistics, then give back the space that deleted rows left behind
+    start = std::chrono::steady_clock::now();
+    database.unsafe_query("ANALYZE");
+    database.unsafe_query("VACUUM");
+    frlog << Log::info << "Analysed and compacted the database in " << seconds_since(start) << "s" << Log::end;
+    return true;
+}
+
+static bool run_benchmark(SFTPSessionPool &sftp, const std::string &library_root, const std::string &filepath, uint64_t megabytes)
+{
+    //Listing the library root, both ways a sync can do it
+    auto start = std::chrono::steady_clock::now();
+    {
+        auto session = sftp.checkout();
+        size_t entries = session->enumerate_directory(library_root).size();
+        frlog << Log::info << "Listed " << entries << " entries in the library root over SFTP in " << seconds_since(start) << "s" << Log::end;
+
+        try
+        {
+            start = std::chrono::steady_clock::now();
+            entries = session.get_connection().enumerate_tree(library_root, 2).size();
+            frlog << Log::info << "Listed " << entries << " entries in the library tree over exec in " << seconds_since(start) << "s" << Log::end;
+        }
+        catch(const std::exception &e)
+        {
+            frlog << Log::warn << "Failed to list the library tree over exec: " << e.what() << Log::end;
+        }
+    }
+
+    if(filepath.empty())
+        return true;
+
+    //Reading a file, the same way that playback does
+    auto session = sftp.checkout();
+    auto file = std::make_unique<SFTPFile>(session->open(filepath));
+    std::unique_ptr<SFTPStripedReader> striped_reader;
+    Config &config = Config::get_instance();
+    auto striped_connections = config.get<uint32_t>(CONFIG_SFTP_STRIPED_CONNECTIONS);
+    if(striped_connections > 1)
+    {
+        striped_reader = std::make_unique<SFTPStripedReader>(config.get<std::string>(CONFIG_SFTP_IP), config.get<uint32_t>(CONFIG_SFTP_PORT),
+                config.get<std::string>(CONFIG_SFTP_USERNAME), file->get_attributes(), striped_connections, file->get_stats());
+    }
+
+    SFTPStream stream(std::move(file), std::move(striped_reader));
+    std::string buffer(CLI_BENCHMARK_READ_SIZE, '\0');
+    uint64_t wanted = megabytes * 1024 * 1024;
+    uint64_t total = 0;
+    start = std::chrono::steady_clock::now();
+    while(total < wanted)
+    {
+        sf::Int64 bytes = stream.read(&buffer[0], static_cast<sf::Int64>(std::min<uint64_t>(buffer.size(), wanted - total)));
+        if(bytes < 0)
+        {
+            frlog << Log::crit << "Failed to read " << filepath << " at offset " << total << Log::end;
+            return false;
+        }
+        if(bytes == 0)
+            break;
+        total += static_cast<uint64_t>(bytes);
+    }
+
+    double elapsed = seconds_since(start);
+    frlog << Log::info << "Read " << total / 1048576.0 << "MB of " << filepath << " in " << elapsed << "s (" << (elapsed > 0 ? total / 1048576.0 / elapsed : 0) << "MB/s)" << Log::end;
+    frlog << Log::info << "Transfer stats: " << stream.get_stats().to_string() << Log::end;
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::string command = argv[1];
+    bool flag = argc > 2 && (strcmp(argv[2], "--full") == 0 || strcmp(argv[2], "--all") == 0);
+    if(command != "sync" && command != "thumbnails" && command != "maintain" && command != "benchmark")
+    {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    //Seed random
+    std::srand(std::time(nullptr));
+
+    //Install signal handler
+    SignalHandler::install();
+
+    //Initialise logging
+    if(!frlog.init("logs/"))
+    {
+        std::cerr << "Failed to initialise logging. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    //Open config
+    Config &config = Config::get_instance();
+
+    //Initialise database
+    auto database = std::make_shared<SQLite3DB>();
+    if(!database->open("database.db"))
+    {
+        std::cerr << "Failed to open internal database, database.db. Exiting." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    //Initialise database repositories. This also brings the schema up to date.
+    auto season_table = std::make_shared<SQLiteSeasonRepository>(database);
+    auto episode_table = std::make_shared<SQLiteEpisodeRepository>(database);
+    auto watch_history_table = std::make_shared<SQLiteWatchHistoryRepository>(database);
+    auto misc_table = std::make_shared<SQLiteMiscRepository>(database, season_table);
+
+    //Maintenance only needs the database
+    if(command == "maintain")
+        return run_maintenance(*database) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    //Benchmarks shouldn't be served from the disk cache, as then they'd be measuring that instead
+    BlockCache::get_instance().set_capacity(config.get<uint64_t>(CONFIG_CACHE_MEMORY_SIZE));
+    if(command != "benchmark" && !DiskCache::get_instance().init(config.get<std::string>(CONFIG_CACHE_DISK_LOCATION), config.get<uint64_t>(CONFIG_CACHE_DISK_SIZE)))
+    {
+        frlog << Log::warn << "Failed to initialise the disk cache. Continuing without it." << Log::end;
+    }
+
+    //Start SFTP connection. Note: Only keyring is supported at the moment. So identity should be loaded prior to starting.
+    auto sftp = std::make_shared<SFTPSessionPool>(config.get<std::string>(CONFIG_SFTP_IP), config.get<uint32_t>(CONFIG_SFTP_PORT),
+            config.get<std::string>(CONFIG_SFTP_USERNAME), config.get<uint32_t>(CONFIG_SFTP_POOL_SIZE));
+    try
+    {
+        sftp->checkout();
+    }
+    catch(const std::exception &e)
+    {
+        frlog << Log::crit << "Failed to connect to SFTP server: " << e.what() << Log::end;
+        return EXIT_FAILURE;
+    }
+
+    bool success = true;
+    auto start = std::chrono::steady_clock::now();
+    if(command == "benchmark")
+    {
+        try
+        {
+            uint64_t megabytes = argc > 3 ? std::stoull(argv[3]) : CLI_BENCHMARK_DEFAULT_MEGABYTES;
+            success = run_benchmark(*sftp, config.get<std::string>(CONFIG_LIBRARY_LOCATION), argc > 2 ? argv[2] : "", megabytes);
+        }
+        catch(const std::exception &e)
+        {
+            frlog << Log::crit << "Benchmark failed: " << e.what() << Log::end;
+            success = false;
+        }
+    }
+    else
+    {
+        try
+        {
+            auto library = std::make_shared<Library>(sftp, config.get<std::string>(CONFIG_LIBRARY_LOCATION), season_table, episode_table, watch_history_table, misc_table);
+            if(command == "sync")
+                library->sync(flag);
+            else
+                library->generate_thumbnails(flag);
+            frlog << Log::info << "Finished " << command << " in " << seconds_since(start) << "s" << Log::end;
+        }
+        catch(const std::exception &e)
+        {
+            frlog << Log::crit << "Failed to " << (command == "sync" ? "sync library" : "generate thumbnails") << ": " << e.what() << Log::end;
+            success = false;
+        }
+    }
+
+    season_table->flush();
+    episode_table->flush();
+    watch_history_table->flush();
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
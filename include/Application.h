@@ -5,6 +5,9 @@
 #ifndef SFTPMEDIASTREAMER_APPLICATION_H
 #define SFTPMEDIASTREAMER_APPLICATION_H
 
+#include <unordered_map>
+#include <mutex>
+#include <glibmm/dispatcher.h>
 #include <gtkmm/scrolledwindow.h>
 #include <gtkmm/window.h>
 #include <gtkmm/grid.h>
@@ -16,8 +19,9 @@
 #include <gtkmm/viewport.h>
 #include <gtkmm/searchbar.h>
 #include <gtkmm/searchentry.h>
+#include <gtkmm/progressbar.h>
 #include <database/watch_history/WatchHistoryRepository.h>
-#include "SFTPSession.h"
+#include "SFTPSessionPool.h"
 #include "Thumbnailer.h"
 #include "Library.h"
 #include "SeasonListingWidget.h"
@@ -36,12 +40,12 @@ public:
      * @param refBuilder GTK internal
      * @param window The window to display to
      * @param library The library to source things from
-     * @param sftp The SFTP connection to receive data over (abstract?)
+     * @param sftp The pool of SFTP sessions to receive data over (abstract?)
      */
     Application(BaseObjectType* cobject,
                 const Glib::RefPtr<Gtk::Builder>& refBuilder,
                 std::shared_ptr<Library> library,
-                std::shared_ptr<SFTPSession> sftp);
+                std::shared_ptr<SFTPSessionPool> sftp);
     ~Application() override;
 private:
 
@@ -66,6 +70,26 @@ private:
      */
     void clear();
 
+    /*!
+     * Adds a tile for a season to the main scroll box
+     *
+     * @param season The season to add
+     */
+    void add_season_listing(std::shared_ptr<SeasonEntry> season);
+
+    /*!
+     * Finds the tile of a season currently being displayed
+     *
+     * @param season_id The ID of the season to find
+     * @return The season's tile. listed_results.end() if it's not displayed.
+     */
+    std::vector<std::shared_ptr<Gtk::Widget>>::iterator find_season_listing(uint64_t season_id);
+
+    /*!
+     * Signal called on the GTK thread when the library sync has events waiting
+     */
+    void signal_sync_events();
+
     /*!
      * Signal called when a library entry is clicked
      */
@@ -88,6 +112,8 @@ private:
     Gtk::Button *recently_added_button;
     Gtk::Viewport *results_viewport;
     Gtk::SearchEntry *search_bar;
+    Gtk::ProgressBar *sync_progress;
+    SFTPSessionPool::Handle playback_session; //Must outlive the video player, as it streams through it
     std::unique_ptr<VideoPlayerWidget> video_player;
     std::shared_ptr<EpisodeEntry> current_playing;
     Gtk::Box *window_box;
@@ -96,10 +122,15 @@ private:
     //State
     const Glib::RefPtr<Gtk::Builder> &builder;
     std::vector<std::shared_ptr<Gtk::Widget>> listed_results;
+    std::unordered_map<std::string, Attributes> listed_attributes; //Filepath -> Attributes, of the season last listed
+    bool showing_home; //True if every season is listed, so newly found ones should be too
+    Glib::Dispatcher sync_dispatcher; //Wakes the GTK thread when the sync has events waiting
+    std::mutex sync_events_lock;
+    std::vector<Library::SyncEvent> sync_events; //Events from the sync, waiting to be handled on the GTK thread
 
     //Dependencies
     std::shared_ptr<Library> library;
-    std::shared_ptr<SFTPSession> sftp;
+    std::shared_ptr<SFTPSessionPool> sftp;
 
     void signal_play_state_changed(VideoWidget::SignalType state);
 };
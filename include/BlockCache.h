@@ -0,0 +1,141 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#ifndef SFTPMEDIASTREAMER_BLOCKCACHE_H
+#define SFTPMEDIASTREAMER_BLOCKCACHE_H
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <list>
+#include <unordered_map>
+#include <future>
+#include <functional>
+#include "Types.h"
+
+#define BLOCK_CACHE_BLOCK_SIZE 262144 //Size of each cached block, in bytes
+#define BLOCK_CACHE_DEFAULT_CAPACITY 0x4000000 //Default cache size, in bytes
+
+/*!
+ * A process-wide, memory bounded LRU cache of fixed size blocks of remote files.
+ * Files are identified by their filepath, modification date and size, so a file
+ * which changes on the server won't be served stale data.
+ *
+ * Concurrent requests for a block which isn't cached result in a single fetch,
+ * with the other requesters waiting on its result.
+ */
+class BlockCache
+{
+public:
+    typedef std::shared_ptr<const std::string> block_t;
+    typedef std::function<void(std::string &block)> fetcher_t;
+
+    //Disable moving/copying
+    BlockCache(const BlockCache&) = delete;
+    BlockCache(BlockCache&&) = delete;
+
+    /*!
+     * Gets the BlockCache singleton instance.
+     *
+     * @return The BlockCache instance
+     */
+    inline static BlockCache &get_instance()
+    {
+        static BlockCache instance;
+        return instance;
+    }
+
+    /*!
+     * Gets a block of a file, fetching it if it's not already cached.
+     *
+     * @throws An std::exception if the fetch fails
+     * @param file The attributes of the file to get a block of
+     * @param block_index The index of the block within the file
+     * @param fetch Called to load the block if it's not cached. It should fill in the passed
+     * string with the block's data. This may be shorter than BLOCK_CACHE_BLOCK_SIZE for the last block of the file.
+     * @return The block's data
+     */
+    block_t get(const Attributes &file, uint64_t block_index, const fetcher_t &fetch);
+
+    /*!
+     * Checks if a block of a file is cached, or already being fetched
+     *
+     * @param file The attributes of the file
+     * @param block_index The index of the block within the file
+     * @return True if it is, false otherwise
+     */
+    bool contains(const Attributes &file, uint64_t block_index);
+
+    /*!
+     * Sets the maximum number of bytes to cache.
+     * Blocks are evicted, least recently used first, until under it.
+     *
+     * @param bytes The maximum number of bytes of file data to keep in memory
+     */
+    void set_capacity(size_t bytes);
+
+    /*!
+     * Checks if the cache is enabled, that is, it has a capacity
+     *
+     * @return True if it's enabled, false otherwise
+     */
+    bool is_enabled();
+
+    /*!
+     * Gets the number of bytes currently cached
+     *
+     * @return The number of bytes currently cached
+     */
+    size_t get_size();
+private:
+    BlockCache();
+
+    struct Key
+    {
+        std::string filepath;
+        time_t mod_date;
+        size_t size;
+        uint64_t block_index;
+
+        bool operator==(const Key &o) const
+        {
+            return block_index == o.block_index && size == o.size && mod_date == o.mod_date && filepath == o.filepath;
+        }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key &key) const
+        {
+            size_t hash = std::hash<std::string>()(key.filepath);
+            hash ^= std::hash<uint64_t>()(key.block_index) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+            hash ^= std::hash<size_t>()(key.size) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+            hash ^= std::hash<time_t>()(key.mod_date) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+            return hash;
+        }
+    };
+
+    struct Entry
+    {
+        block_t data;
+        std::list<Key>::iterator lru_position;
+    };
+
+    /*!
+     * Evicts least recently used blocks until we're within capacity.
+     * The lock must be held.
+     */
+    void evict();
+
+    //State
+    std::unordered_map<Key, Entry, KeyHash> blocks;
+    std::unordered_map<Key, std::shared_future<block_t>, KeyHash> in_flight;
+    std::list<Key> lru; //Most recently used at the front
+    size_t capacity;
+    size_t size;
+    std::mutex lock;
+};
+
+
+#endif //SFTPMEDIASTREAMER_BLOCKCACHE_H
@@ -0,0 +1,125 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#ifndef SFTPMEDIASTREAMER_BOUNDEDQUEUE_H
+#define SFTPMEDIASTREAMER_BOUNDEDQUEUE_H
+
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+/*!
+ * A fixed capacity, thread-safe FIFO queue for handing work between pipeline stages.
+ * Producers block whilst it's full, so a slow stage holds back those feeding it
+ * rather than letting work pile up. Once closed, consumers drain what's left and then stop.
+ *
+ * @tparam T The type of item queued
+ */
+template<typename T>
+class BoundedQueue
+{
+public:
+    /*!
+     * Constructor
+     *
+     * @param capacity The most items that may be queued at once
+     */
+    explicit BoundedQueue(size_t capacity)
+    : capacity(capacity == 0 ? 1 : capacity),
+      closed(false)
+    {
+
+    }
+
+    /*!
+     * Adds an item, waiting for there to be room if the queue's full
+     *
+     * @param item The item to add
+     * @return True on success, false if the queue has been closed
+     */
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        not_full.wait(guard, [this]() {return closed || items.size() < capacity;});
+        if(closed)
+            return false;
+
+        items.emplace_back(std::move(item));
+        guard.unlock();
+        not_empty.notify_one();
+        return true;
+    }
+
+    /*!
+     * Takes the oldest item, waiting for one to be added if the queue's empty
+     *
+     * @param item Where to store the item
+     * @return True on success, false if the queue has been closed and is empty
+     */
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        not_empty.wait(guard, [this]() {return closed || !items.empty();});
+        if(items.empty())
+            return false;
+
+        item = std::move(items.front());
+        items.pop_front();
+        guard.unlock();
+        not_full.notify_one();
+        return true;
+    }
+
+    /*!
+     * Takes up to 'max' of the oldest items, waiting for at least one to be added if the queue's empty.
+     * Useful for stages which work more efficiently on batches.
+     *
+     * @param batch Where to store the items. Cleared first.
+     * @param max The most items to take
+     * @return True on success, false if the queue has been closed and is empty
+     */
+    bool pop_many(std::vector<T> &batch, size_t max)
+    {
+        batch.clear();
+        std::unique_lock<std::mutex> guard(lock);
+        not_empty.wait(guard, [this]() {return closed || !items.empty();});
+        if(items.empty())
+            return false;
+
+        while(!items.empty() && batch.size() < max)
+        {
+            batch.emplace_back(std::move(items.front()));
+            items.pop_front();
+        }
+        guard.unlock();
+        not_full.notify_all();
+        return true;
+    }
+
+    /*!
+     * Closes the queue. Nothing more can be added, and consumers
+     * stop once they've taken everything that's left.
+     */
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            closed = true;
+        }
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+
+private:
+    std::deque<T> items;
+    size_t capacity;
+    bool closed;
+    std::mutex lock;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+};
+
+
+#endif //SFTPMEDIASTREAMER_BOUNDEDQUEUE_H
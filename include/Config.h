@@ -14,12 +14,23 @@
 
 #define CONFIG_LOG_RETENTION "logging.retention"
 #define CONFIG_MAX_LOG_SIZE "logging.max_log_size"
+#define CONFIG_LOG_TRANSFER_STATS_INTERVAL "logging.transfer_stats_interval"
 #define CONFIG_SFTP_IP "sftp.ip"
 #define CONFIG_SFTP_PORT "sftp.port"
 #define CONFIG_SFTP_USERNAME "sftp.username"
 #define CONFIG_SFTP_PASSWORD "sftp.password"
 #define CONFIG_SFTP_KEYFILE "sftp.keyfile"
+#define CONFIG_SFTP_POOL_SIZE "sftp.pool_size"
+#define CONFIG_SFTP_STRIPED_CONNECTIONS "sftp.striped_connections"
 #define CONFIG_LIBRARY_LOCATION "library.location"
+#define CONFIG_LIBRARY_SYNC_LIST_THREADS "library.sync_list_threads"
+#define CONFIG_LIBRARY_SYNC_THUMBNAIL_THREADS "library.sync_thumbnail_threads"
+#define CONFIG_LIBRARY_SYNC_PROBE_THREADS "library.sync_probe_threads"
+#define CONFIG_LIBRARY_EXEC_LISTING "library.exec_listing"
+#define CONFIG_LIBRARY_WATCH_CHANGES "library.watch_changes"
+#define CONFIG_CACHE_MEMORY_SIZE "cache.memory_size"
+#define CONFIG_CACHE_DISK_LOCATION "cache.disk_location"
+#define CONFIG_CACHE_DISK_SIZE "cache.disk_size"
 
 class Log;
 class Config
@@ -78,7 +89,11 @@ public:
         if(fPos == settings.end())
             throw std::logic_error("Setting '" + key + "' requested from Config. But no setting with that name exists.");
 
-        return std::stoull(fPos->second);
+        //Values prefixed with '0x' are hexadecimal, everything else is decimal (even with leading zeros)
+        const std::string &value = fPos->second;
+        if(value.size() > 2 && value[0] == '0' && (value[1] == 'x' || value[1] == 'X'))
+            return std::stoull(value, nullptr, 16);
+        return std::stoull(value, nullptr, 10);
     }
 
     /*!
@@ -0,0 +1,168 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#ifndef SFTPMEDIASTREAMER_DISKCACHE_H
+#define SFTPMEDIASTREAMER_DISKCACHE_H
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include "Types.h"
+
+#define DISK_CACHE_MAGIC "SKDC1" //Identifies a bitmap file, and its format version
+#define DISK_CACHE_MAX_MAPPED_FILES 16 //Maximum number of cache files to keep mapped at once
+
+/*!
+ * A persistent, size bounded cache of remote file blocks stored on local disk.
+ *
+ * Each remote file is stored as a sparse local file of the same size, with a bitmap
+ * recording which blocks are present. Files are identified by their filepath, modification
+ * date and size. Once the cache is over capacity, whole files are evicted, least recently
+ * used first. Data is read and written through a memory mapping of the local file.
+ */
+class DiskCache
+{
+public:
+    //Disable moving/copying
+    DiskCache(const DiskCache&) = delete;
+    DiskCache(DiskCache&&) = delete;
+    ~DiskCache();
+
+    /*!
+     * Gets the DiskCache singleton instance.
+     *
+     * @return The DiskCache instance
+     */
+    inline static DiskCache &get_instance()
+    {
+        static DiskCache instance;
+        return instance;
+    }
+
+    /*!
+     * Enables the cache, loading any existing entries from disk.
+     * The cache is disabled until this is called.
+     *
+     * @param directory The directory to store cached data in. Created if it doesn't exist.
+     * @param capacity The maximum number of bytes to store. 0 to leave the cache disabled.
+     * @return True on success, false on failure.
+     */
+    bool init(std::string directory, uint64_t capacity);
+
+    /*!
+     * Reads a block of a file from the cache, if it's present.
+     *
+     * @param file The attributes of the remote file
+     * @param block_index The index of the block, of BLOCK_CACHE_BLOCK_SIZE bytes, to read
+     * @param block Where to store the block's data
+     * @return True if the block was cached, false otherwise.
+     */
+    bool read_block(const Attributes &file, uint64_t block_index, std::string &block);
+
+    /*!
+     * Stores a block of a file in the cache.
+     *
+     * @param file The attributes of the remote file
+     * @param block_index The index of the block, of BLOCK_CACHE_BLOCK_SIZE bytes, to store
+     * @param block The block's data. Should be a full block, unless it's the last one in the file.
+     */
+    void write_block(const Attributes &file, uint64_t block_index, const std::string &block);
+
+    /*!
+     * Checks if a block of a file is present in the cache, without reading it
+     *
+     * @param file The attributes of the remote file
+     * @param block_index The index of the block, of BLOCK_CACHE_BLOCK_SIZE bytes
+     * @return True if it's present, false otherwise
+     */
+    bool contains(const Attributes &file, uint64_t block_index);
+
+    /*!
+     * Checks if the cache has been enabled
+     *
+     * @return True if it has, false otherwise
+     */
+    bool is_enabled();
+private:
+    DiskCache();
+
+    //The open local files behind a cached file
+    struct Mapping
+    {
+        ~Mapping();
+
+        char *data = nullptr;
+        size_t size = 0;
+        int data_fd = -1;
+        int bitmap_fd = -1;
+    };
+
+    //A remote file which has at least some blocks cached
+    struct CachedFile
+    {
+        std::string filepath; //Remote filepath
+        time_t mod_date;
+        uint64_t size;
+        std::string local_path; //Local path, without extension
+        std::vector<uint8_t> bitmap; //A bit per block, set if present
+        std::unordered_set<uint64_t> unflushed_blocks; //Present, but not yet flushed to disk, so not marked present there either
+        uint64_t present_bytes;
+        time_t last_access;
+        std::shared_ptr<Mapping> mapping; //Opened on demand. Readers hold a reference whilst copying.
+    };
+
+    /*!
+     * Gets the name used to store a file in the cache
+     *
+     * @param file The remote file's attributes
+     * @return The file's local name, without extension
+     */
+    std::string get_cache_name(const Attributes &file);
+
+    /*!
+     * Loads a cached file's bitmap from disk
+     *
+     * @param local_path The path of the cached file, without extension
+     * @return The loaded file on success, nullptr on failure.
+     */
+    std::shared_ptr<CachedFile> load_cached_file(const std::string &local_path);
+
+    /*!
+     * Opens and maps the local files behind a cached file, if not already done.
+     * The lock must be held.
+     *
+     * @param cached The cached file to map
+     * @return True on success, false on failure.
+     */
+    bool map_cached_file(CachedFile &cached);
+
+    /*!
+     * Evicts least recently used files until we're within capacity.
+     * The lock must be held.
+     *
+     * @param keep The file currently being written, which shouldn't be evicted.
+     */
+    void evict(const std::string &keep);
+
+    /*!
+     * Unmaps files beyond DISK_CACHE_MAX_MAPPED_FILES, least recently used first.
+     * The lock must be held.
+     *
+     * @param keep The file which has just been mapped, which shouldn't be unmapped.
+     */
+    void limit_mapped_files(const CachedFile &keep);
+
+    //State
+    std::unordered_map<std::string, std::shared_ptr<CachedFile>> files;
+    std::string directory;
+    uint64_t capacity;
+    uint64_t used;
+    std::mutex lock;
+};
+
+
+#endif //SFTPMEDIASTREAMER_DISKCACHE_H
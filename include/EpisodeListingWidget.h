@@ -42,6 +42,13 @@ public:
         return episode_entry;
     }
 private:
+    /*!
+     * Describes the episode's media, for its tooltip
+     *
+     * @return One line each for its duration, streams and bitrate. Empty if it's not been probed.
+     */
+    std::string get_media_description();
+
     //Widget stuff
     Gtk::Box box;
     Gtk::Image watched_icon;
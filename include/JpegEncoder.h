@@ -0,0 +1,64 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#ifndef SFTPMEDIASTREAMER_JPEGENCODER_H
+#define SFTPMEDIASTREAMER_JPEGENCODER_H
+
+#include <cstdio>
+#include <csetjmp>
+#include <string>
+#include <vector>
+#include <jpeglib.h>
+
+#define JPEG_ENCODER_INITIAL_BUFFER_SIZE 65536 //Starting size of the output buffer. It's grown as needed, and kept between images.
+
+/*!
+ * Encodes images as JPEGs in memory with libjpeg. The compressor and output buffer are
+ * kept between images, so encoding many of the same size allocates nothing after the first.
+ * Not thread-safe: each thread encoding images should have its own.
+ */
+class JpegEncoder
+{
+public:
+    /*!
+     * Constructor
+     *
+     * @param quality The quality to encode at, from 0 to 100
+     */
+    explicit JpegEncoder(int quality);
+    ~JpegEncoder();
+    JpegEncoder(const JpegEncoder&) = delete;
+    void operator=(const JpegEncoder&) = delete;
+
+    /*!
+     * Encodes an image
+     *
+     * @throws An std::exception on failure
+     * @param pixels The image as RGBA, one byte per channel, with rows packed together
+     * @param width The width of the image
+     * @param height The height of the image
+     * @return The encoded JPEG. Only valid until the next call.
+     */
+    const std::string &encode(const uint8_t *pixels, size_t width, size_t height);
+private:
+    //libjpeg callbacks. The destination ones write into 'buffer'.
+    static void init_destination(j_compress_ptr compressor);
+    static boolean empty_output_buffer(j_compress_ptr compressor);
+    static void term_destination(j_compress_ptr compressor);
+    static void error_exit(j_common_ptr compressor);
+
+    //Each libjpeg structure has the encoder as its client data, so callbacks can get back to it
+    jpeg_compress_struct compressor;
+    jpeg_error_mgr error_manager;
+    jpeg_destination_mgr destination;
+    jmp_buf error_jump; //Where error_exit() returns to. libjpeg can't be unwound through by an exception.
+    char error_message[JMSG_LENGTH_MAX];
+    int quality;
+    std::string buffer;
+    size_t buffer_used; //Bytes of 'buffer' holding the image, once it's been encoded
+    std::vector<uint8_t> row; //Of the image being encoded, converted to RGB
+};
+
+
+#endif //SFTPMEDIASTREAMER_JPEGENCODER_H
@@ -7,28 +7,147 @@
 
 #include <vector>
 #include <string>
+#include <optional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <functional>
 #include <database/season/SeasonRepository.h>
 #include <database/episode/EpisodeRepository.h>
 #include <database/watch_history/WatchHistoryRepository.h>
 #include <database/MiscRepository.h>
-#include "SFTPSession.h"
-#include "Thumbnailer.h"
+#include "SFTPSessionPool.h"
+#include "ThumbnailService.h"
+#include "BoundedQueue.h"
+#include "RemoteWatcher.h"
+
+#define LIBRARY_SYNC_QUEUE_SIZE 64 //Most items waiting between each stage of a sync
+#define LIBRARY_SYNC_LIST_BATCH 32 //Most season directories listed in one batch request
+#define LIBRARY_SYNC_WRITE_BATCH 64 //Most seasons' changes written to the database at once
 
 class Library
 {
 public:
+    //Something a sync has done, which anything showing the library may want to reflect
+    struct SyncEvent
+    {
+        enum Type
+        {
+            SeasonAdded = 0,
+            SeasonUpdated = 1, //Its episodes or thumbnail changed
+            SeasonRemoved = 2,
+            Progress = 3,
+            Finished = 4,
+        };
 
-    Library(std::shared_ptr<SFTPSession> sftp,
+        Type type;
+        uint64_t season_id; //Unset for Progress and Finished
+        uint64_t seasons_done; //Seasons synced so far
+        uint64_t seasons_total; //Seasons which need syncing
+    };
+    typedef std::function<void(const SyncEvent&)> sync_listener_t;
+
+    Library(std::shared_ptr<SFTPSessionPool> sftp,
             std::string library_root,
             std::shared_ptr<SeasonRepository> season_table,
             std::shared_ptr<EpisodeRepository> episode_table,
             std::shared_ptr<WatchHistoryRepository> watch_history_table,
             std::shared_ptr<MiscRepository> misc_table);
+    ~Library();
+
+    /*!
+     * Syncs the season table with what's actually on disk.
+     *
+     * Runs as a pipeline of stages connected by bounded queues: season directories
+     * are listed in parallel, diffed against the database, written to the database
+     * in batches, and then have thumbnails generated in parallel. Every stage runs
+     * at once, so no stage waits for the previous one to finish entirely.
+     *
+     * Only seasons whose directory has been modified since the last sync are listed,
+     * so if nothing has changed then this costs a single listing of the library root.
+     *
+     * @param full_rescan True to list every season regardless
+     */
+    void sync(bool full_rescan = false);
+
+    /*!
+     * Syncs just the given seasons, new or existing, with what's on disk.
+     * Cheaper than a full sync when it's known which seasons have changed.
+     *
+     * @param season_filepaths The filepaths of the season directories to sync
+     * @param removed_filepaths The filepaths of season directories known to have gone.
+     * They're deleted, unless they turn out to have been renamed to one of season_filepaths.
+     */
+    void sync_seasons(const std::vector<std::string> &season_filepaths, const std::vector<std::string> &removed_filepaths = {});
+
+    /*!
+     * Starts a sync on a background thread, so that the library
+     * can be browsed from the database in the meantime. Does nothing
+     * if one is already running.
+     *
+     * @param full_rescan True to list every season regardless
+     */
+    void start_sync(bool full_rescan = false);
+
+    /*!
+     * Cancels a background sync, if one is running, and waits for it
+     * to stop. Work already written to the database is kept, but
+     * thumbnails being generated are abandoned.
+     */
+    void stop_sync();
+
+    /*!
+     * Sets who to tell about what a sync is doing. It's called
+     * from the syncing threads, not the caller's, so it should
+     * hand events off to its own thread rather than act on them.
+     *
+     * @param listener The listener to call. nullptr to stop listening.
+     */
+    void set_sync_listener(sync_listener_t listener);
+
+    /*!
+     * Starts watching the library on the server, so that seasons and episodes
+     * are added and removed as they change, without waiting for the next sync.
+     * Needs inotifywait on the server. Does nothing if already watching.
+     */
+    void start_watching();
+
+    /*!
+     * Stops watching the library on the server, if it is being watched
+     */
+    void stop_watching();
+
+    /*!
+     * Generates thumbnails for seasons in bulk, sync_thumbnail_threads at a time.
+     * Waits for any running sync to finish first.
+     *
+     * @param replace_existing True to regenerate every season's thumbnail, false for just those without one
+     */
+    void generate_thumbnails(bool replace_existing);
+
+    /*!
+     * Loads a season with a given ID
+     *
+     * @throws An std::exception on failure
+     * @param season_id The ID of the season to load
+     * @return The season entry on success
+     */
+    inline std::shared_ptr<SeasonEntry> get_season(uint64_t season_id)
+    {
+        return season_table->load(season_id);
+    }
 
     /*!
-     * Syncs the season table with what's actually on disk
+     * Loads the thumbnail of a season. They're not loaded along with
+     * the season itself, so should be loaded when they're shown.
+     *
+     * @param season_id The ID of the season
+     * @return The thumbnail as a JPEG. Empty if it doesn't have one yet.
      */
-    void sync();
+    inline std::string get_season_thumbnail(uint64_t season_id)
+    {
+        return season_table->load_thumbnail(season_id);
+    }
 
     /*!
      * Deletes a season with a given ID
@@ -122,16 +241,176 @@ public:
      */
     std::shared_ptr<SeasonEntry> get_episode_season(uint64_t episode_id);
 
-    std::string generate_season_thumbnail(const std::string &remote_filepath);
+    /*!
+     * Queues a season to have its thumbnail regenerated. Returns straight away,
+     * with a SeasonUpdated sync event sent once the new thumbnail's been stored.
+     *
+     * @param season_id The ID of the season
+     */
+    void regenerate_season_thumbnail(uint64_t season_id);
 private:
+    //A season directory, and what's in it
+    struct SeasonListing
+    {
+        Attributes season;
+        std::vector<Attributes> entries;
+    };
+
+    //An existing episode whose file has moved or changed
+    struct EpisodeUpdate
+    {
+        uint64_t episode_id;
+        Attributes file; //Where it is now
+        uint64_t fingerprint;
+    };
+
+    //What needs changing in the database for a season
+    struct SeasonChanges
+    {
+        Attributes season;
+        uint64_t season_id; //NO_SUCH_ENTRY if the season itself is new
+        uint64_t entry_count; //Number of entries in the season's directory
+        std::vector<Attributes> new_episodes;
+        std::vector<uint64_t> new_fingerprints; //Of each new episode. 0 if it couldn't be fingerprinted.
+        std::vector<uint64_t> removed_episodes;
+        std::vector<EpisodeUpdate> updated_episodes; //Episodes which have moved or changed on disk
+    };
+
+    //What's known of an episode's file
+    struct IndexedEpisode
+    {
+        uint64_t id;
+        uint64_t size;
+        time_t mod_date;
+        uint64_t fingerprint;
+    };
+
+    //What's in the database, indexed so that listings can be diffed against it in memory
+    struct SyncIndex
+    {
+        std::unordered_map<std::string, uint64_t> season_ids; //Season filepath -> ID
+        std::unordered_map<uint64_t, std::unordered_map<std::string, IndexedEpisode>> episodes; //Season ID -> episode filepath -> episode
+    };
+
+    //An episode to probe the media of
+    struct ProbeJob
+    {
+        uint64_t episode_id;
+        std::string filepath;
+    };
+
+    /*!
+     * Sync stage. Lists season directories, a batch at a time.
+     *
+     * @param input Seasons to list
+     * @param output Where to pass on their listings
+     */
+    void sync_list_stage(BoundedQueue<Attributes> &input, BoundedQueue<SeasonListing> &output);
+
+    /*!
+     * Sync stage. Works out which seasons and episodes are missing from the database,
+     * and which episodes are in it but no longer on disk.
+     *
+     * @param index What was in the database when the sync started
+     * @param input Season listings to diff
+     * @param output Where to pass on anything that needs changing
+     */
+    void sync_diff_stage(const SyncIndex &index, BoundedQueue<SeasonListing> &input, BoundedQueue<SeasonChanges> &output);
+
+    /*!
+     * Sync stage. Adds new seasons and episodes to the database.
+     *
+     * New seasons are handed to the thumbnail service once they've been written.
+     *
+     * @param input Changes to write
+     * @param probes Where to pass on episodes whose media needs probing
+     */
+    void sync_write_stage(BoundedQueue<SeasonChanges> &input, BoundedQueue<ProbeJob> &probes);
+
+    /*!
+     * Sync stage. Probes episodes' container headers for their duration, streams
+     * and bitrate, and stores what's found. Several run at once, as each probe
+     * spends most of its time waiting on a few round trips.
+     *
+     * @param input Episodes to probe
+     */
+    void sync_probe_stage(BoundedQueue<ProbeJob> &input);
+
+    /*!
+     * Stores a thumbnail generated by the thumbnail service. Called from its workers.
+     *
+     * @param season_id The season it's of
+     * @param thumbnail The thumbnail as a JPEG. Nothing's stored if it's empty.
+     */
+    void store_thumbnail(uint64_t season_id, std::string thumbnail);
+
+    /*!
+     * Tells the sync listener, if there is one, about an event
+     *
+     * @param type The type of event
+     * @param season_id The season it concerns, if any
+     */
+    void notify_sync_listener(SyncEvent::Type type, uint64_t season_id = 0);
+
+    /*!
+     * Adds every episode in the database to an index
+     *
+     * @param index The index to add them to
+     */
+    void index_episodes(SyncIndex &index);
+
+    /*!
+     * Finds seasons which have gone, but have really just been renamed to one which has
+     * appeared. Their episodes' sizes, modification times and fingerprints are compared.
+     * Renamed seasons are moved in place, keeping their episodes, watch history and thumbnail.
+     *
+     * @param index What's in the database. Updated with any renamed seasons.
+     * @param vanished The IDs of seasons which have gone. Those which were renamed are removed.
+     * @param appeared Season directories which aren't in the database
+     * @param tree Listings of the appeared directories, if they've already been listed. nullptr to list them over SFTP.
+     */
+    void match_renamed_seasons(SyncIndex &index, std::vector<uint64_t> &vanished, const std::vector<Attributes> &appeared, std::unordered_map<std::string, std::vector<Attributes>> *tree);
+
+    /*!
+     * Deletes seasons which are no longer on disk, in a single batch
+     *
+     * @param vanished The IDs of the seasons to delete
+     */
+    void delete_vanished_seasons(const std::vector<uint64_t> &vanished);
+
+    /*!
+     * Runs seasons through the sync pipeline. See sync().
+     *
+     * @param index What's in the database
+     * @param seasons The season directories to sync
+     * @param tree Listings of the season directories, if they've already been listed. nullptr to list them over SFTP.
+     * @return The number of seasons synced
+     */
+    size_t run_sync_pipeline(const SyncIndex &index, std::vector<Attributes> &seasons, std::unordered_map<std::string, std::vector<Attributes>> *tree);
+
+    /*!
+     * Applies changes reported by the remote watcher
+     *
+     * @param events What changed
+     */
+    void apply_watch_events(const std::vector<RemoteWatcher::Event> &events);
 
 
     //State
     std::string library_root;
-    Thumbnailer thumbnailer;
+    std::unique_ptr<ThumbnailService> thumbnail_service;
+    std::thread sync_thread;
+    std::mutex sync_lock; //Held by whichever sync is running, so they don't both add the same thing
+    std::unique_ptr<RemoteWatcher> watcher;
+    std::atomic<bool> sync_running;
+    std::atomic<bool> sync_cancelled; //Set to have a running sync give up as soon as it can
+    std::atomic<uint64_t> sync_seasons_done;
+    std::atomic<uint64_t> sync_seasons_total;
+    std::mutex sync_listener_lock;
+    sync_listener_t sync_listener;
 
     //Dependencies
-    std::shared_ptr<SFTPSession> sftp;
+    std::shared_ptr<SFTPSessionPool> sftp;
     std::shared_ptr<SeasonRepository> season_table;
     std::shared_ptr<EpisodeRepository> episode_table;
     std::shared_ptr<WatchHistoryRepository> watch_history_table;
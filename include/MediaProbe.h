@@ -0,0 +1,209 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#ifndef SFTPMEDIASTREAMER_MEDIAPROBE_H
+#define SFTPMEDIASTREAMER_MEDIAPROBE_H
+
+#include <string>
+#include <functional>
+#include <stdexcept>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include "Types.h"
+
+#define MEDIA_PROBE_READ_SIZE 65536 //Reads are rounded up to at least this, so neighbouring fields come in the same round trip
+#define MEDIA_PROBE_MAX_READ 4194304 //Most bytes read from one file before giving up
+#define MEDIA_PROBE_MAX_KEYFRAME_RANGE 4194304 //Most bytes fetched for a keyframe, if the index doesn't say where it ends
+
+//What's known about a media file's content
+struct MediaInfo
+{
+    uint64_t duration; //Milliseconds. 0 if unknown.
+    uint64_t width; //Of the first video stream. 0 if there isn't one.
+    uint64_t height;
+    std::string video_codec; //Empty if there's no video stream
+    std::string audio_codec; //Of the first audio stream. Empty if there isn't one.
+    uint64_t audio_channels;
+    uint64_t bitrate; //Averaged over the whole file, in bits per second. 0 if unknown.
+};
+
+//Where a keyframe is, and which parts of the file are needed to decode it
+struct KeyframeLocation
+{
+    uint64_t time; //Milliseconds from the start of the media
+    std::vector<ByteRange> ranges; //The container's headers and index, and the keyframe itself. Sorted and not overlapping.
+};
+
+/*!
+ * Works out the duration, streams and bitrate of Matroska and MP4 files by
+ * parsing their container headers. Only the header and index structures are read,
+ * never the media itself, so probing a remote file takes a handful of round trips.
+ */
+class MediaProbe
+{
+public:
+    //Thrown if the file isn't in a container that's understood
+    class UnsupportedError : public std::runtime_error
+    {
+    public:
+        explicit UnsupportedError(const std::string &e)
+        : std::runtime_error(e)
+        {}
+    };
+
+    /*!
+     * Reads part of the file being probed
+     *
+     * @throws An std::exception on failure
+     * @param offset Where to read from
+     * @param length The number of bytes wanted
+     * @return The bytes read. Shorter than 'length' only at the end of the file.
+     */
+    typedef std::function<std::string(uint64_t offset, size_t length)> read_t;
+
+    /*!
+     * Constructor
+     *
+     * @param size The size of the file in bytes
+     * @param read Called to read from the file
+     */
+    MediaProbe(uint64_t size, read_t read);
+
+    /*!
+     * Probes the file
+     *
+     * @throws An UnsupportedError if the file can't be parsed, or whatever 'read' throws
+     * @return What was found
+     */
+    MediaInfo probe();
+
+    /*!
+     * Finds the last keyframe at or before a point in the media, through the container's
+     * index (Matroska cues, or MP4 sample tables), rather than by reading the media.
+     *
+     * @throws An UnsupportedError if the file can't be parsed or has no index, or whatever 'read' throws
+     * @param position How far into the media to look, from 0 to 1
+     * @return Where the keyframe is
+     */
+    KeyframeLocation locate_keyframe(double position);
+private:
+    /*!
+     * Reads from the file through a buffer, so that small nearby
+     * reads don't each cost a round trip
+     *
+     * @throws An UnsupportedError if too much has been read, or whatever 'read' throws
+     * @param offset Where to read from
+     * @param length The number of bytes wanted
+     * @return The bytes read. Shorter than 'length' only at the end of the file.
+     */
+    std::string read_range(uint64_t offset, size_t length);
+
+    /*!
+     * Reads a Matroska variable length integer
+     *
+     * @throws An UnsupportedError if it's malformed
+     * @param offset Where it starts. Moved past it.
+     * @param keep_marker True for element IDs, which keep their length marker bits
+     * @return The integer. All ones if the size is 'unknown'.
+     */
+    uint64_t read_vint(uint64_t &offset, bool keep_marker);
+
+    /*!
+     * Reads the ID and size of a Matroska element
+     *
+     * @throws An UnsupportedError if they're malformed
+     * @param offset Where the element starts. Moved to the start of its body.
+     * @param end The end of whatever the element is within
+     * @param length Set to the size of the element's body, cut short if it would run past 'end'
+     * @return The element's ID
+     */
+    uint64_t read_element_header(uint64_t &offset, uint64_t end, uint64_t &length);
+
+    /*!
+     * Reads a big endian unsigned integer from the file
+     *
+     * @throws An UnsupportedError if it's past the end of the file
+     * @param offset Where it starts
+     * @param length Its size in bytes, up to 8
+     * @return The integer
+     */
+    uint64_t read_integer(uint64_t offset, size_t length);
+
+    /*!
+     * Finds the Matroska segment, and where its top level elements are. Those before the first
+     * cluster are found by walking the segment, and any others through its seek head.
+     *
+     * @throws An UnsupportedError if there's no segment
+     * @param segment_start Set to the offset of the segment's body
+     * @param segment_end Set to the end of the segment
+     * @param elements Filled with the offset of each top level element, by ID
+     * @param headers Filled with the ranges making up everything before the first cluster, bar attachments
+     */
+    void scan_matroska_segment(uint64_t &segment_start, uint64_t &segment_end, std::unordered_map<uint64_t, uint64_t> &elements, std::vector<ByteRange> &headers);
+
+    /*!
+     * Finds the body of a top level Matroska element
+     *
+     * @param elements Where each element is, from scan_matroska_segment
+     * @param id The ID of the element
+     * @param segment_end The end of the segment
+     * @param body_start Set to the offset of the element's body
+     * @param body_end Set to the end of the element
+     * @return True if it was found, false otherwise
+     */
+    bool find_matroska_element(const std::unordered_map<uint64_t, uint64_t> &elements, uint64_t id, uint64_t segment_end, uint64_t &body_start, uint64_t &body_end);
+
+    MediaInfo probe_matroska();
+    KeyframeLocation locate_matroska_keyframe(double position);
+    void parse_matroska_info(uint64_t offset, uint64_t end, MediaInfo &info);
+    void parse_matroska_tracks(uint64_t offset, uint64_t end, MediaInfo &info);
+
+    /*!
+     * Checks that the file looks like an MP4, going by its first box
+     *
+     * @throws An UnsupportedError if it doesn't
+     */
+    void check_mp4_signature();
+
+    MediaInfo probe_mp4();
+    KeyframeLocation locate_mp4_keyframe(double position);
+    void parse_mp4_trak(uint64_t offset, uint64_t end, MediaInfo &info);
+
+    /*!
+     * Reads the header of the MP4 box at an offset
+     *
+     * @throws An UnsupportedError if it's malformed
+     * @param offset Where the box starts
+     * @param end The end of whatever the box is within
+     * @param type Set to the four character type of the box
+     * @param body_start Set to the offset of the box's body
+     * @param body_end Set to the offset just past the box
+     * @return True if there's a box there, false if 'end' has been reached
+     */
+    bool next_mp4_box(uint64_t offset, uint64_t end, std::string &type, uint64_t &body_start, uint64_t &body_end);
+
+    /*!
+     * Finds the first MP4 box of a given type
+     *
+     * @param offset Where to start looking
+     * @param end Where to stop looking
+     * @param type The four character type of the box
+     * @param body_start Set to the offset of the box's body
+     * @param body_end Set to the offset just past the box
+     * @return True if it was found, false otherwise
+     */
+    bool find_mp4_box(uint64_t offset, uint64_t end, const char *type, uint64_t &body_start, uint64_t &body_end);
+
+    uint64_t size;
+    read_t read;
+    std::string buffer;
+    uint64_t buffer_offset; //File offset of buffer[0]
+    uint64_t total_read;
+    uint64_t timecode_scale; //Of a Matroska file. Nanoseconds per timecode.
+    uint64_t video_track; //Number of a Matroska file's first video track
+};
+
+
+#endif //SFTPMEDIASTREAMER_MEDIAPROBE_H
@@ -0,0 +1,103 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#ifndef SFTPMEDIASTREAMER_REMOTEWATCHER_H
+#define SFTPMEDIASTREAMER_REMOTEWATCHER_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+
+#define REMOTE_WATCHER_DEBOUNCE_MS 2000 //How long the tree must be quiet before changes are passed on, so bulk copies arrive together
+#define REMOTE_WATCHER_POLL_MS 250 //How often the watcher thread checks if it should stop
+#define REMOTE_WATCHER_RETRY_SECONDS 30 //How long to wait before restarting the watcher if it fails
+
+/*!
+ * Watches a directory tree on the server for files and directories being
+ * created, deleted, moved or written to, by running inotifywait over an exec channel.
+ * Changes are pushed by the server as they happen, so nothing is polled,
+ * and the connection is idle whilst nothing changes.
+ *
+ * The watcher runs on its own thread with its own SSH connection, which is
+ * restarted if it drops. Note that inotify needs a watch per directory, so
+ * very large trees may need the server's fs.inotify.max_user_watches raising.
+ */
+class RemoteWatcher
+{
+public:
+    //A change to the tree
+    struct Event
+    {
+        enum Type
+        {
+            Created = 0, //Created, or moved into the tree
+            Deleted = 1, //Deleted, or moved out of the tree
+            Modified = 2, //A file finished being written to, such as once a copy into the tree completes
+        };
+
+        Type type;
+        bool is_directory;
+        std::string filepath;
+    };
+    typedef std::function<void(std::vector<Event>)> callback_t;
+
+    /*!
+     * Starts watching. The connection is made by the watcher
+     * thread itself, so this does not block.
+     *
+     * @param hostname The hostname of the ssh server
+     * @param port The port of the ssh server
+     * @param username The username to authenticate as
+     * @param root The directory to watch, and everything below it
+     * @param callback Called on the watcher's thread with each batch of changes, in the order they happened
+     */
+    RemoteWatcher(std::string hostname, int port, std::string username, std::string root, callback_t callback);
+    ~RemoteWatcher();
+    RemoteWatcher(const RemoteWatcher&) = delete;
+    void operator=(const RemoteWatcher&) = delete;
+
+    /*!
+     * Stops watching, and waits for the watcher thread to finish
+     */
+    void stop();
+private:
+
+    /*!
+     * Entry point of the watcher thread. Watches until stopped, restarting on failure.
+     */
+    void watcher_thread();
+
+    /*!
+     * Connects and watches, until stopped or something fails
+     *
+     * @throws An std::runtime_error on failure
+     */
+    void watch();
+
+    /*!
+     * Parses a line of inotifywait's output
+     *
+     * @param line The line to parse
+     * @param events Where to add the event, if it's one we're interested in
+     */
+    static void parse_event(const std::string &line, std::vector<Event> &events);
+
+    std::string hostname;
+    int port;
+    std::string username;
+    std::string root;
+    callback_t callback;
+
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable stop_cv;
+    bool running;
+    bool gave_up; //Set if the watcher can never work, such as if inotifywait isn't installed
+};
+
+
+#endif //SFTPMEDIASTREAMER_REMOTEWATCHER_H
@@ -0,0 +1,162 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#ifndef SFTPMEDIASTREAMER_SFTPBATCH_H
+#define SFTPMEDIASTREAMER_SFTPBATCH_H
+
+#include <string>
+#include <unordered_map>
+#include <libssh/libssh.h>
+#include <libssh/sftp.h>
+#include "Types.h"
+
+//SFTP v3 packet types, see draft-ietf-secsh-filexfer-02
+#define SFTP_BATCH_FXP_INIT 1
+#define SFTP_BATCH_FXP_VERSION 2
+#define SFTP_BATCH_FXP_OPEN 3
+#define SFTP_BATCH_FXP_CLOSE 4
+#define SFTP_BATCH_FXP_READ 5
+#define SFTP_BATCH_FXP_OPENDIR 11
+#define SFTP_BATCH_FXP_READDIR 12
+#define SFTP_BATCH_FXP_STAT 17
+#define SFTP_BATCH_FXP_STATUS 101
+#define SFTP_BATCH_FXP_HANDLE 102
+#define SFTP_BATCH_FXP_DATA 103
+#define SFTP_BATCH_FXP_NAME 104
+#define SFTP_BATCH_FXP_ATTRS 105
+
+/*!
+ * Speaks SFTP v3 over its own SFTP subsystem channel, so that many requests can
+ * be put on the wire before waiting for their replies. libssh's own calls wait a
+ * full round trip for each one.
+ *
+ * The channel is separate to libssh's SFTP session, so handles opened through
+ * one can't be used with the other. If anything fails part way through, replies
+ * may still be outstanding, so the batch must be discarded rather than reused.
+ */
+class SFTPBatch
+{
+public:
+    //A reply from the server, and a cursor for unpacking it
+    struct Reply
+    {
+        uint8_t type;
+        std::string payload;
+        size_t position;
+
+        /*!
+         * Unpacks the next field of the reply
+         *
+         * @throws An std::runtime_error if the reply is too short
+         */
+        uint32_t read_uint32();
+        uint64_t read_uint64();
+        std::string read_string();
+
+        /*!
+         * Unpacks an ATTRS structure
+         *
+         * @throws An std::runtime_error if the reply is too short
+         * @param filepath The filepath the attributes are of
+         * @return The unpacked attributes
+         */
+        Attributes read_attributes(const std::string &filepath);
+
+        /*!
+         * Checks if this is a status reply carrying a given code
+         *
+         * @param code The SSH_FX_* code to check for
+         * @return True if it is, false otherwise
+         */
+        bool is_status(uint32_t code);
+    };
+
+    /*!
+     * Opens a channel to the server's SFTP subsystem
+     *
+     * @throws An std::runtime_error on failure
+     * @param session The SSH session to open the channel through
+     */
+    explicit SFTPBatch(ssh_session session);
+    ~SFTPBatch();
+    SFTPBatch(const SFTPBatch&) = delete;
+    void operator=(const SFTPBatch&) = delete;
+
+    /*!
+     * Sends a request, without waiting for its reply. If the channel's window has
+     * no room left for it, then reads replies until the server makes some.
+     *
+     * @throws An std::runtime_error on failure
+     * @return The ID of the request, to receive the reply with
+     */
+    uint32_t send_open(const std::string &filepath);
+    uint32_t send_close(const std::string &handle);
+    uint32_t send_read(const std::string &handle, uint64_t offset, uint32_t length);
+    uint32_t send_opendir(const std::string &filepath);
+    uint32_t send_readdir(const std::string &handle);
+    uint32_t send_stat(const std::string &filepath);
+
+    /*!
+     * Waits for the reply to a request. Replies to other requests which
+     * arrive first are kept until they're asked for.
+     *
+     * @throws An std::runtime_error if the channel fails
+     * @param id The ID of the request to get the reply to
+     * @return The reply
+     */
+    Reply receive(uint32_t id);
+private:
+
+    /*!
+     * Reads the next packet off the channel
+     *
+     * @throws An std::runtime_error if the channel fails, or the packet is malformed
+     * @return The packet, positioned after its type
+     */
+    Reply receive_packet();
+
+    /*!
+     * Reads the next reply off the channel, keeping it until it's asked for
+     *
+     * @throws An std::runtime_error if the channel fails, or the packet is malformed
+     */
+    void stash_reply();
+
+    /*!
+     * Sends a request
+     *
+     * @throws An std::runtime_error on failure
+     * @param type The SSH_FXP_* type of the request
+     * @param body The request's fields, after the ID
+     * @return The ID of the request
+     */
+    uint32_t send(uint8_t type, const std::string &body);
+
+    /*!
+     * Writes a whole packet to the channel
+     *
+     * @throws An std::runtime_error on failure
+     * @param packet The packet, including its length
+     */
+    void write_packet(const std::string &packet);
+
+    /*!
+     * Reads exactly 'length' bytes from the channel
+     *
+     * @throws An std::runtime_error on failure
+     */
+    void read_exact(char *buffer, size_t length);
+
+    static void write_uint32(std::string &buffer, uint32_t value);
+    static void write_string(std::string &buffer, const std::string &value);
+
+    ssh_session session;
+    ssh_channel channel;
+    uint32_t next_id;
+    size_t in_flight; //Requests sent whose replies haven't been read off the channel yet
+    std::unordered_map<uint32_t, Reply> stashed; //Replies which arrived before they were asked for
+};
+
+
+#endif //SFTPMEDIASTREAMER_SFTPBATCH_H
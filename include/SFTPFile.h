@@ -8,7 +8,17 @@
 
 #include <libssh/sftp.h>
 #include <string>
+#include <deque>
+#include <chrono>
+#include <limits>
+#include <memory>
 #include "Types.h"
+#include "TransferStats.h"
+
+#define SFTP_READ_AHEAD_CHUNK_SIZE 32768 //Size of each read request. 32KB is the largest size all servers must support.
+#define SFTP_READ_AHEAD_MIN_DEPTH 2 //Minimum number of read requests to keep in flight
+#define SFTP_READ_AHEAD_MAX_DEPTH 64 //Maximum number of read requests to keep in flight
+#define SFTP_MAX_ABANDONED_REQUESTS 256 //Abandoned requests allowed to pile up before waiting for their responses
 
 class SFTPFile
 {
@@ -21,11 +31,16 @@ public:
     void operator=(SFTPFile &&)=delete;
 
     /*!
-     * Enables async transfers for the file with a given buffer size
+     * Enables async transfers for the file with a given buffer size.
+     *
+     * Once enabled, a window of read requests is kept in flight ahead
+     * of the read cursor, so that sequential reads don't wait a full round
+     * trip for each chunk. The number of requests in flight adapts to the
+     * measured bandwidth * RTT of the connection.
      *
-     * @param buffersz The buffer size to use
+     * @param buffersz The size of each read request
      */
-    void enable_async(size_t buffersz = 16384);
+    void enable_async(size_t buffersz = SFTP_READ_AHEAD_CHUNK_SIZE);
 
     /*!
      * Should be called if enable_async is set to
@@ -38,11 +53,14 @@ public:
     size_t read_async(void *buff);
 
     /*!
-     * Reads into a buffer
+     * Reads into a buffer. If async transfers are enabled, then
+     * data is served from the read-ahead window, blocking only if
+     * the data hasn't arrived yet. Requests which fit in the space left
+     * in 'buff' are received straight into it, rather than through the async buffer.
      *
      * @param buff Buffer to read into
      * @param buffsz Your buffer size
-     * @return Number of bytes actually read
+     * @return Number of bytes actually read, or -1 on error
      */
     ssize_t read(void *buff, size_t buffsz);
 
@@ -66,7 +84,10 @@ public:
     size_t tellg();
 
     /*!
-     * Seeks to a specific offset within the file
+     * Seeks to a specific offset within the file.
+     * If async transfers are enabled, this only moves the cursor. The read-ahead
+     * window is left alone until the next read, which uses whatever was already requested
+     * if the cursor is still within it, and only restarts the window if it's not.
      *
      * @param offset Offset from the beginning of the file to seek to
      * @return True on success, false on failure.
@@ -80,6 +101,13 @@ public:
      */
     size_t size();
 
+    /*!
+     * Gets the attributes of the file, as they were when it was opened
+     *
+     * @return The file's attributes
+     */
+    const Attributes &get_attributes();
+
     /*!
      * Gets the async buffer size. When calling async_read, your
      * buffer needs to be this large.
@@ -87,13 +115,126 @@ public:
      * @return Async buffer size
      */
     size_t get_async_buffer_size();
+
+    /*!
+     * Stops the read-ahead window from requesting data past a given offset.
+     * Useful when only a known range of the file is wanted.
+     *
+     * @param offset The offset to stop at. Or std::numeric_limits<uint64_t>::max() for no limit.
+     */
+    void set_read_ahead_limit(uint64_t offset);
+
+    /*!
+     * Gets the number of read requests currently in flight
+     *
+     * @return The number of outstanding read requests
+     */
+    size_t get_pipeline_depth();
+
+    /*!
+     * Gets the transfer counters of the file. These are shared,
+     * so that whatever wraps the file can record into them too.
+     *
+     * @return The file's transfer counters
+     */
+    const std::shared_ptr<TransferStats> &get_stats();
+
+    /*!
+     * Records into other transfer counters from now on, such as those of
+     * another file which this is reading part of the same transfer for.
+     * Not thread-safe, so should be called before reading.
+     *
+     * @param stats_ The counters to record into
+     */
+    void set_stats(std::shared_ptr<TransferStats> stats_);
 private:
+    //An outstanding sftp_async_read_begin request
+    struct ReadRequest
+    {
+        uint64_t offset;
+        uint32_t length;
+        uint32_t id;
+        std::chrono::steady_clock::time_point issue_time;
+    };
+
     explicit SFTPFile(sftp_file file, Attributes attributes);
+
+    /*!
+     * Issues read requests until the target pipeline depth is reached,
+     * or there's nothing left in the file to request.
+     */
+    void fill_pipeline();
+
+    /*!
+     * Waits for the oldest read request to complete, storing
+     * its data in the async buffer.
+     *
+     * If a destination is given, the data is handed straight to the reader
+     * instead: it's written there, and the read cursor moved past it.
+     * The request must start at the read cursor and fit in the destination.
+     *
+     * @param block True if we should wait for the data to arrive. False to return if it's not ready yet.
+     * @param destination Where to receive the data to. Null to use the async buffer.
+     * @return SSH_OK on success, SSH_AGAIN if not blocking and the data isn't ready yet, SSH_EOF
+     * if the server reported EOF, or SSH_ERROR on failure.
+     */
+    int receive_head(bool block, char *destination = nullptr);
+
+    /*!
+     * Brings the read-ahead window in line with the read cursor, after a seek.
+     * Requests ending before the cursor are abandoned. If the cursor is outside
+     * of the window entirely, everything is abandoned and the window restarted from it.
+     */
+    void reposition_pipeline();
+
+    /*!
+     * Moves a request onto the abandoned list, for its response to be discarded when it arrives
+     *
+     * @param request The request to abandon
+     */
+    void abandon_request(const ReadRequest &request);
+
+    /*!
+     * Discards the responses of abandoned requests
+     *
+     * @param block True to wait for all of them. False to only collect those which have already arrived.
+     */
+    void reap_abandoned(bool block);
+
+    /*!
+     * Collects and discards every read request which is still in flight,
+     * so that stale responses aren't left queued within the session.
+     */
+    void drain_pipeline();
+
+    /*!
+     * Updates the bandwidth/RTT estimates after a request completes,
+     * and recalculates the target pipeline depth from them.
+     *
+     * @param request The request which just completed
+     * @param bytes The number of bytes it returned
+     */
+    void update_pipeline_estimates(const ReadRequest &request, size_t bytes);
+
     sftp_file file;
     Attributes attributes;
-    std::string async_buffer;
     bool open;
-    int async_request;
+    std::shared_ptr<TransferStats> stats;
+
+    //Read-ahead state
+    std::deque<ReadRequest> in_flight; //Outstanding requests, in file order
+    std::deque<ReadRequest> abandoned; //Outstanding requests whose data is no longer wanted, in the order they were issued
+    std::string discard_buffer; //Where abandoned responses are received to
+    std::string async_buffer; //Data of the most recently completed request
+    uint64_t async_buffer_offset; //File offset of async_buffer[0]
+    size_t async_buffer_length; //Number of valid bytes in async_buffer
+    uint64_t read_offset; //Read cursor
+    uint64_t request_offset; //Offset of the next byte to request
+    uint64_t read_ahead_limit; //Offset past which nothing should be requested
+    size_t target_depth; //Number of requests we want in flight
+    double bandwidth_estimate; //Bytes per second
+    double min_rtt; //Lowest request latency seen, in seconds
+    std::chrono::steady_clock::time_point last_completion;
 };
 
 
@@ -7,10 +7,17 @@
 
 #include <libssh/sftp.h>
 #include <vector>
+#include <memory>
+#include <optional>
 #include "SSHConnection.h"
 #include "SFTPFile.h"
 #include "Types.h"
 
+//Files are fingerprinted by hashing this many bytes from each of their start, middle and end
+#define SFTP_FINGERPRINT_SAMPLE_SIZE 4096
+#define SFTP_FINGERPRINT_SAMPLE_COUNT 3
+
+class SFTPBatch;
 class SFTPSession
 {
 public:
@@ -41,6 +48,16 @@ public:
      */
     SFTPFile open(const std::string &filepath);
 
+    /*!
+     * Opens a remote file whose attributes are already known, such as
+     * from a directory listing. Saves a round trip over open(filepath).
+     *
+     * @throws An std::exception on failure
+     * @param attributes The attributes of the file to open
+     * @return The file on success, throws an std::exception on failure
+     */
+    SFTPFile open(const Attributes &attributes);
+
     /*!
      * Stats a filepath
      *
@@ -49,9 +66,63 @@ public:
      * @return Attributes on success. Throws an std::runtime_error on failure
      */
     Attributes stat(const std::string &filepath);
+
+    /*!
+     * Stats several filepaths at once. Every request is sent before any
+     * replies are waited for, so this takes about one round trip in total.
+     *
+     * @throws An std::exception if the session fails
+     * @param filepaths The filepaths to stat
+     * @return The attributes of each filepath, in the same order. Empty for those which couldn't be statted.
+     */
+    std::vector<std::optional<Attributes>> stat_many(const std::vector<std::string> &filepaths);
+
+    /*!
+     * Lists several directories at once. Their listings are read in lock-step,
+     * so this takes a few round trips in total, rather than a few per directory.
+     *
+     * @throws An std::exception if the session fails
+     * @param filepaths The filepaths of the directories to enumerate
+     * @return The listing of each directory, in the same order. Empty for those which couldn't be listed.
+     */
+    std::vector<std::optional<std::vector<Attributes>>> enumerate_many(const std::vector<std::string> &filepaths);
+
+    /*!
+     * Fingerprints several remote files at once, by hashing a few small ranges
+     * sampled from each. Files with the same size, modification time and fingerprint
+     * are almost certainly the same file, so it's used to recognise files which have moved.
+     * Every file is opened, sampled and closed in lock-step, so this takes a few round trips in total.
+     *
+     * @throws An std::exception if the session fails
+     * @param files The attributes of the files to fingerprint
+     * @return The fingerprint of each file, in the same order. Never 0. Empty for those which couldn't be read.
+     */
+    std::vector<std::optional<uint64_t>> fingerprint_many(const std::vector<Attributes> &files);
 private:
+
+    /*!
+     * Converts libssh attributes into our own, freeing them
+     *
+     * @param filepath The filepath the attributes are of
+     * @param attributes The attributes to convert. Freed by this call.
+     * @return The converted attributes
+     */
+    Attributes convert_attributes(const std::string &filepath, sftp_attributes attributes);
+
+    /*!
+     * Runs a set of batched requests, opening the batch channel first if needed.
+     * If they throw, replies may still be outstanding, so the channel is discarded.
+     *
+     * @throws Whatever the operations throw
+     * @param operations Called with the batch to make requests through
+     * @return What the operations return
+     */
+    template<typename Operations>
+    auto run_batch(Operations &&operations);
+
     SSHConnection *ssh;
     sftp_session sftp;
+    std::unique_ptr<SFTPBatch> batch; //Opened on first use, see the *_many functions
 };
 
 #endif //SFTPMEDIASTREAMER_SFTPSESSION_H
@@ -0,0 +1,172 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#ifndef SFTPMEDIASTREAMER_SFTPSESSIONPOOL_H
+#define SFTPMEDIASTREAMER_SFTPSESSIONPOOL_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include "SSHConnection.h"
+#include "SFTPSession.h"
+
+//Sessions idle for longer than this are checked with a round trip before being handed out
+#define SFTP_POOL_IDLE_CHECK_SECONDS 30
+
+//How many sessions background work must leave free for interactive checkouts, if the pool's big enough
+#define SFTP_POOL_INTERACTIVE_RESERVED 1
+
+/*!
+ * A thread-safe pool of SFTP sessions, each with its own SSH connection.
+ * A session may only be used by whoever has it checked out, so that library
+ * syncs, thumbnail generation and playback can all run at the same time.
+ *
+ * Sessions are created on demand, up to the pool's size. Once that is reached,
+ * checkouts wait for one to be returned. Background work can't check out the last
+ * SFTP_POOL_INTERACTIVE_RESERVED sessions, so that the GUI thread never waits on a sync.
+ */
+class SFTPSessionPool
+{
+    struct Entry
+    {
+        std::unique_ptr<SSHConnection> connection;
+        std::unique_ptr<SFTPSession> session;
+        std::chrono::steady_clock::time_point last_used;
+        bool interactive = false; //If it's checked out by checkout_interactive()
+    };
+public:
+
+    /*!
+     * A checked out session. It's returned to the pool when this is destroyed,
+     * so anything opened through it must be closed first.
+     */
+    class Handle
+    {
+    public:
+        Handle();
+        ~Handle();
+        Handle(Handle &&other) noexcept;
+        Handle &operator=(Handle &&other) noexcept;
+        Handle(const Handle&) = delete;
+        void operator=(const Handle&) = delete;
+
+        SFTPSession *operator->();
+        SFTPSession &operator*();
+
+        /*!
+         * Gets the SSH connection the session runs over, for
+         * things which need more than SFTP, such as running commands.
+         *
+         * @return The session's connection
+         */
+        SSHConnection &get_connection();
+
+        /*!
+         * Returns the session to the pool early. Does nothing if the handle is empty.
+         */
+        void release();
+
+        /*!
+         * Checks if the handle holds a session
+         *
+         * @return True if it does, false otherwise
+         */
+        explicit operator bool() const;
+    private:
+        friend class SFTPSessionPool;
+        Handle(SFTPSessionPool *pool, std::unique_ptr<Entry> entry);
+
+        SFTPSessionPool *pool;
+        std::unique_ptr<Entry> entry;
+    };
+
+    /*!
+     * Constructor. No connections are made until they're needed.
+     *
+     * @param hostname The hostname of the ssh server
+     * @param port The port of the ssh server
+     * @param username The username to authenticate as
+     * @param max_size The most sessions that may be open at once
+     */
+    SFTPSessionPool(std::string hostname, int port, std::string username, size_t max_size);
+    SFTPSessionPool(const SFTPSessionPool&) = delete;
+    void operator=(const SFTPSessionPool&) = delete;
+
+    /*!
+     * Checks out a session, waiting for one to be free if the pool is exhausted.
+     * Idle sessions which have dropped are replaced with new ones.
+     *
+     * @throws An std::exception if a new session had to be made but couldn't be
+     * @return The checked out session
+     */
+    Handle checkout();
+
+    /*!
+     * Checks out a session for something the user is waiting on, such as playback.
+     * These may use the sessions reserved from background work, so they only
+     * wait if other interactive checkouts are holding every session.
+     *
+     * @throws An std::exception if a new session had to be made but couldn't be
+     * @return The checked out session
+     */
+    Handle checkout_interactive();
+
+    /*!
+     * Gets the most sessions that may be open at once
+     *
+     * @return The pool's size
+     */
+    size_t get_max_size();
+private:
+
+    /*!
+     * Checks out a session, waiting for one to be free if the pool is exhausted
+     *
+     * @throws An std::exception if a new session had to be made but couldn't be
+     * @param interactive True if it may use the sessions reserved for interactive use
+     * @return The checked out session
+     */
+    Handle checkout(bool interactive);
+
+    /*!
+     * Makes a new connection and session
+     *
+     * @throws An std::exception on failure
+     * @return The new session
+     */
+    std::unique_ptr<Entry> create_entry();
+
+    /*!
+     * Checks that a session still works
+     *
+     * @param entry The session to check
+     * @return True if it's usable, false otherwise
+     */
+    bool is_healthy(Entry &entry);
+
+    /*!
+     * Returns a session to the pool
+     *
+     * @param entry The session to return
+     */
+    void release(std::unique_ptr<Entry> entry);
+
+    std::string hostname;
+    int port;
+    std::string username;
+    size_t max_size;
+    size_t background_max_size; //The most sessions background work may have checked out at once
+
+    std::vector<std::unique_ptr<Entry>> idle;
+    size_t open_count; //Sessions that exist, or are being made, whether idle or not
+    size_t background_count; //Sessions checked out by background work, or being made for it
+    std::mutex lock;
+    std::condition_variable released_cv;
+};
+
+
+#endif //SFTPMEDIASTREAMER_SFTPSESSIONPOOL_H
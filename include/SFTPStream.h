@@ -6,14 +6,58 @@
 #define SFTPMEDIASTREAMER_SFTPSTREAM_H
 
 #include <memory>
+#include <map>
+#include <future>
+#include <chrono>
 #include <SFML/System/InputStream.hpp>
 #include "SFTPFile.h"
+#include "BlockCache.h"
+#include "SFTPStripedReader.h"
 
+//The number of blocks to keep requested ahead of the reader when striping
+#define SFTP_STRIPED_READ_AHEAD_BLOCKS 8
+#define SFTP_STRIPED_MAX_READ_AHEAD_BLOCKS 64 //Most blocks requested ahead, however high the bitrate
+#define SFTP_STRIPED_READ_AHEAD_SECONDS 4 //Seconds of playback to keep requested ahead, if the bitrate's known
+#define SFTP_READ_AHEAD_BLOCKS 16 //Most uncached blocks past the one being fetched which the unstriped read-ahead window may run on into
+
+/*!
+ * Exposes a remote file as an sf::InputStream. Reads are served in blocks
+ * through the process-wide BlockCache, so readers of the same file share data.
+ * Blocks missing from memory are looked for in the DiskCache before being fetched.
+ *
+ * If given an SFTPStripedReader, blocks are fetched through that instead, with
+ * several blocks ahead of the reader requested at once, spread across its connections.
+ *
+ * If enabled with enable_stats_logging(), transfer counters are logged every
+ * logging.transfer_stats_interval seconds whilst reading, and once more as a
+ * summary when the stream is destroyed.
+ */
 class SFTPStream : public sf::InputStream
 {
 public:
 
-    explicit SFTPStream(std::unique_ptr<SFTPFile> file);
+    /*!
+     * Constructor
+     *
+     * @param file The remote file to stream
+     * @param striped_reader Optional reader to fetch blocks across several connections with. Null to use 'file' alone.
+     */
+    explicit SFTPStream(std::unique_ptr<SFTPFile> file, std::unique_ptr<SFTPStripedReader> striped_reader = nullptr);
+    ~SFTPStream() override;
+
+    /*!
+     * Sizes the striped read-ahead window to cover a few seconds of playback,
+     * rather than a fixed number of blocks. It's never made smaller than the default.
+     *
+     * @param bitrate The file's average bitrate, in bits per second
+     */
+    void set_bitrate(uint64_t bitrate);
+
+    /*!
+     * Logs the stream's transfer counters periodically, and as a summary once it's destroyed.
+     * Meant for playback, as logging for every short-lived stream would flood the log.
+     */
+    void enable_stats_logging();
 
     ////////////////////////////////////////////////////////////
     /// \brief Read data from the stream
@@ -54,8 +98,62 @@ public:
     ///
     ////////////////////////////////////////////////////////////
     sf::Int64 getSize() override;
+
+    /*!
+     * Gets the transfer counters of the stream. Safe to call from any thread.
+     *
+     * @return The stream's transfer counters
+     */
+    TransferStats::Snapshot get_stats();
 private:
+
+    /*!
+     * Reads from the file straight into the caller's buffer, bypassing the caches.
+     * libssh then receives data directly into the buffer, without any intermediate copies.
+     *
+     * @param data Buffer to read into
+     * @param size The number of bytes wanted
+     * @return The number of bytes actually read, or -1 on error
+     */
+    sf::Int64 read_direct(char *data, size_t size);
+
+    /*!
+     * Reads data into a buffer. Wrapped by read(), so that it can be timed.
+     *
+     * @param data Buffer to read into
+     * @param size The number of bytes wanted
+     * @return The number of bytes actually read, or -1 on error
+     */
+    sf::Int64 read_blocks(char *data, size_t size);
+
+    /*!
+     * Loads a block of the file from the server
+     *
+     * @throws An std::exception on failure
+     * @param block_index The index of the block to load
+     * @param block Where to store the block's data
+     */
+    void fetch_block(uint64_t block_index, std::string &block);
+
+    /*!
+     * Loads a block of the file through the striped reader, topping up
+     * the blocks requested ahead of it whilst doing so.
+     *
+     * @throws An std::exception on failure
+     * @param block_index The index of the block to load
+     * @param block Where to store the block's data
+     */
+    void fetch_striped_block(uint64_t block_index, std::string &block);
+
     std::unique_ptr<SFTPFile> file;
+    std::shared_ptr<TransferStats> stats;
+    bool log_stats;
+    std::chrono::steady_clock::duration stats_interval;
+    std::chrono::steady_clock::time_point last_stats_log;
+    std::unique_ptr<SFTPStripedReader> striped_reader;
+    std::map<uint64_t, std::future<std::string>> striped_blocks; //Block index -> Pending fetch
+    uint64_t read_ahead_blocks; //Blocks to keep requested ahead of the reader when striping
+    uint64_t position;
 };
 
 
@@ -0,0 +1,99 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#ifndef SFTPMEDIASTREAMER_SFTPSTRIPEDREADER_H
+#define SFTPMEDIASTREAMER_SFTPSTRIPEDREADER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <future>
+#include <memory>
+#include <condition_variable>
+#include "TransferStats.h"
+#include "Types.h"
+
+/*!
+ * Fetches ranges of a single remote file over several independent SSH connections
+ * at once. A single connection is limited by its own flow control window and
+ * crypto throughput, so spreading requests across a few of them can fill links
+ * that one connection cannot.
+ *
+ * Each connection is owned and driven by its own worker thread. Callers submit
+ * ranges and collect the results through futures, in whatever order they like.
+ */
+class SFTPStripedReader
+{
+public:
+    /*!
+     * Starts the worker threads. Connections are established by the
+     * workers themselves, so this does not block.
+     *
+     * @param hostname The hostname of the ssh server
+     * @param port The port of the ssh server
+     * @param username The username to authenticate as
+     * @param file The remote file to read from
+     * @param connection_count The number of connections to stripe reads across
+     * @param stats The transfer counters to record every connection's requests into, normally those of the stream being read
+     */
+    SFTPStripedReader(std::string hostname, int port, std::string username, Attributes file, size_t connection_count, std::shared_ptr<TransferStats> stats);
+    ~SFTPStripedReader();
+    SFTPStripedReader(const SFTPStripedReader&) = delete;
+    void operator=(const SFTPStripedReader&) = delete;
+
+    /*!
+     * Queues a range of the file to be read by the next free connection.
+     * The result may be shorter than requested if the range passes the end of the file.
+     *
+     * @param offset The offset to read from
+     * @param length The number of bytes to read
+     * @return A future which is set to the data, or to an exception if it could not be read
+     */
+    std::future<std::string> read(uint64_t offset, size_t length);
+
+    /*!
+     * Gets the number of connections the reader was asked to use
+     *
+     * @return The connection count
+     */
+    size_t get_connection_count();
+private:
+    struct Job
+    {
+        uint64_t offset;
+        size_t length;
+        std::promise<std::string> result;
+    };
+
+    /*!
+     * Entry point of each worker. Connects, then serves jobs until shutdown.
+     *
+     * @param worker_index The index of the worker, for logging
+     */
+    void worker_thread(size_t worker_index);
+
+    /*!
+     * Called when a worker can no longer serve jobs. If it was the last one,
+     * then anything still queued is failed, as nobody else will serve it.
+     */
+    void worker_exited();
+
+    std::string hostname;
+    int port;
+    std::string username;
+    Attributes file;
+    std::shared_ptr<TransferStats> stats;
+
+    std::vector<std::thread> workers;
+    std::deque<Job> jobs;
+    std::mutex lock;
+    std::condition_variable jobs_cv;
+    size_t live_workers;
+    bool running;
+};
+
+
+#endif //SFTPMEDIASTREAMER_SFTPSTRIPEDREADER_H
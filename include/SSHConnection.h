@@ -5,11 +5,35 @@
 #ifndef SFTPMEDIASTREAMER_SSHCONNECTION_H
 #define SFTPMEDIASTREAMER_SSHCONNECTION_H
 #include <string>
+#include <vector>
+#include <functional>
+#include <stdexcept>
 #include <libssh/libssh.h>
+#include "Types.h"
 
 class SSHConnection
 {
 public:
+    //Thrown if a command run on the server exits with a non-zero status
+    class ExitStatusError : public std::runtime_error
+    {
+    public:
+        explicit ExitStatusError(int status_)
+        : std::runtime_error("Command exited with status " + std::to_string(status_)),
+          status(status_)
+        {}
+
+        int status;
+    };
+
+    /*!
+     * Called with a command's standard output as it arrives
+     *
+     * @param data The output
+     * @param length The number of bytes of it
+     */
+    typedef std::function<void(const char *data, size_t length)> output_t;
+
     SSHConnection();
     ~SSHConnection();
 
@@ -41,6 +65,58 @@ public:
      * @return The session object
      */
     ssh_session get();
+
+    /*!
+     * Runs a command on the server over an exec channel, and waits for it to finish
+     *
+     * @throws An std::runtime_error if the server won't run it, or an ExitStatusError if it exits with a non-zero status
+     * @param command The command to run, interpreted by the user's shell
+     * @param output Called with the command's standard output as it arrives
+     */
+    void execute(const std::string &command, const output_t &output);
+
+    /*!
+     * Runs a command on the server over an exec channel, until it finishes or 'poll' asks
+     * for it to stop. For long running commands, whose output comes and goes.
+     *
+     * @throws An std::runtime_error if the server won't run it, or an ExitStatusError if it exits with a non-zero status
+     * @param command The command to run, interpreted by the user's shell
+     * @param output Called with the command's standard output as it arrives
+     * @param poll_ms The longest to wait for output before calling 'poll'
+     * @param poll Called after each wait for output, whether any arrived or not. Returns false to stop the command.
+     */
+    void execute(const std::string &command, const output_t &output, int poll_ms, const std::function<bool()> &poll);
+
+    /*!
+     * Quotes a string for the server's shell, so that a command gets it as a single argument, as is
+     *
+     * @param argument The string to quote
+     * @return The quoted string
+     */
+    static std::string shell_quote(const std::string &argument);
+
+    /*!
+     * Lists a directory tree by running 'find' on the server, so the whole tree
+     * arrives in one streamed reply rather than costing a round trip per directory.
+     *
+     * @throws An std::runtime_error if it couldn't be listed this way, such as if
+     * the server doesn't permit exec, or doesn't have GNU find. Listing over SFTP
+     * should be used instead.
+     * @param root The directory to list
+     * @param max_depth How far below root to list. 1 lists just root's own entries.
+     * @return Every entry found, in the same form that SFTPSession::enumerate_directory gives them
+     */
+    std::vector<Attributes> enumerate_tree(const std::string &root, uint32_t max_depth);
+
+    /*!
+     * Parses one entry of the listing printed by enumerate_tree's find command
+     *
+     * @throws An std::runtime_error if it's malformed
+     * @param record The entry, without its NUL terminator
+     * @param root The directory that was listed
+     * @return The entry
+     */
+    static Attributes parse_find_record(const std::string &record, const std::string &root);
 private:
 
     /*!
@@ -7,18 +7,28 @@
 
 
 #include <gtkmm/eventbox.h>
+#include <functional>
 #include <database/season/SeasonEntry.h>
 #include "ISearchable.h"
 
 class SeasonListingWidget : public Gtk::EventBox, public ISearchable
 {
 public:
+    /*!
+     * Loads the thumbnail of a season
+     *
+     * @param season_id The ID of the season
+     * @return The thumbnail as a JPEG. Empty if it doesn't have one.
+     */
+    typedef std::function<std::string(uint64_t season_id)> thumbnail_loader_t;
+
     /*!
      * Constructor
      *
      * @param season The season to represent. The tooltip and search tag is set to the name of the season.
+     * @param load_thumbnail Called to load the season's thumbnail, whenever the widget's updated
      */
-    explicit SeasonListingWidget(std::shared_ptr<SeasonEntry> season);
+    SeasonListingWidget(std::shared_ptr<SeasonEntry> season, thumbnail_loader_t load_thumbnail);
     ~SeasonListingWidget() final =default;
 
     /*!
@@ -46,6 +56,7 @@ private:
 
     //Dependencies
     std::shared_ptr<SeasonEntry> season_entry;
+    thumbnail_loader_t load_thumbnail;
 };
 
 
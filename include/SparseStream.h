@@ -0,0 +1,41 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#ifndef SFTPMEDIASTREAMER_SPARSESTREAM_H
+#define SFTPMEDIASTREAMER_SPARSESTREAM_H
+
+#include <vector>
+#include <SFML/System/InputStream.hpp>
+#include "Types.h"
+
+/*!
+ * Exposes only some ranges of another stream. Reads within them are passed through,
+ * whilst the gaps between them read as zeros without touching the stream, and anything
+ * past the last reads as the end of the stream. Lets a decoder be given a file's headers
+ * and a single frame, without it fetching any more of the file than that.
+ */
+class SparseStream : public sf::InputStream
+{
+public:
+    /*!
+     * Constructor
+     *
+     * @param stream The stream to read through. Must outlive this.
+     * @param ranges The ranges of it to expose. Sorted and not overlapping.
+     */
+    SparseStream(sf::InputStream &stream, std::vector<ByteRange> ranges);
+
+    sf::Int64 read(void* data, sf::Int64 size) override;
+    sf::Int64 seek(sf::Int64 position) override;
+    sf::Int64 tell() override;
+    sf::Int64 getSize() override;
+private:
+    sf::InputStream &stream;
+    std::vector<ByteRange> ranges;
+    uint64_t position;
+    uint64_t end; //Of the last range
+};
+
+
+#endif //SFTPMEDIASTREAMER_SPARSESTREAM_H
@@ -0,0 +1,129 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#ifndef SFTPMEDIASTREAMER_THUMBNAILSERVICE_H
+#define SFTPMEDIASTREAMER_THUMBNAILSERVICE_H
+
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <random>
+#include <functional>
+#include <condition_variable>
+#include "SFTPSessionPool.h"
+#include "Thumbnailer.h"
+#include "JpegEncoder.h"
+#include "Types.h"
+
+/*!
+ * Generates season thumbnails on a pool of worker threads. Each worker owns a Thumbnailer,
+ * and so a libVLC instance and player, along with a JpegEncoder, which it reuses for every
+ * job it takes. Thumbnails are encoded in memory, so workers never touch the filesystem. Jobs are
+ * queued and return straight away, with completions reported from the worker threads.
+ *
+ * Where the container's index says where a keyframe is, only the file's headers and that
+ * keyframe are fetched. Otherwise the thumbnail's taken by seeking through playback.
+ */
+class ThumbnailService
+{
+public:
+    //A season to generate a thumbnail for
+    struct Job
+    {
+        uint64_t season_id;
+        std::string name;
+        std::string filepath; //Of the season's directory
+        std::vector<Attributes> media; //The season's files. If empty, the directory's listed to find them.
+    };
+
+    /*!
+     * Called from a worker thread when a job's done
+     *
+     * @param season_id The season the job was for
+     * @param thumbnail The thumbnail as a JPEG. Empty if one couldn't be generated.
+     */
+    typedef std::function<void(uint64_t season_id, std::string thumbnail)> completion_t;
+
+    /*!
+     * Constructor. Workers are started straight away, but
+     * their Thumbnailers aren't created until they're first needed.
+     *
+     * @param sftp Where to get sessions to read media through
+     * @param worker_count The number of thumbnails to generate at once
+     * @param on_complete Called as each job finishes
+     */
+    ThumbnailService(std::shared_ptr<SFTPSessionPool> sftp, size_t worker_count, completion_t on_complete);
+
+    /*!
+     * Destructor. Jobs still queued are dropped, and those in progress cancelled.
+     */
+    ~ThumbnailService();
+
+    /*!
+     * Queues a job
+     *
+     * @param job The job to queue
+     */
+    void submit(Job job);
+
+    /*!
+     * Waits for every queued job to be finished
+     */
+    void wait_idle();
+
+    /*!
+     * Drops every job which hasn't been started yet
+     */
+    void cancel_pending();
+
+    /*!
+     * Cancels every job which is being worked on. They complete without a thumbnail.
+     * Jobs submitted afterwards are generated as normal.
+     */
+    void cancel_running();
+
+    /*!
+     * Gets the number of bytes received from the server whilst generating thumbnails
+     *
+     * @return The total across every job so far
+     */
+    uint64_t get_bytes_received();
+private:
+    /*!
+     * Takes and runs jobs until the service is destroyed
+     *
+     * @param index The worker's index into 'thumbnailers'
+     */
+    void worker_main(size_t index);
+
+    /*!
+     * Generates a thumbnail from a randomly chosen video in a season
+     *
+     * @throws An std::exception on failure
+     * @param thumbnailer The worker's thumbnailer
+     * @param encoder The worker's encoder
+     * @param random The worker's random number generator
+     * @param job The season to generate it for
+     * @return The thumbnail as a JPEG. Empty if there was no video to choose from.
+     */
+    std::string generate(Thumbnailer &thumbnailer, JpegEncoder &encoder, std::mt19937 &random, Job &job);
+
+    std::shared_ptr<SFTPSessionPool> sftp;
+    completion_t on_complete;
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Thumbnailer>> thumbnailers; //One per worker, or null until it's first needed
+    std::deque<Job> jobs;
+    size_t running; //Jobs taken by workers, but not yet finished
+    std::atomic<uint64_t> bytes_received;
+    bool stopping;
+    std::mutex lock;
+    std::condition_variable job_available;
+    std::condition_variable idle;
+};
+
+
+#endif //SFTPMEDIASTREAMER_THUMBNAILSERVICE_H
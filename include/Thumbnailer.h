@@ -10,14 +10,26 @@
 #include <SFML/System/InputStream.hpp>
 #include <SFML/Graphics/Texture.hpp>
 #include <vlc/vlc.h>
-#include <atomic>
+#include <mutex>
+#include <random>
+#include <condition_variable>
+#include <vector>
 
+#define THUMBNAILER_TIMEOUT_SECONDS 30 //Longest a thumbnail can take before it's given up on
 
+/*!
+ * Grabs frames from media with libVLC. The libVLC instance and player are created once
+ * and reused for every thumbnail, as setting them up costs more than the grab itself.
+ * Generation waits on the player's events and rendered frames, rather than polling it.
+ * Not thread-safe, other than cancel(): each thread generating thumbnails should have its own.
+ */
 class Thumbnailer
 {
 public:
     Thumbnailer();
     ~Thumbnailer();
+    Thumbnailer(const Thumbnailer&) = delete;
+    void operator=(const Thumbnailer&) = delete;
 
     /*!
      * Generates a thumbnail for a given sf::InputStream.
@@ -30,6 +42,31 @@ public:
      */
     sf::Image generate_thumbnail(sf::InputStream &stream, size_t width, size_t height);
 
+    /*!
+     * Generates a thumbnail from a keyframe, whose position is already known. Playback starts
+     * at the keyframe, so nothing before it's read, and the first frame decoded is taken.
+     *
+     * @throws An std::exception on failure.
+     * @param stream The steam to generate the thumbnail from
+     * @param width The width of the generated image
+     * @param height The height of the generated image
+     * @param time Where the keyframe is, in milliseconds from the start of the media
+     * @return The generated image on success.
+     */
+    sf::Image generate_keyframe_thumbnail(sf::InputStream &stream, size_t width, size_t height, uint64_t time);
+
+    /*!
+     * Cancels the thumbnail being generated, and any generated after. They throw
+     * instead of waiting for playback. Can be called from any thread.
+     */
+    void cancel();
+
+    /*!
+     * Undoes cancel(), so that thumbnails can be generated again.
+     * Can be called from any thread.
+     */
+    void resume();
+
 private:
     //Generation context
     struct ThumbnailContext
@@ -38,19 +75,55 @@ private:
         : frame_data(nullptr),
           frame_data_size(0),
           stream(nullptr),
+          video_started(false),
           seek_complete(false),
-          thumbnail_completed(false)
+          frame_rendered(false),
+          thumbnail_completed(false),
+          failed(false),
+          cancelled(false)
         {
 
         }
 
-        uint8_t *frame_data;
+        uint8_t *frame_data; //Points into frame_buffer
         size_t frame_data_size;
         sf::InputStream *stream;
-        std::atomic_bool seek_complete;
-        std::atomic_bool thumbnail_completed;
+
+        //Everything below is set from libVLC's threads, so is guarded by 'lock'. 'changed' is signalled whenever it is.
+        std::mutex lock;
+        std::condition_variable changed;
+        bool video_started; //A video output's been created, so the media can be seeked
+        bool seek_complete; //Playback's reached the part of the media a frame should be taken from
+        bool frame_rendered; //A frame's been rendered since playback started
+        bool thumbnail_completed; //A frame's been rendered since the seek completed
+        bool failed; //Playback errored, or the media ended before a thumbnail was taken
+        bool cancelled;
     };
 
+    /*!
+     * Generates a thumbnail
+     *
+     * @throws An std::exception on failure.
+     * @param stream The steam to generate the thumbnail from
+     * @param width The width of the generated image
+     * @param height The height of the generated image
+     * @param start_time Milliseconds to start playback at, where the frame's taken from. -1 to seek to a random position instead.
+     * @return The generated image on success.
+     */
+    sf::Image grab(sf::InputStream &stream, size_t width, size_t height, int64_t start_time);
+
+    /*!
+     * Waits for something to happen to the player
+     *
+     * @throws An std::exception if playback failed, or generation was cancelled
+     * @param guard Holding the context's lock
+     * @param deadline When to stop waiting
+     * @param done Checked, with the lock held, whenever the context changes
+     * @return True if 'done' returned true, false if the deadline was reached first
+     */
+    template<typename Predicate>
+    bool wait_for(std::unique_lock<std::mutex> &guard, std::chrono::steady_clock::time_point deadline, Predicate done);
+
     //libVLC callbacks
     static int open_callback(void *opaque, void **datap, uint64_t *sizep);
     static void close_callback(void *opaque);
@@ -58,8 +131,13 @@ private:
     static int seek_callback(void *opaque, uint64_t offset);
     static void *lock_callback(void *opaque, void **pixels);
     static void unlock_callback(void *opaque, void *picture, void *const *pixels);
+    static void event_callback(const libvlc_event_t *event, void *opaque);
 
     libvlc_instance_t *vlc;
+    libvlc_media_player_t *player;
+    ThumbnailContext context; //Of the thumbnail being generated. The player's callbacks point at it.
+    std::vector<uint8_t> frame_buffer;
+    std::mt19937 random; //Each worker has its own Thumbnailer, so this is never shared between threads
 };
 
 
@@ -0,0 +1,117 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#ifndef SFTPMEDIASTREAMER_TRANSFERSTATS_H
+#define SFTPMEDIASTREAMER_TRANSFERSTATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+//Bucket 0 counts latencies under 1ms, bucket n those in [2^(n-1), 2^n)ms. The last bucket holds everything beyond.
+#define TRANSFER_STATS_LATENCY_BUCKETS 16
+
+/*!
+ * Counters describing the transfer of a single remote file. They're updated by
+ * whoever is reading the file, and may be read from any thread at any time.
+ * All updates are relaxed atomics, so recording costs next to nothing.
+ */
+class TransferStats
+{
+public:
+    //A copy of the counters at one point in time
+    struct Snapshot
+    {
+        uint64_t bytes_read; //Bytes handed to the reader
+        uint64_t bytes_received; //Bytes received from the server
+        uint64_t requests_issued;
+        uint64_t requests_completed;
+        uint64_t requests_abandoned; //Issued, but no longer wanted by the time they arrived
+        std::array<uint64_t, TRANSFER_STATS_LATENCY_BUCKETS> latency_histogram;
+        uint64_t read_calls;
+        double stall_time; //Seconds the reader spent blocked waiting on reads
+        uint64_t seek_count;
+        uint64_t seek_distance; //Sum of the distances of every seek, in bytes
+        double elapsed; //Seconds since the counters were created
+
+        /*!
+         * Estimates a request latency percentile from the histogram
+         *
+         * @param percentile The percentile to get, between 0 and 1
+         * @return The upper bound of the bucket it falls in, in milliseconds. 0 if there's no data.
+         */
+        double get_latency_percentile(double percentile) const;
+
+        /*!
+         * Formats the counters into a single human readable line
+         *
+         * @return The formatted counters
+         */
+        std::string to_string() const;
+    };
+
+    TransferStats();
+
+    /*!
+     * Records data being handed to the reader
+     *
+     * @param bytes The number of bytes
+     */
+    void add_bytes_read(uint64_t bytes);
+
+    /*!
+     * Records a read request being sent to the server
+     */
+    void add_request_issued();
+
+    /*!
+     * Records a read request's response arriving
+     *
+     * @param latency How long after being issued it arrived
+     * @param bytes The number of bytes it returned
+     */
+    void add_request_completed(std::chrono::steady_clock::duration latency, uint64_t bytes);
+
+    /*!
+     * Records a read request being abandoned
+     */
+    void add_request_abandoned();
+
+    /*!
+     * Records a read call by the reader, and how long they were blocked in it
+     *
+     * @param duration How long the call took
+     */
+    void add_read_call(std::chrono::steady_clock::duration duration);
+
+    /*!
+     * Records the reader seeking
+     *
+     * @param distance How far the cursor moved, in bytes
+     */
+    void add_seek(uint64_t distance);
+
+    /*!
+     * Takes a copy of the counters
+     *
+     * @return The counters as they are now
+     */
+    Snapshot get_snapshot() const;
+private:
+    std::atomic<uint64_t> bytes_read;
+    std::atomic<uint64_t> bytes_received;
+    std::atomic<uint64_t> requests_issued;
+    std::atomic<uint64_t> requests_completed;
+    std::atomic<uint64_t> requests_abandoned;
+    std::array<std::atomic<uint64_t>, TRANSFER_STATS_LATENCY_BUCKETS> latency_histogram;
+    std::atomic<uint64_t> read_calls;
+    std::atomic<uint64_t> stall_nanoseconds;
+    std::atomic<uint64_t> seek_count;
+    std::atomic<uint64_t> seek_distance;
+    std::chrono::steady_clock::time_point created;
+};
+
+
+#endif //SFTPMEDIASTREAMER_TRANSFERSTATS_H
@@ -5,6 +5,7 @@
 #ifndef SFTPMEDIASTREAMER_TYPES_H
 #define SFTPMEDIASTREAMER_TYPES_H
 #include <string>
+#include <cstdint>
 #include <cxxabi.h>
 
 struct Attributes
@@ -30,6 +31,34 @@ struct Attributes
     {
         return full_name;
     }
+
+    /*!
+     * Checks if a file's name says it's a video which can be played
+     *
+     * @param name The file's name
+     * @return True if it is, false otherwise
+     */
+    static bool is_video_filename(const std::string &name)
+    {
+        return name.find(".mkv") != std::string::npos || name.find(".mp4") != std::string::npos;
+    }
+
+    /*!
+     * Checks if this is a video file which can be played
+     *
+     * @return True if it is, false otherwise
+     */
+    bool is_video() const
+    {
+        return type == Regular && is_video_filename(name);
+    }
+};
+
+//A run of bytes within a file
+struct ByteRange
+{
+    uint64_t offset;
+    uint64_t length;
 };
 
 //Duration constants in seconds so there's no magic '3600's in the code.
@@ -62,6 +91,7 @@ static std::string demangle(const char *name)
 #define NO_SUCH_ENTRY 0
 #define THUMBNAIL_WIDTH 256
 #define THUMBNAIL_HEIGHT 144
+#define THUMBNAIL_JPEG_QUALITY 90
 #define SUB_TRACK_UNSET (-2)
 #define AUDIO_TRACK_UNSET (-2)
 #define RIGHT_CLICK 3
@@ -11,6 +11,7 @@
 #include <map>
 #include <atomic>
 #include <mutex>
+#include <functional>
 #define CACHE_CLEAR_THRESHOLD 200
 
 class SyntaxError : public std::logic_error
@@ -33,18 +34,38 @@ public:
      */
     void flush()
     {
-        std::lock_guard<std::mutex> guard(lock);
-        for(auto &a : cache)
-        {
-            if(a.second)
+        //The cache is locked inside the batch, as whoever else has a batch open may be waiting on the cache
+        batch([&]() {
+            std::lock_guard<std::mutex> guard(lock);
+            check_rollbacks();
+            for(auto &a : cache)
             {
-                if(a.second->get_dirty())
+                if(a.second)
                 {
-                    a.second->set_dirty(false); //Order is important, don't want to have changed commited, then more changes made, then dirty flag cleared
-                    database_update(a.second);
+                    if(a.second->get_dirty())
+                    {
+                        a.second->set_dirty(false); //Order is important, don't want to have changed commited, then more changes made, then dirty flag cleared
+                        database_update(a.second);
+                    }
                 }
             }
-        }
+        });
+    }
+
+    /*!
+     * Runs a set of operations as a single batch, so they're committed to the
+     * database together rather than one at a time. If the operations throw, then
+     * none of them are committed. Batches can be nested.
+     *
+     * Repositories sharing a database share its batches, so operations on
+     * any of them can be made within the same batch.
+     *
+     * @throws Whatever the operations throw
+     * @param operations The operations to run
+     */
+    virtual void batch(const std::function<void()> &operations)
+    {
+        operations();
     }
 
     /*!
@@ -60,7 +81,7 @@ public:
         try
         {
             auto entry = std::make_shared<T>(std::forward<Args>(args)...);
-            database_create(entry.get());
+            entry->set_id(database_create(entry.get()));
             entry->set_dirty(false);
             entry = store_cache(entry);
             return entry->get_id();
@@ -87,6 +108,7 @@ public:
         try
         {
             std::lock_guard<std::mutex> guard(lock);
+            check_rollbacks();
 
             //Check the cache first to see if it's already loaded
             auto iter = cache.find(id);
@@ -119,20 +141,23 @@ public:
      */
     void erase(uint64_t id)
     {
-        std::lock_guard<std::mutex> guard(lock);
-
         try
         {
-            //Delete from database
-            database_erase(id);
+            //Writes wait on open batches, so the cache is locked inside the batch, as in flush()
+            batch([&]() {
+                std::lock_guard<std::mutex> guard(lock);
+                check_rollbacks();
 
-            //Delete from cache if it's cached
-            auto iter = cache.find(id);
-            if(iter != cache.end())
-            {
-                iter->second = nullptr;
-                return;
-            }
+                //Delete from database
+                database_erase(id);
+
+                //Delete from cache if it's cached
+                auto iter = cache.find(id);
+                if(iter != cache.end())
+                {
+                    iter->second = nullptr;
+                }
+            });
         }
         catch(std::exception &e)
         {
@@ -194,6 +219,7 @@ protected:
         }
 
         std::lock_guard<std::mutex> guard(lock);
+        check_rollbacks();
 
         //Clean cache
         clean_cache();
@@ -236,9 +262,34 @@ protected:
      */
     virtual void database_erase(uint64_t entry_id) =0;
 
+    /*!
+     * Gets the number of times the database has been rolled back. The cache
+     * is dropped whenever this changes.
+     *
+     * @return The number of rollbacks so far. Always 0 if it can't roll back.
+     */
+    virtual uint64_t database_rollback_count()
+    {
+        return 0;
+    }
 
 private:
 
+    /*!
+     * Drops every cached entry, without committing them, if the database has been rolled back
+     * since last checked. They may hold changes which were undone, or IDs which the database
+     * has since reused. The lock must be held.
+     */
+    void check_rollbacks()
+    {
+        uint64_t rollbacks = database_rollback_count();
+        if(rollbacks != seen_rollbacks)
+        {
+            cache.clear();
+            seen_rollbacks = rollbacks;
+        }
+    }
+
     /*!
      * Removes all entries which are no longer needed
      * from the cache
@@ -286,6 +337,7 @@ private:
     //State
     std::map<uint64_t, std::shared_ptr<T>> cache;
     std::mutex lock;
+    uint64_t seen_rollbacks = 0; //Of the database, when the cache was last checked
 };
 
 constexpr bool equal( char const* a, char const* b )
@@ -10,6 +10,8 @@
 #include <unordered_map>
 #include <any>
 #include <functional>
+#include <mutex>
+#include <atomic>
 #include <Log.h>
 #include "DBType.h"
 
@@ -115,6 +117,52 @@ public:
         std::vector<int> column_types;
     };
 
+    /*!
+     * A scoped transaction. Everything done through the database whilst it's
+     * alive is committed together by commit(), or rolled back if it's destroyed
+     * first, such as by an exception.
+     *
+     * Transactions can be nested. Only the outermost one actually begins and
+     * commits; inner ones are savepoints within it, so if they aren't committed
+     * only their own part is rolled back, and the outer one can still commit.
+     * Whilst one thread has a transaction open, others wait to open their own,
+     * and to write outside of one, so their writes can't end up in (and be
+     * rolled back with) another thread's transaction.
+     */
+    class Transaction
+    {
+    public:
+        /*!
+         * Begins a transaction, or joins the one this thread already has open
+         *
+         * @throws An std::exception on failure
+         * @param database The database to begin it on
+         */
+        explicit Transaction(SQLite3DB &database);
+        ~Transaction();
+        Transaction(const Transaction&)=delete;
+        Transaction &operator=(const Transaction &)=delete;
+
+        /*!
+         * Commits the transaction. Inner ones are released into the transaction
+         * they're within, to be committed along with it.
+         *
+         * @throws An std::exception on failure
+         */
+        void commit();
+    private:
+        /*!
+         * Gets the name of the savepoint an inner transaction is
+         *
+         * @return The savepoint's name
+         */
+        std::string savepoint_name();
+
+        SQLite3DB &database;
+        uint32_t level; //0 for the outermost transaction
+        bool finished;
+    };
+
     SQLite3DB();
     ~SQLite3DB();
     SQLite3DB(const SQLite3DB &)=delete;
@@ -209,6 +257,26 @@ public:
      */
     CompiledStatement compile_statement(const std::string &statement);
 
+    /*!
+     * Adds a column to an existing table, if it doesn't have it already.
+     * Used to bring tables created by older versions up to date.
+     *
+     * @throws An std::exception on failure
+     * @param table The name of the table to add the column to
+     * @param column The name of the column to add
+     * @param definition The column's type and constraints. Needs a default value if the table may have rows.
+     * @return True if the column was added, false if it already existed
+     */
+    bool add_column_if_missing(const std::string &table, const std::string &column, const std::string &definition);
+
+    /*!
+     * Gets the number of times a transaction, or part of one, has been rolled back.
+     * Anything cached from the database may be stale once this changes.
+     *
+     * @return The number of rollbacks so far
+     */
+    uint64_t get_rollback_count();
+
     /*!
      * Starts a new transaction,
      * should be used before a batch of inserts.
@@ -249,8 +317,8 @@ public:
                   const Functor &functor)
     {
         query_t results;
-        std::array<DBType, expected_column_names.size()> constructor_args;
-        std::array<query_t::iterator, expected_column_names.size()> column_iterators;
+        std::array<DBType, col_count> constructor_args;
+        std::array<query_t::iterator, col_count> column_iterators;
         static_assert(!column_iterators.empty(), "There must be results");
 
         bool running = true;
@@ -298,7 +366,21 @@ private:
      */
     void reset_pragmas();
 
+    /*!
+     * Takes the transaction lock if a statement writes to the database,
+     * so that it waits for any transaction another thread has open.
+     *
+     * @param statement The statement about to be executed
+     * @return A lock, which is only held if the statement isn't read only
+     */
+    std::unique_lock<std::recursive_mutex> lock_if_writing(CompiledStatement &statement);
+
     sqlite3 *database;
     std::string database_filepath;
+
+    //Transaction state
+    std::recursive_mutex transaction_lock; //Held by the thread with a transaction open
+    uint32_t transaction_depth = 0; //Number of nested transactions open
+    std::atomic<uint64_t> rollback_count = 0;
 };
 #endif //SFTPMEDIASTREAMER_SQLITE3WRAPPER_H
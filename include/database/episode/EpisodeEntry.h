@@ -14,7 +14,8 @@
 class EpisodeEntry
 {
 public:
-    EpisodeEntry(uint64_t id_, uint64_t season_id_, std::string filepath_, std::string name_, uint64_t watched_, uint64_t watch_offset_, uint64_t audio_track_, uint64_t sub_track_, uint64_t date_added_)
+    EpisodeEntry(uint64_t id_, uint64_t season_id_, std::string filepath_, std::string name_, uint64_t watched_, uint64_t watch_offset_, uint64_t audio_track_, uint64_t sub_track_, uint64_t date_added_, uint64_t size_, uint64_t fingerprint_,
+                 uint64_t duration_, uint64_t width_, uint64_t height_, std::string video_codec_, std::string audio_codec_, uint64_t audio_channels_, uint64_t bitrate_, uint64_t media_probed_)
     : id(id_),
       season_id(season_id_),
       filepath(std::move(filepath_)),
@@ -23,11 +24,21 @@ public:
       watch_offset(watch_offset_),
       audio_track(audio_track_),
       sub_track(sub_track_),
-      date_added(date_added_)
+      date_added(date_added_),
+      size(size_),
+      fingerprint(fingerprint_),
+      duration(duration_),
+      width(width_),
+      height(height_),
+      video_codec(std::move(video_codec_)),
+      audio_codec(std::move(audio_codec_)),
+      audio_channels(audio_channels_),
+      bitrate(bitrate_),
+      media_probed(media_probed_)
     {}
 
     EpisodeEntry()
-    : EpisodeEntry(0, 0, "", "", false, 0, 0, 0, 0)
+    : EpisodeEntry(0, 0, "", "", false, 0, 0, 0, 0, 0, 0, 0, 0, 0, "", "", 0, 0, false)
     {}
 
     EpisodeEntry(EpisodeEntry &&o)
@@ -39,7 +50,17 @@ public:
       watch_offset(o.watch_offset),
       audio_track(o.audio_track),
       sub_track(o.sub_track),
-      date_added(o.date_added)
+      date_added(o.date_added),
+      size(o.size),
+      fingerprint(o.fingerprint),
+      duration(o.duration),
+      width(o.width),
+      height(o.height),
+      video_codec(std::move(o.video_codec)),
+      audio_codec(std::move(o.audio_codec)),
+      audio_channels(o.audio_channels),
+      bitrate(o.bitrate),
+      media_probed(o.media_probed)
     {
 
     }
@@ -53,7 +74,19 @@ public:
     db_entry_def(uint64_t, watch_offset)
     db_entry_def(int64_t, audio_track)
     db_entry_def(int64_t, sub_track)
-    db_entry_def(time_t, date_added)
+    db_entry_def(time_t, date_added) //The file's modification time
+    db_entry_def(uint64_t, size) //The file's size in bytes
+    db_entry_def(uint64_t, fingerprint) //See SFTPSession::fingerprint_many. 0 if unknown.
+
+    //Media metadata, see MediaProbe. Only valid once media_probed is set.
+    db_entry_def(uint64_t, duration) //Milliseconds
+    db_entry_def(uint64_t, width)
+    db_entry_def(uint64_t, height)
+    db_entry_def(std::string, video_codec)
+    db_entry_def(std::string, audio_codec)
+    db_entry_def(uint64_t, audio_channels)
+    db_entry_def(uint64_t, bitrate) //Bits per second
+    db_entry_def(bool, media_probed)
 };
 
 
@@ -28,6 +28,24 @@ public:
      * @return An episode ID on success, NO_SUCH_ENTRY on failure.
      */
     virtual uint64_t get_episode_id_from_filepath(const std::string &episode_filepath)=0;
+
+    /*!
+     * Iterates through the ID, season ID and file details of every episode, without
+     * loading the episodes themselves. Lets the whole table be indexed in one query,
+     * rather than looking episodes up one at a time.
+     *
+     * @param callback The callback to call for each row. Should return true
+     * if more rows are wanted, false if it's finished.
+     */
+    virtual void for_each_episode_file(const std::function<bool(uint64_t episode_id, uint64_t season_id, const std::string &filepath, uint64_t size, time_t date_added, uint64_t fingerprint)> &callback)=0;
+
+    /*!
+     * Iterates through the ID and filepath of every episode which hasn't had its media probed yet
+     *
+     * @param callback The callback to call for each row. Should return true
+     * if more rows are wanted, false if it's finished.
+     */
+    virtual void for_each_unprobed_episode(const std::function<bool(uint64_t episode_id, const std::string &filepath)> &callback)=0;
 };
 
 
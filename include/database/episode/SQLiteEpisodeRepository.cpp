@@ -3,7 +3,7 @@
 //
 
 #include "SQLiteEpisodeRepository.h"
-#define column_names std::array<std::string, 9>{"id", "season_id", "filepath", "name", "watched", "watch_offset", "audio_track", "sub_track", "date_added"}
+#define column_names std::array<std::string, 19>{"id", "season_id", "filepath", "name", "watched", "watch_offset", "audio_track", "sub_track", "date_added", "size", "fingerprint", "duration", "width", "height", "video_codec", "audio_codec", "audio_channels", "bitrate", "media_probed"}
 
 SQLiteEpisodeRepository::SQLiteEpisodeRepository(std::shared_ptr<SQLite3DB> database_)
 : database(std::move(database_))
@@ -11,12 +11,23 @@ SQLiteEpisodeRepository::SQLiteEpisodeRepository(std::shared_ptr<SQLite3DB> data
     //Create table and indexes
     database->unsafe_query("CREATE TABLE IF NOT EXISTS episode(id INTEGER PRIMARY KEY AUTOINCREMENT, season_id INTEGER NOT NULL, filepath VARCHAR(4096) NOT NULL, name VARCHAR(4096) NOT NULL, watched BOOLEAN NOT NULL, watch_offset INTEGER NOT NULL, audio_track INTEGER NOT NULL, sub_track INTEGER NOT NULL, date_added DATE INTEGER NOT NULL, FOREIGN KEY(season_id) REFERENCES season(id));");
     database->unsafe_query("CREATE INDEX IF NOT EXISTS episode_filepath_index ON episode(filepath);");
+    database->add_column_if_missing("episode", "size", "INTEGER NOT NULL DEFAULT 0");
+    database->add_column_if_missing("episode", "fingerprint", "INTEGER NOT NULL DEFAULT 0");
+    database->add_column_if_missing("episode", "duration", "INTEGER NOT NULL DEFAULT 0");
+    database->add_column_if_missing("episode", "width", "INTEGER NOT NULL DEFAULT 0");
+    database->add_column_if_missing("episode", "height", "INTEGER NOT NULL DEFAULT 0");
+    database->add_column_if_missing("episode", "video_codec", "VARCHAR(64) NOT NULL DEFAULT ''");
+    database->add_column_if_missing("episode", "audio_codec", "VARCHAR(64) NOT NULL DEFAULT ''");
+    database->add_column_if_missing("episode", "audio_channels", "INTEGER NOT NULL DEFAULT 0");
+    database->add_column_if_missing("episode", "bitrate", "INTEGER NOT NULL DEFAULT 0");
+    database->add_column_if_missing("episode", "media_probed", "BOOLEAN NOT NULL DEFAULT 0");
 }
 
 uint64_t SQLiteEpisodeRepository::database_create(EpisodeEntry *entry)
 {
-    return database->insert_query("INSERT INTO episode VALUES(NULL, ?, ?, ?, ?, ?, ?, ?, ?)",
-                                  {entry->get_season_id(), entry->get_filepath(), entry->get_name(), entry->get_watched(), entry->get_watch_offset(), entry->get_audio_track(), entry->get_sub_track(), entry->get_date_added()});
+    return database->insert_query("INSERT INTO episode VALUES(NULL, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)",
+                                  {entry->get_season_id(), entry->get_filepath(), entry->get_name(), entry->get_watched(), entry->get_watch_offset(), entry->get_audio_track(), entry->get_sub_track(), entry->get_date_added(), entry->get_size(), entry->get_fingerprint(),
+                                   entry->get_duration(), entry->get_width(), entry->get_height(), entry->get_video_codec(), entry->get_audio_codec(), entry->get_audio_channels(), entry->get_bitrate(), entry->get_media_probed()});
 }
 
 std::shared_ptr<EpisodeEntry> SQLiteEpisodeRepository::database_load(uint64_t entry_id)
@@ -29,15 +40,26 @@ std::shared_ptr<EpisodeEntry> SQLiteEpisodeRepository::database_load(uint64_t en
                                          results.at("name").at(0).get<std::string>(),
                                          results.at("watched").at(0).get<uint64_t>(),
                                          results.at("watch_offset").at(0).get<uint64_t>(),
-                                         results.at("audio_track").at(0).get<int64_t>(),
-                                         results.at("sub_track").at(0).get<int64_t>(),
-                                         results.at("date_added").at(0).get<time_t>());
+                                         static_cast<int64_t>(results.at("audio_track").at(0).get<uint64_t>()),
+                                         static_cast<int64_t>(results.at("sub_track").at(0).get<uint64_t>()),
+                                         static_cast<time_t>(results.at("date_added").at(0).get<uint64_t>()),
+                                         results.at("size").at(0).get<uint64_t>(),
+                                         results.at("fingerprint").at(0).get<uint64_t>(),
+                                         results.at("duration").at(0).get<uint64_t>(),
+                                         results.at("width").at(0).get<uint64_t>(),
+                                         results.at("height").at(0).get<uint64_t>(),
+                                         results.at("video_codec").at(0).get<std::string>(),
+                                         results.at("audio_codec").at(0).get<std::string>(),
+                                         results.at("audio_channels").at(0).get<uint64_t>(),
+                                         results.at("bitrate").at(0).get<uint64_t>(),
+                                         results.at("media_probed").at(0).get<uint64_t>());
 }
 
 void SQLiteEpisodeRepository::database_update(std::shared_ptr<EpisodeEntry> entry)
 {
-    database->query("UPDATE episode SET season_id=?, filepath=?, name=?, watched=?, watch_offset=?, audio_track=?, sub_track=?, date_added=? WHERE id=?",
-                    {entry->get_season_id(), entry->get_filepath(), entry->get_name(), entry->get_watched(), entry->get_watch_offset(), entry->get_audio_track(), entry->get_sub_track(), entry->get_date_added(), entry->get_id()});
+    database->query("UPDATE episode SET season_id=?, filepath=?, name=?, watched=?, watch_offset=?, audio_track=?, sub_track=?, date_added=?, size=?, fingerprint=?, duration=?, width=?, height=?, video_codec=?, audio_codec=?, audio_channels=?, bitrate=?, media_probed=? WHERE id=?",
+                    {entry->get_season_id(), entry->get_filepath(), entry->get_name(), entry->get_watched(), entry->get_watch_offset(), entry->get_audio_track(), entry->get_sub_track(), entry->get_date_added(), entry->get_size(), entry->get_fingerprint(),
+                     entry->get_duration(), entry->get_width(), entry->get_height(), entry->get_video_codec(), entry->get_audio_codec(), entry->get_audio_channels(), entry->get_bitrate(), entry->get_media_probed(), entry->get_id()});
 }
 
 void SQLiteEpisodeRepository::database_erase(uint64_t entry_id)
@@ -45,6 +67,18 @@ void SQLiteEpisodeRepository::database_erase(uint64_t entry_id)
     database->query("DELETE FROM episode WHERE id=?", {entry_id});
 }
 
+void SQLiteEpisodeRepository::batch(const std::function<void()> &operations)
+{
+    SQLite3DB::Transaction transaction(*database);
+    operations();
+    transaction.commit();
+}
+
+uint64_t SQLiteEpisodeRepository::database_rollback_count()
+{
+    return database->get_rollback_count();
+}
+
 uint64_t SQLiteEpisodeRepository::get_episode_id_from_filepath(const std::string &episode_filepath)
 {
     SQLite3DB::query_t query = database->query("SELECT id FROM episode WHERE filepath=?", {episode_filepath});
@@ -60,4 +94,32 @@ void SQLiteEpisodeRepository::for_each_episode_in_season(uint64_t season_id, con
     database->for_each<EpisodeEntry>(stmt, {season_id}, column_names, [&](std::shared_ptr<EpisodeEntry> obj) {
         return callback(store_cache(obj));
     });
-}
\ No newline at end of file
+}
+
+void SQLiteEpisodeRepository::for_each_episode_file(const std::function<bool(uint64_t, uint64_t, const std::string &, uint64_t, time_t, uint64_t)> &callback)
+{
+    SQLite3DB::query_t query = database->query("SELECT id, season_id, filepath, size, date_added, fingerprint FROM episode", {});
+    auto &ids = query["id"];
+    auto &season_ids = query["season_id"];
+    auto &filepaths = query["filepath"];
+    auto &sizes = query["size"];
+    auto &dates_added = query["date_added"];
+    auto &fingerprints = query["fingerprint"];
+    for(size_t a = 0; a < ids.size(); ++a)
+    {
+        if(!callback(ids[a].get<uint64_t>(), season_ids[a].get<uint64_t>(), filepaths[a].get<std::string>(), sizes[a].get<uint64_t>(), static_cast<time_t>(dates_added[a].get<uint64_t>()), fingerprints[a].get<uint64_t>()))
+            break;
+    }
+}
+
+void SQLiteEpisodeRepository::for_each_unprobed_episode(const std::function<bool(uint64_t, const std::string &)> &callback)
+{
+    SQLite3DB::query_t query = database->query("SELECT id, filepath FROM episode WHERE media_probed=0", {});
+    auto &ids = query["id"];
+    auto &filepaths = query["filepath"];
+    for(size_t a = 0; a < ids.size(); ++a)
+    {
+        if(!callback(ids[a].get<uint64_t>(), filepaths[a].get<std::string>()))
+            break;
+    }
+}
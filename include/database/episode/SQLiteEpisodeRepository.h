@@ -46,6 +46,21 @@ public:
      */
     void database_erase(uint64_t entry_id) override;
 
+    /*!
+     * Runs a set of operations within a single transaction
+     *
+     * @throws Whatever the operations throw
+     * @param operations The operations to run
+     */
+    void batch(const std::function<void()> &operations) override;
+
+    /*!
+     * Gets the number of times the database has been rolled back
+     *
+     * @return The number of rollbacks so far
+     */
+    uint64_t database_rollback_count() override;
+
     /*!
      * Iterates through every episode in a given season.
      *
@@ -63,6 +78,24 @@ public:
      */
     uint64_t get_episode_id_from_filepath(const std::string &episode_filepath) override;
 
+    /*!
+     * Iterates through the ID, season ID and file details of every episode, without
+     * loading the episodes themselves. Lets the whole table be indexed in one query,
+     * rather than looking episodes up one at a time.
+     *
+     * @param callback The callback to call for each row. Should return true
+     * if more rows are wanted, false if it's finished.
+     */
+    void for_each_episode_file(const std::function<bool(uint64_t episode_id, uint64_t season_id, const std::string &filepath, uint64_t size, time_t date_added, uint64_t fingerprint)> &callback) override;
+
+    /*!
+     * Iterates through the ID and filepath of every episode which hasn't had its media probed yet
+     *
+     * @param callback The callback to call for each row. Should return true
+     * if more rows are wanted, false if it's finished.
+     */
+    void for_each_unprobed_episode(const std::function<bool(uint64_t episode_id, const std::string &filepath)> &callback) override;
+
 private:
     std::shared_ptr<SQLite3DB> database;
 };
@@ -4,7 +4,8 @@
 
 #include "SQLiteSeasonRepository.h"
 
-#define column_names std::array<std::string, 5>{"id", "filepath", "name", "thumbnail", "date_added"}
+#define column_names std::array<std::string, 6>{"id", "filepath", "name", "date_added", "mod_date", "entry_count"}
+#define column_list "id, filepath, name, date_added, mod_date, entry_count" //Everything but the unused thumbnail column
 
 SQLiteSeasonRepository::SQLiteSeasonRepository(std::shared_ptr<SQLite3DB> database_)
 : database(std::move(database_))
@@ -12,39 +13,65 @@ SQLiteSeasonRepository::SQLiteSeasonRepository(std::shared_ptr<SQLite3DB> databa
     //Create table and indexes
     database->unsafe_query("CREATE TABLE IF NOT EXISTS season(id INTEGER PRIMARY KEY AUTOINCREMENT, filepath VARCHAR(4096) NOT NULL, name VARCHAR(4096) NOT NULL, thumbnail BLOB NOT NULL, date_added DATE INTEGER NOT NULL);");
     database->unsafe_query("CREATE INDEX IF NOT EXISTS season_filepath_index ON season(filepath);");
+
+    //Added since the table was first created
+    database->add_column_if_missing("season", "mod_date", "INTEGER NOT NULL DEFAULT 0");
+    database->add_column_if_missing("season", "entry_count", "INTEGER NOT NULL DEFAULT 0");
+
+    //Thumbnails used to be stored in the season table, which meant that every season listing loaded them all.
+    //They're moved out to their own table. The old column's left empty, as SQLite can't always drop columns.
+    database->unsafe_query("CREATE TABLE IF NOT EXISTS season_thumbnail(season_id INTEGER PRIMARY KEY, thumbnail BLOB NOT NULL);");
+    SQLite3DB::Transaction transaction(*database);
+    database->unsafe_query("INSERT OR IGNORE INTO season_thumbnail(season_id, thumbnail) SELECT id, thumbnail FROM season WHERE length(thumbnail) > 0;");
+    database->unsafe_query("UPDATE season SET thumbnail=x'' WHERE length(thumbnail) > 0;");
+    transaction.commit();
 }
 
 uint64_t SQLiteSeasonRepository::database_create(SeasonEntry *entry)
 {
-    return database->insert_query("INSERT INTO season VALUES(NULL, ?, ?, ?, ?)",
-                                  {entry->get_filepath(), entry->get_name(), DBType(entry->get_thumbnail(), DBType::BLOB), entry->get_date_added()});
+    return database->insert_query("INSERT INTO season(filepath, name, thumbnail, date_added, mod_date, entry_count) VALUES(?, ?, x'', ?, ?, ?)",
+                                  {entry->get_filepath(), entry->get_name(), entry->get_date_added(), entry->get_mod_date(), entry->get_entry_count()});
 }
 
 std::shared_ptr<SeasonEntry> SQLiteSeasonRepository::database_load(uint64_t entry_id)
 {
-    SQLite3DB::query_t results = database->query("SELECT * FROM season WHERE id=?", {entry_id});
+    SQLite3DB::query_t results = database->query("SELECT " column_list " FROM season WHERE id=?", {entry_id});
 
     return std::make_shared<SeasonEntry>(entry_id,
                                          results.at("filepath").at(0).get<std::string>(),
                                          results.at("name").at(0).get<std::string>(),
-                                         results.at("thumbnail").at(0).get<std::string>(),
-                                         results.at("date_added").at(0).get<time_t>());
+                                         static_cast<time_t>(results.at("date_added").at(0).get<uint64_t>()),
+                                         static_cast<time_t>(results.at("mod_date").at(0).get<uint64_t>()),
+                                         results.at("entry_count").at(0).get<uint64_t>());
 }
 
 void SQLiteSeasonRepository::database_update(std::shared_ptr<SeasonEntry> entry)
 {
-    database->query("UPDATE season SET filepath=?, name=?, thumbnail=?, date_added=? WHERE id=?",
-                    {entry->get_filepath(), entry->get_name(), entry->get_thumbnail(), entry->get_date_added(), entry->get_id()});
+    database->query("UPDATE season SET filepath=?, name=?, date_added=?, mod_date=?, entry_count=? WHERE id=?",
+                    {entry->get_filepath(), entry->get_name(), entry->get_date_added(), entry->get_mod_date(), entry->get_entry_count(), entry->get_id()});
 }
 
 void SQLiteSeasonRepository::database_erase(uint64_t entry_id)
 {
+    database->query("DELETE FROM season_thumbnail WHERE season_id=?", {entry_id});
     database->query("DELETE FROM season WHERE id=?", {entry_id});
 }
 
+void SQLiteSeasonRepository::batch(const std::function<void()> &operations)
+{
+    SQLite3DB::Transaction transaction(*database);
+    operations();
+    transaction.commit();
+}
+
+uint64_t SQLiteSeasonRepository::database_rollback_count()
+{
+    return database->get_rollback_count();
+}
+
 void SQLiteSeasonRepository::for_each_season(const std::function<bool(std::shared_ptr<SeasonEntry>)> callback)
 {
-    auto stmt = database->compile_statement("SELECT * FROM season ORDER BY UPPER(name)");
+    auto stmt = database->compile_statement("SELECT " column_list " FROM season ORDER BY UPPER(name)");
     database->for_each<SeasonEntry>(stmt, {}, column_names, [&](std::shared_ptr<SeasonEntry> obj) {
         return callback(store_cache(obj));
     });
@@ -52,9 +79,32 @@ void SQLiteSeasonRepository::for_each_season(const std::function<bool(std::share
 
 uint64_t SQLiteSeasonRepository::get_season_id_from_filepath(const std::string &season_filepath)
 {
-    SQLite3DB::query_t query = database->query("SELECT * FROM season WHERE filepath=?", {season_filepath});
+    SQLite3DB::query_t query = database->query("SELECT id FROM season WHERE filepath=?", {season_filepath});
     auto &iter = query.at("id");
     if(iter.empty())
         return NO_SUCH_ENTRY;
     return iter.at(0).get<uint64_t>();
 }
+
+std::string SQLiteSeasonRepository::load_thumbnail(uint64_t season_id)
+{
+    SQLite3DB::query_t query = database->query("SELECT thumbnail FROM season_thumbnail WHERE season_id=?", {season_id});
+    auto &thumbnails = query["thumbnail"];
+    if(thumbnails.empty())
+        return "";
+    return thumbnails.at(0).get<std::string>();
+}
+
+void SQLiteSeasonRepository::store_thumbnail(uint64_t season_id, const std::string &thumbnail)
+{
+    database->query("INSERT OR REPLACE INTO season_thumbnail(season_id, thumbnail) VALUES(?, ?)", {season_id, DBType(thumbnail, DBType::BLOB)});
+}
+
+std::unordered_set<uint64_t> SQLiteSeasonRepository::get_seasons_with_thumbnails()
+{
+    std::unordered_set<uint64_t> season_ids;
+    SQLite3DB::query_t query = database->query("SELECT season_id FROM season_thumbnail", {});
+    for(auto &season_id : query["season_id"])
+        season_ids.emplace(season_id.get<uint64_t>());
+    return season_ids;
+}
@@ -47,6 +47,21 @@ public:
      */
     void database_erase(uint64_t entry_id) override;
 
+    /*!
+     * Runs a set of operations within a single transaction
+     *
+     * @throws Whatever the operations throw
+     * @param operations The operations to run
+     */
+    void batch(const std::function<void()> &operations) override;
+
+    /*!
+     * Gets the number of times the database has been rolled back
+     *
+     * @return The number of rollbacks so far
+     */
+    uint64_t database_rollback_count() override;
+
     /*!
      * Iterates through every row in the table, calling a callback
      * for each entry.
@@ -64,6 +79,30 @@ public:
      */
     uint64_t get_season_id_from_filepath(const std::string &season_filepath) override;
 
+    /*!
+     * Loads the thumbnail of a season. Thumbnails are stored apart from the seasons
+     * themselves, so that listing seasons doesn't load every thumbnail along with them.
+     *
+     * @param season_id The ID of the season
+     * @return The thumbnail as a JPEG. Empty if the season doesn't have one.
+     */
+    std::string load_thumbnail(uint64_t season_id) override;
+
+    /*!
+     * Stores the thumbnail of a season, replacing any it already has
+     *
+     * @param season_id The ID of the season
+     * @param thumbnail The thumbnail as a JPEG
+     */
+    void store_thumbnail(uint64_t season_id, const std::string &thumbnail) override;
+
+    /*!
+     * Gets which seasons have a thumbnail, without loading any of them
+     *
+     * @return The IDs of every season which has a thumbnail
+     */
+    std::unordered_set<uint64_t> get_seasons_with_thumbnails() override;
+
 private:
     std::shared_ptr<SQLite3DB> database;
 };
@@ -16,34 +16,37 @@
 class SeasonEntry
 {
 public:
-    SeasonEntry(uint64_t id_, std::string filepath_, std::string name_, std::string thumbnail_, uint64_t date_added_)
+    SeasonEntry(uint64_t id_, std::string filepath_, std::string name_, uint64_t date_added_, uint64_t mod_date_, uint64_t entry_count_)
     : id(id_),
       filepath(std::move(filepath_)),
       name(std::move(name_)),
-      thumbnail(std::move(thumbnail_)),
-      date_added(date_added_)
+      date_added(date_added_),
+      mod_date(mod_date_),
+      entry_count(entry_count_)
     {}
 
     SeasonEntry(SeasonEntry&&o)
     : id(o.id),
       filepath(std::move(o.filepath)),
       name(std::move(o.name)),
-      thumbnail(std::move(o.thumbnail)),
-      date_added(o.date_added)
+      date_added(o.date_added),
+      mod_date(o.mod_date),
+      entry_count(o.entry_count)
     {
 
     }
 
     SeasonEntry()
-    : SeasonEntry(0, "", "", "", 0)
+    : SeasonEntry(0, "", "", 0, 0, 0)
     {}
 
     db_define_dirty()
     db_entry_def(uint64_t, id)
     db_entry_def(std::string, filepath)
     db_entry_def(std::string, name)
-    db_entry_def(std::string, thumbnail)
     db_entry_def(time_t, date_added)
+    db_entry_def(time_t, mod_date) //Modification time of the season's directory when it was last synced
+    db_entry_def(uint64_t, entry_count) //Number of entries in the season's directory when it was last synced
 };
 
 
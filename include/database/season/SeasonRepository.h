@@ -7,6 +7,7 @@
 
 
 #include <functional>
+#include <unordered_set>
 #include <database/DatabaseRepository.h>
 #include "SeasonEntry.h"
 
@@ -29,6 +30,30 @@ public:
      * @return A season ID on success, NO_SUCH_ENTRY on failure.
      */
     virtual uint64_t get_season_id_from_filepath(const std::string &season_filepath)=0;
+
+    /*!
+     * Loads the thumbnail of a season. Thumbnails are stored apart from the seasons
+     * themselves, so that listing seasons doesn't load every thumbnail along with them.
+     *
+     * @param season_id The ID of the season
+     * @return The thumbnail as a JPEG. Empty if the season doesn't have one.
+     */
+    virtual std::string load_thumbnail(uint64_t season_id)=0;
+
+    /*!
+     * Stores the thumbnail of a season, replacing any it already has
+     *
+     * @param season_id The ID of the season
+     * @param thumbnail The thumbnail as a JPEG
+     */
+    virtual void store_thumbnail(uint64_t season_id, const std::string &thumbnail)=0;
+
+    /*!
+     * Gets which seasons have a thumbnail, without loading any of them
+     *
+     * @return The IDs of every season which has a thumbnail
+     */
+    virtual std::unordered_set<uint64_t> get_seasons_with_thumbnails()=0;
 };
 
 
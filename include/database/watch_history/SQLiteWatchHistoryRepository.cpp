@@ -24,7 +24,7 @@ std::shared_ptr<WatchHistoryEntry> SQLiteWatchHistoryRepository::database_load(u
 
     return std::make_shared<WatchHistoryEntry>(entry_id,
                                                results.at("episode_id").at(0).get<uint64_t>(),
-                                               results.at("date").at(0).get<time_t>());
+                                               static_cast<time_t>(results.at("date").at(0).get<uint64_t>()));
 }
 
 void SQLiteWatchHistoryRepository::database_update(std::shared_ptr<WatchHistoryEntry> entry)
@@ -38,6 +38,18 @@ void SQLiteWatchHistoryRepository::database_erase(uint64_t entry_id)
     database->query("DELETE FROM watch_history WHERE id=?", {entry_id});
 }
 
+void SQLiteWatchHistoryRepository::batch(const std::function<void()> &operations)
+{
+    SQLite3DB::Transaction transaction(*database);
+    operations();
+    transaction.commit();
+}
+
+uint64_t SQLiteWatchHistoryRepository::database_rollback_count()
+{
+    return database->get_rollback_count();
+}
+
 void SQLiteWatchHistoryRepository::for_each_entry(bool unique, const std::function<bool(std::shared_ptr<WatchHistoryEntry>)> callback)
 {
     const static std::string unique_query = "SELECT * FROM watch_history GROUP BY episode_id ORDER BY id DESC";
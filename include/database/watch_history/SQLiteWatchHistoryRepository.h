@@ -46,6 +46,21 @@ public:
      */
     void database_erase(uint64_t entry_id) override;
 
+    /*!
+     * Runs a set of operations within a single transaction
+     *
+     * @throws Whatever the operations throw
+     * @param operations The operations to run
+     */
+    void batch(const std::function<void()> &operations) override;
+
+    /*!
+     * Gets the number of times the database has been rolled back
+     *
+     * @return The number of rollbacks so far
+     */
+    uint64_t database_rollback_count() override;
+
     /*!
      * Iterates through each unique watch history entry,
      * in the order of most recent to least recent.
@@ -3,7 +3,7 @@
 #include <mutex>
 #include <SFML/Graphics.hpp>
 #include <SSHConnection.h>
-#include <SFTPSession.h>
+#include <SFTPSessionPool.h>
 #include <cstring>
 #include <atomic>
 #include <gtkmm-3.0/gtkmm.h>
@@ -15,6 +15,8 @@
 #include <Log.h>
 #include <SignalHandler.h>
 #include <database/SQLiteMiscRepository.h>
+#include <BlockCache.h>
+#include <DiskCache.h>
 
 int main(int argc, char** argv)
 {
@@ -45,13 +47,20 @@ int main(int argc, char** argv)
         return EXIT_FAILURE;
     }
 
+    //Size the shared in-memory cache of remote file data, and open the on-disk one
+    BlockCache::get_instance().set_capacity(config.get<uint64_t>(CONFIG_CACHE_MEMORY_SIZE));
+    if(!DiskCache::get_instance().init(config.get<std::string>(CONFIG_CACHE_DISK_LOCATION), config.get<uint64_t>(CONFIG_CACHE_DISK_SIZE)))
+    {
+        frlog << Log::warn << "Failed to initialise the disk cache. Continuing without it." << Log::end;
+    }
+
     //Start SFTP connection. Note: Only keyring is supported at the moment. So identity should be loaded prior to starting.
-    SSHConnection connection;
-    std::shared_ptr<SFTPSession> sftp;
+    auto sftp = std::make_shared<SFTPSessionPool>(config.get<std::string>(CONFIG_SFTP_IP), config.get<uint32_t>(CONFIG_SFTP_PORT),
+            config.get<std::string>(CONFIG_SFTP_USERNAME), config.get<uint32_t>(CONFIG_SFTP_POOL_SIZE));
     try
     {
-        connection.connect(config.get<std::string>(CONFIG_SFTP_IP), config.get<uint32_t>(CONFIG_SFTP_PORT), config.get<std::string>(CONFIG_SFTP_USERNAME));
-        sftp = std::make_shared<SFTPSession>(&connection);
+        //Connect up front, so that a bad config is reported straight away and the host key is verified before anything runs in the background
+        sftp->checkout();
     }
     catch(const std::exception &e)
     {
@@ -76,7 +85,14 @@ int main(int argc, char** argv)
         Application *window;
         glade_builder->get_widget_derived("main_window", window, library, sftp);
         window->set_title(WINDOW_TITLE);
+
+        //The window shows what's already in the database, and is kept up to date as the library syncs behind it
+        library->start_sync();
+        if(config.get<bool>(CONFIG_LIBRARY_WATCH_CHANGES))
+            library->start_watching();
         application->run(*window);
+        library->stop_sync();
+        library->stop_watching();
         delete window;
     }
     season_table->flush();
@@ -22,9 +22,10 @@
 Application::Application(BaseObjectType *cobject,
                          const Glib::RefPtr<Gtk::Builder> &refBuilder,
                          std::shared_ptr<Library> library_,
-                         std::shared_ptr<SFTPSession> sftp_)
+                         std::shared_ptr<SFTPSessionPool> sftp_)
 : Gtk::Window(cobject),
   builder(refBuilder),
+  showing_home(false),
   library(std::move(library_)),
   sftp(std::move(sftp_))
 {
@@ -40,6 +41,7 @@ Application::Application(BaseObjectType *cobject,
     builder->get_widget("results_window", results_viewport);
     builder->get_widget("window_box", window_box);
     builder->get_widget("search_bar", search_bar);
+    builder->get_widget("sync_progress", sync_progress);
 
     //Connect widgets
     home_button->signal_clicked().connect(sigc::mem_fun(*this, &Application::load_home));
@@ -47,13 +49,25 @@ Application::Application(BaseObjectType *cobject,
     recently_added_button->signal_clicked().connect(sigc::mem_fun(*this, &Application::load_recently_added));
     search_bar->signal_search_changed().connect(sigc::mem_fun(*this, &Application::signal_search_changed));
 
+    //Sync events arrive on the library's threads, so are queued up and handled on this one
+    sync_dispatcher.connect(sigc::mem_fun(*this, &Application::signal_sync_events));
+    library->set_sync_listener([this](const Library::SyncEvent &event) {
+        {
+            std::lock_guard<std::mutex> guard(sync_events_lock);
+            sync_events.emplace_back(event);
+        }
+        sync_dispatcher.emit();
+    });
+
     //Load home
     load_home();
 }
 
 Application::~Application()
 {
+    library->set_sync_listener(nullptr);
     video_player = nullptr;
+    playback_session.release();
 }
 
 void Application::load_home()
@@ -62,18 +76,9 @@ void Application::load_home()
     frlog << Log::info << "Loading home screen" << Log::end;
 
     //Fill the flow box in with season entries
+    showing_home = true;
     library->for_each_season([&](std::shared_ptr<SeasonEntry> season) -> bool {
-
-        //Create a season entry tile, and connect it to a season display handler
-        auto season_listing = std::make_shared<SeasonListingWidget>(season);
-        season_listing->signal_button_press_event().connect(
-                sigc::bind<std::shared_ptr<SeasonListingWidget>>(sigc::mem_fun(*this,
-                                                                               &Application::signal_library_listing_clicked), season_listing));
-
-        //Add it to the global UI
-        results_list->add(*season_listing);
-        listed_results.emplace_back(std::move(season_listing));
-
+        add_season_listing(std::move(season));
         return true;
     });
 
@@ -87,15 +92,7 @@ void Application::load_history()
 
     library->for_each_recently_watched([&](std::shared_ptr<SeasonEntry> season) -> bool {
 
-        //Create a season entry tile, and connect it to a season display handler
-        auto season_listing = std::make_shared<SeasonListingWidget>(season);
-        season_listing->signal_button_press_event().connect(
-                sigc::bind<std::shared_ptr<SeasonListingWidget>>(
-                        sigc::mem_fun(*this, &Application::signal_library_listing_clicked), season_listing));
-
-        //Add it to the global UI
-        results_list->add(*season_listing);
-        listed_results.emplace_back(std::move(season_listing));
+        add_season_listing(std::move(season));
 
         return listed_results.size() < 50;
     });
@@ -116,15 +113,7 @@ void Application::load_recently_added()
             return true;
         seasons_shown.emplace(season->get_id());
 
-        //Create a season entry tile, and connect it to a season display handler
-        auto season_listing = std::make_shared<SeasonListingWidget>(season);
-        season_listing->signal_button_press_event().connect(
-                sigc::bind<std::shared_ptr<SeasonListingWidget>>(
-                        sigc::mem_fun(*this, &Application::signal_library_listing_clicked), season_listing));
-
-        //Add it to the global UI
-        results_list->add(*season_listing);
-        listed_results.emplace_back(std::move(season_listing));
+        add_season_listing(std::move(season));
 
         return listed_results.size() < 50;
     });
@@ -139,8 +128,7 @@ bool Application::signal_library_listing_clicked(GdkEventButton *button,
     if(button->button == RIGHT_CLICK)
     {
         frlog << Log::info << "Regenerating season thumbnail for: " << season_listing->get_season_entry()->get_name() << Log::end;
-        season_listing->get_season_entry()->set_thumbnail(library->generate_season_thumbnail(season_listing->get_season_entry()->get_filepath()));
-        season_listing->update();
+        library->regenerate_season_thumbnail(season_listing->get_season_entry()->get_id());
         return true;
     }
 
@@ -149,15 +137,24 @@ bool Application::signal_library_listing_clicked(GdkEventButton *button,
     clear();
     frlog << Log::info << "Loading season screen" << Log::end;
 
+    //List the season once, rather than statting each episode. The attributes are kept to open episodes with later.
+    listed_attributes.clear();
+    try
+    {
+        for(auto &attributes : sftp->checkout_interactive()->enumerate_directory(season_listing->get_season_entry()->get_filepath()))
+            listed_attributes.emplace(attributes.full_name, std::move(attributes));
+    }
+    catch(const std::exception &e)
+    {
+        frlog << Log::warn << "Failed to list " << season_listing->get_season_entry()->get_name() << ": " << e.what() << Log::end;
+        return true;
+    }
+
     //Add in library tile's entries
     library->for_each_episode_in_season(season_listing->get_season_entry()->get_id(), [&](std::shared_ptr<EpisodeEntry> episode) -> bool {
 
         //Check that this episode still exists on the server
-        try
-        {
-            sftp->stat(episode->get_filepath());
-        }
-        catch(...)
+        if(listed_attributes.find(episode->get_filepath()) == listed_attributes.end())
         {
             //It no longer exists, erase it
             frlog << Log::info << "Deleting removed episode: " << episode->get_name() << Log::end;
@@ -211,8 +208,21 @@ bool Application::signal_episode_listing_clicked(GdkEventButton *button,
 
     //Setup the video widget and file stream
     current_playing = episode_listing->get_episode_entry();
-    auto video_source = std::make_unique<SFTPFile>(sftp->open(current_playing->get_filepath()));
-    auto video_stream = std::make_unique<SFTPStream>(std::move(video_source)); //todo: abstract, accept sf::InputStream from library instead
+    playback_session = sftp->checkout_interactive();
+    auto listed = listed_attributes.find(current_playing->get_filepath());
+    auto video_source = std::make_unique<SFTPFile>(listed != listed_attributes.end() ? playback_session->open(listed->second) : playback_session->open(current_playing->get_filepath()));
+    std::unique_ptr<SFTPStripedReader> striped_reader;
+    Config &config = Config::get_instance();
+    auto striped_connections = config.get<uint32_t>(CONFIG_SFTP_STRIPED_CONNECTIONS);
+    if(striped_connections > 1)
+    {
+        striped_reader = std::make_unique<SFTPStripedReader>(config.get<std::string>(CONFIG_SFTP_IP), config.get<uint32_t>(CONFIG_SFTP_PORT),
+                config.get<std::string>(CONFIG_SFTP_USERNAME), video_source->get_attributes(), striped_connections, video_source->get_stats());
+    }
+    auto video_stream = std::make_unique<SFTPStream>(std::move(video_source), std::move(striped_reader)); //todo: abstract, accept sf::InputStream from library instead
+    video_stream->enable_stats_logging();
+    if(current_playing->get_media_probed() && current_playing->get_bitrate() != 0)
+        video_stream->set_bitrate(current_playing->get_bitrate());
     video_player = std::make_unique<VideoPlayerWidget>(GDK_WINDOW_XID(get_window()->gobj()), std::move(video_stream));
     video_player->signal_playback_state_changed().connect(sigc::mem_fun(this, &Application::signal_play_state_changed));
     video_player->set_playback_offset(current_playing->get_watch_offset());
@@ -271,6 +281,7 @@ void Application::signal_play_state_changed(VideoWidget::SignalType state)
         Gtk::Container::remove(video_box);
         add(*window_box);
         video_player = nullptr;
+        playback_session.release();
         current_playing = nullptr;
         get_window()->set_title(WINDOW_TITLE);
     }
@@ -281,6 +292,7 @@ void Application::clear()
 {
     //Remove all library tiles
     frlog << Log::info << "Clearing screen entries" << Log::end;
+    showing_home = false;
     auto children = results_list->get_children();
     for(auto &iter : children)
         results_list->remove(*iter);
@@ -290,3 +302,93 @@ void Application::clear()
     //Reset scrolled window container scroll
     results_viewport->get_vadjustment()->set_value(0.0);
 }
+
+void Application::add_season_listing(std::shared_ptr<SeasonEntry> season)
+{
+    //Create a season entry tile, and connect it to a season display handler
+    auto season_listing = std::make_shared<SeasonListingWidget>(std::move(season), [this](uint64_t season_id) {
+        return library->get_season_thumbnail(season_id);
+    });
+    season_listing->signal_button_press_event().connect(
+            sigc::bind<std::shared_ptr<SeasonListingWidget>>(
+                    sigc::mem_fun(*this, &Application::signal_library_listing_clicked), season_listing));
+
+    //Add it to the global UI
+    results_list->add(*season_listing);
+    listed_results.emplace_back(std::move(season_listing));
+}
+
+std::vector<std::shared_ptr<Gtk::Widget>>::iterator Application::find_season_listing(uint64_t season_id)
+{
+    return std::find_if(listed_results.begin(), listed_results.end(), [season_id](const std::shared_ptr<Gtk::Widget> &widget) {
+        auto *season_listing = dynamic_cast<SeasonListingWidget*>(widget.get());
+        return season_listing && season_listing->get_season_entry()->get_id() == season_id;
+    });
+}
+
+void Application::signal_sync_events()
+{
+    std::vector<Library::SyncEvent> events;
+    {
+        std::lock_guard<std::mutex> guard(sync_events_lock);
+        events.swap(sync_events);
+    }
+
+    for(auto &event : events)
+    {
+        switch(event.type)
+        {
+            case Library::SyncEvent::SeasonAdded:
+            {
+                //Only the home screen lists every season
+                if(!showing_home)
+                    break;
+                try
+                {
+                    add_season_listing(library->get_season(event.season_id));
+                }
+                catch(const std::exception &e)
+                {
+                    frlog << Log::warn << "Failed to load newly found season " << event.season_id << ": " << e.what() << Log::end;
+                    break;
+                }
+                results_list->show_all();
+                if(!search_bar->get_text().empty())
+                    signal_search_changed();
+                break;
+            }
+            case Library::SyncEvent::SeasonUpdated:
+            {
+                auto iter = find_season_listing(event.season_id);
+                if(iter != listed_results.end())
+                    dynamic_cast<SeasonListingWidget*>(iter->get())->update();
+                break;
+            }
+            case Library::SyncEvent::SeasonRemoved:
+            {
+                auto iter = find_season_listing(event.season_id);
+                if(iter == listed_results.end())
+                    break;
+                auto parent = (*iter)->get_parent();
+                if(parent)
+                    parent->remove(**iter);
+                listed_results.erase(iter);
+                break;
+            }
+            case Library::SyncEvent::Progress:
+            {
+                if(event.seasons_total == 0)
+                    break;
+                sync_progress->set_fraction(static_cast<double>(event.seasons_done) / event.seasons_total);
+                sync_progress->set_text("Syncing library (" + std::to_string(event.seasons_done) + "/" + std::to_string(event.seasons_total) + ")");
+                sync_progress->show();
+                break;
+            }
+            case Library::SyncEvent::Finished:
+            {
+                sync_progress->hide();
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,103 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#include "BlockCache.h"
+
+BlockCache::BlockCache()
+: capacity(BLOCK_CACHE_DEFAULT_CAPACITY),
+  size(0)
+{
+
+}
+
+BlockCache::block_t BlockCache::get(const Attributes &file, uint64_t block_index, const fetcher_t &fetch)
+{
+    Key key{file.full_name, file.mod_date, file.size, block_index};
+    std::promise<block_t> promise;
+    std::shared_future<block_t> pending;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        //Serve it from the cache if we can, moving it to the front of the LRU list
+        auto iter = blocks.find(key);
+        if(iter != blocks.end())
+        {
+            lru.splice(lru.begin(), lru, iter->second.lru_position);
+            return iter->second.data;
+        }
+
+        //If someone else is already fetching it then wait for them instead, else it's our job to fetch it
+        auto fetching = in_flight.find(key);
+        if(fetching != in_flight.end())
+            pending = fetching->second;
+        else
+            in_flight.emplace(key, promise.get_future().share());
+    }
+
+    if(pending.valid())
+        return pending.get();
+
+    //Fetch outside of the lock, so that other blocks can still be served
+    block_t block;
+    try
+    {
+        auto data = std::make_shared<std::string>();
+        fetch(*data);
+        block = std::move(data);
+    }
+    catch(...)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        promise.set_exception(std::current_exception());
+        in_flight.erase(key);
+        throw;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    promise.set_value(block);
+    in_flight.erase(key);
+    lru.emplace_front(key);
+    blocks.emplace(std::move(key), Entry{block, lru.begin()});
+    size += block->size();
+    evict();
+    return block;
+}
+
+bool BlockCache::contains(const Attributes &file, uint64_t block_index)
+{
+    Key key{file.full_name, file.mod_date, file.size, block_index};
+    std::lock_guard<std::mutex> guard(lock);
+    return blocks.find(key) != blocks.end() || in_flight.find(key) != in_flight.end();
+}
+
+void BlockCache::set_capacity(size_t bytes)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    capacity = bytes;
+    evict();
+}
+
+bool BlockCache::is_enabled()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return capacity != 0;
+}
+
+size_t BlockCache::get_size()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return size;
+}
+
+void BlockCache::evict()
+{
+    while(size > capacity && !lru.empty())
+    {
+        auto iter = blocks.find(lru.back());
+        size -= iter->second.data->size();
+        blocks.erase(iter);
+        lru.pop_back();
+    }
+}
@@ -15,13 +15,26 @@ static std::string default_config = ""
         "username=\"user\"\n"
         "password=\"\"\n"
         "keyfile=\"\"\n"
+        "pool_size=4\n"
+        "striped_connections=0\n"
         "\n"
         "[library]\n"
         "location=\"/remote/sftp/location\"\n"
+        "sync_list_threads=2\n"
+        "sync_thumbnail_threads=2\n"
+        "sync_probe_threads=2\n"
+        "exec_listing=1\n"
+        "watch_changes=0\n"
+        "\n"
+        "[cache]\n"
+        "memory_size=0x4000000\n"
+        "disk_location=\"cache/\"\n"
+        "disk_size=0x100000000\n"
         "\n"
         "[logging]\n"
         "retention=14\n"
-        "max_log_size=0x20000000\n";
+        "max_log_size=0x20000000\n"
+        "transfer_stats_interval=60\n";
 
 Config::Config()
 {
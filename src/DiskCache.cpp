@@ -0,0 +1,390 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <algorithm>
+#include <Log.h>
+#include <SystemUtilities.h>
+#include "BlockCache.h"
+#include "DiskCache.h"
+
+DiskCache::DiskCache()
+: capacity(0),
+  used(0)
+{
+
+}
+
+DiskCache::~DiskCache()
+{
+    files.clear();
+}
+
+DiskCache::Mapping::~Mapping()
+{
+    if(data)
+        munmap(data, size);
+    if(data_fd != -1)
+        ::close(data_fd);
+    if(bitmap_fd != -1)
+        ::close(bitmap_fd);
+}
+
+bool DiskCache::init(std::string directory_, uint64_t capacity_)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    directory = std::move(directory_);
+    if(directory.empty() || directory.back() != '/')
+        directory += '/';
+    files.clear();
+    used = 0;
+    capacity = 0;
+
+    if(capacity_ == 0)
+        return true;
+
+    if(!SystemUtilities::does_filepath_exist(directory) && !SystemUtilities::create_directory(directory))
+    {
+        frlog << Log::warn << "Failed to create disk cache directory '" << directory << "'. Errno: " << errno << Log::end;
+        return false;
+    }
+
+    //Load existing entries, deleting any which are unreadable
+    std::vector<std::string> listing;
+    if(!SystemUtilities::list_files(directory, listing))
+    {
+        frlog << Log::warn << "Failed to enumerate disk cache directory '" << directory << "'" << Log::end;
+        return false;
+    }
+
+    for(auto &name : listing)
+    {
+        if(name.size() < 4 || name.compare(name.size() - 4, 4, ".map") != 0)
+            continue;
+
+        std::string local_path = directory + name.substr(0, name.size() - 4);
+        auto cached = load_cached_file(local_path);
+        if(!cached)
+        {
+            frlog << Log::warn << "Discarding unreadable disk cache entry: " << local_path << Log::end;
+            std::remove((local_path + ".map").c_str());
+            std::remove((local_path + ".data").c_str());
+            continue;
+        }
+
+        used += cached->present_bytes;
+        files.emplace(name.substr(0, name.size() - 4), std::move(cached));
+    }
+
+    capacity = capacity_;
+    evict({});
+    frlog << Log::info << "Disk cache loaded " << files.size() << " files (" << used / 1048576 << "MB)" << Log::end;
+    return true;
+}
+
+bool DiskCache::is_enabled()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return capacity != 0;
+}
+
+bool DiskCache::read_block(const Attributes &file, uint64_t block_index, std::string &block)
+{
+    std::shared_ptr<Mapping> mapping;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if(capacity == 0)
+            return false;
+
+        auto iter = files.find(get_cache_name(file));
+        if(iter == files.end())
+            return false;
+        CachedFile &cached = *iter->second;
+
+        if(block_index / 8 >= cached.bitmap.size() || !(cached.bitmap[block_index / 8] & (1u << (block_index % 8))))
+            return false;
+        cached.last_access = std::time(nullptr);
+        if(!map_cached_file(cached))
+            return false;
+        mapping = cached.mapping;
+    }
+
+    //Copy outside of the lock. Holding a reference keeps the mapping alive, even if it's evicted meanwhile.
+    uint64_t block_start = block_index * BLOCK_CACHE_BLOCK_SIZE;
+    block.assign(mapping->data + block_start, std::min<uint64_t>(BLOCK_CACHE_BLOCK_SIZE, mapping->size - block_start));
+    return true;
+}
+
+bool DiskCache::contains(const Attributes &file, uint64_t block_index)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if(capacity == 0)
+        return false;
+
+    auto iter = files.find(get_cache_name(file));
+    if(iter == files.end())
+        return false;
+    const CachedFile &cached = *iter->second;
+    return block_index / 8 < cached.bitmap.size() && (cached.bitmap[block_index / 8] & (1u << (block_index % 8)));
+}
+
+void DiskCache::write_block(const Attributes &file, uint64_t block_index, const std::string &block)
+{
+    uint64_t block_start = block_index * BLOCK_CACHE_BLOCK_SIZE;
+    std::shared_ptr<CachedFile> cached;
+    std::shared_ptr<Mapping> mapping;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if(capacity == 0 || file.size == 0)
+            return;
+
+        if(block_start + block.size() > file.size || block.size() > capacity)
+            return;
+
+        //Find the file's entry, or create a new one
+        std::string name = get_cache_name(file);
+        auto iter = files.find(name);
+        if(iter == files.end())
+        {
+            auto created = std::make_shared<CachedFile>();
+            created->filepath = file.full_name;
+            created->mod_date = file.mod_date;
+            created->size = file.size;
+            created->local_path = directory + name;
+            created->bitmap.resize((file.size / BLOCK_CACHE_BLOCK_SIZE + 1 + 7) / 8, 0);
+            created->present_bytes = 0;
+            created->last_access = std::time(nullptr);
+            iter = files.emplace(name, std::move(created)).first;
+        }
+        cached = iter->second;
+
+        uint8_t &bitmap_byte = cached->bitmap[block_index / 8];
+        auto bit = static_cast<uint8_t>(1u << (block_index % 8));
+        if(bitmap_byte & bit)
+            return;
+
+        //Make room for it
+        cached->last_access = std::time(nullptr);
+        if(!map_cached_file(*cached))
+        {
+            used -= cached->present_bytes;
+            std::remove((cached->local_path + ".map").c_str());
+            std::remove((cached->local_path + ".data").c_str());
+            files.erase(name);
+            return;
+        }
+        used += block.size();
+        cached->present_bytes += block.size();
+        evict(name);
+
+        //Readers can have it from the mapping straight away, but it's not marked as present on disk until it's flushed
+        memcpy(cached->mapping->data + block_start, block.data(), block.size());
+        bitmap_byte |= bit;
+        cached->unflushed_blocks.emplace(block_index);
+        mapping = cached->mapping;
+    }
+
+    //Flushing waits on the disk, so it's done outside of the lock, with references keeping the file open meanwhile.
+    //The data's flushed before the bitmap is written, so that a crash can't leave it claiming blocks that never made it.
+    auto page_size = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    uint64_t sync_start = block_start - block_start % page_size;
+    if(msync(mapping->data + sync_start, block_start + block.size() - sync_start, MS_SYNC) != 0)
+    {
+        //It's left as unflushed, so that it's never marked as present on disk
+        frlog << Log::warn << "Failed to flush disk cache file for " << cached->filepath << ". Errno: " << errno << Log::end;
+        return;
+    }
+
+    //Blocks sharing its byte of the bitmap may not have been flushed yet
+    std::lock_guard<std::mutex> guard(lock);
+    cached->unflushed_blocks.erase(block_index);
+    uint64_t first_in_byte = block_index - block_index % 8;
+    uint8_t bitmap_byte = cached->bitmap[block_index / 8];
+    for(uint64_t a = first_in_byte; a < first_in_byte + 8; ++a)
+    {
+        if(cached->unflushed_blocks.count(a) != 0)
+            bitmap_byte &= static_cast<uint8_t>(~(1u << (a % 8)));
+    }
+
+    auto header_size = static_cast<off_t>(strlen(DISK_CACHE_MAGIC) + sizeof(uint64_t) * 2 + sizeof(uint32_t) + cached->filepath.size());
+    if(pwrite(mapping->bitmap_fd, &bitmap_byte, 1, header_size + static_cast<off_t>(block_index / 8)) != 1)
+        frlog << Log::warn << "Failed to update disk cache bitmap for " << cached->filepath << ". Errno: " << errno << Log::end;
+}
+
+std::string DiskCache::get_cache_name(const Attributes &file)
+{
+    //FNV-1a over the identifying attributes
+    uint64_t hash = 0xcbf29ce484222325;
+    auto mix = [&](const void *data, size_t len) {
+        for(size_t a = 0; a < len; ++a)
+        {
+            hash ^= static_cast<const uint8_t*>(data)[a];
+            hash *= 0x100000001b3;
+        }
+    };
+    auto mod_date = static_cast<uint64_t>(file.mod_date);
+    auto size = static_cast<uint64_t>(file.size);
+    mix(file.full_name.data(), file.full_name.size());
+    mix(&mod_date, sizeof(mod_date));
+    mix(&size, sizeof(size));
+
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hash));
+    return name;
+}
+
+std::shared_ptr<DiskCache::CachedFile> DiskCache::load_cached_file(const std::string &local_path)
+{
+    std::string data;
+    try
+    {
+        data = SystemUtilities::read_binary_file(local_path + ".map");
+    }
+    catch(const std::exception &e)
+    {
+        return nullptr;
+    }
+
+    //Parse the header
+    size_t magic_len = strlen(DISK_CACHE_MAGIC);
+    size_t fixed_header_size = magic_len + sizeof(uint64_t) * 2 + sizeof(uint32_t);
+    if(data.size() < fixed_header_size || data.compare(0, magic_len, DISK_CACHE_MAGIC) != 0)
+        return nullptr;
+
+    auto cached = std::make_shared<CachedFile>();
+    uint64_t mod_date;
+    uint32_t filepath_len;
+    memcpy(&mod_date, &data[magic_len], sizeof(mod_date));
+    memcpy(&cached->size, &data[magic_len + sizeof(uint64_t)], sizeof(uint64_t));
+    memcpy(&filepath_len, &data[magic_len + sizeof(uint64_t) * 2], sizeof(filepath_len));
+    cached->mod_date = static_cast<time_t>(mod_date);
+
+    size_t bitmap_size = (cached->size / BLOCK_CACHE_BLOCK_SIZE + 1 + 7) / 8;
+    if(data.size() != fixed_header_size + filepath_len + bitmap_size)
+        return nullptr;
+    cached->filepath = data.substr(fixed_header_size, filepath_len);
+    cached->bitmap.assign(data.begin() + fixed_header_size + filepath_len, data.end());
+    cached->local_path = local_path;
+
+    //The data file must still be there, and the right size
+    struct stat info{};
+    if(stat((local_path + ".data").c_str(), &info) != 0 || static_cast<uint64_t>(info.st_size) != cached->size)
+        return nullptr;
+
+    //Tally up what's present
+    cached->present_bytes = 0;
+    uint64_t block_count = (cached->size + BLOCK_CACHE_BLOCK_SIZE - 1) / BLOCK_CACHE_BLOCK_SIZE;
+    for(uint64_t block = 0; block < block_count; ++block)
+    {
+        if(cached->bitmap[block / 8] & (1u << (block % 8)))
+            cached->present_bytes += std::min<uint64_t>(BLOCK_CACHE_BLOCK_SIZE, cached->size - block * BLOCK_CACHE_BLOCK_SIZE);
+    }
+    cached->last_access = SystemUtilities::get_modification_date(local_path + ".map");
+    return cached;
+}
+
+bool DiskCache::map_cached_file(CachedFile &cached)
+{
+    if(cached.mapping)
+        return true;
+
+    //Open/create the sparse data file
+    auto mapping = std::make_shared<Mapping>();
+    mapping->data_fd = ::open((cached.local_path + ".data").c_str(), O_RDWR | O_CREAT, 0600);
+    if(mapping->data_fd == -1 || ftruncate(mapping->data_fd, static_cast<off_t>(cached.size)) != 0)
+    {
+        frlog << Log::warn << "Failed to open disk cache file " << cached.local_path << ".data. Errno: " << errno << Log::end;
+        return false;
+    }
+
+    void *data = mmap(nullptr, cached.size, PROT_READ | PROT_WRITE, MAP_SHARED, mapping->data_fd, 0);
+    if(data == MAP_FAILED)
+    {
+        frlog << Log::warn << "Failed to map disk cache file " << cached.local_path << ".data. Errno: " << errno << Log::end;
+        return false;
+    }
+    mapping->data = static_cast<char*>(data);
+    mapping->size = cached.size;
+
+    //Open the bitmap, writing the header if it's new
+    bool is_new = !SystemUtilities::does_filepath_exist(cached.local_path + ".map");
+    mapping->bitmap_fd = ::open((cached.local_path + ".map").c_str(), O_RDWR | O_CREAT, 0600);
+    if(mapping->bitmap_fd == -1)
+    {
+        frlog << Log::warn << "Failed to open disk cache bitmap " << cached.local_path << ".map. Errno: " << errno << Log::end;
+        return false;
+    }
+    if(is_new)
+    {
+        auto mod_date = static_cast<uint64_t>(cached.mod_date);
+        auto filepath_len = static_cast<uint32_t>(cached.filepath.size());
+        std::string header(DISK_CACHE_MAGIC);
+        header.append(reinterpret_cast<const char*>(&mod_date), sizeof(mod_date));
+        header.append(reinterpret_cast<const char*>(&cached.size), sizeof(cached.size));
+        header.append(reinterpret_cast<const char*>(&filepath_len), sizeof(filepath_len));
+        header.append(cached.filepath);
+        header.append(reinterpret_cast<const char*>(cached.bitmap.data()), cached.bitmap.size());
+        if(write(mapping->bitmap_fd, header.data(), header.size()) != static_cast<ssize_t>(header.size()))
+        {
+            frlog << Log::warn << "Failed to write disk cache bitmap " << cached.local_path << ".map. Errno: " << errno << Log::end;
+            return false;
+        }
+    }
+    else
+    {
+        //Bump its on-disk modification date, so that LRU order survives restarts
+        utime((cached.local_path + ".map").c_str(), nullptr);
+    }
+
+    cached.mapping = std::move(mapping);
+    limit_mapped_files(cached);
+    return true;
+}
+
+void DiskCache::evict(const std::string &keep)
+{
+    while(used > capacity)
+    {
+        //Find the least recently used file
+        auto victim = files.end();
+        for(auto iter = files.begin(); iter != files.end(); ++iter)
+        {
+            if(iter->first != keep && (victim == files.end() || iter->second->last_access < victim->second->last_access))
+                victim = iter;
+        }
+        if(victim == files.end())
+            break;
+
+        //Files are unlinked now, but stay mapped until any readers are done with them
+        std::remove((victim->second->local_path + ".map").c_str());
+        std::remove((victim->second->local_path + ".data").c_str());
+        used -= victim->second->present_bytes;
+        files.erase(victim);
+    }
+}
+
+void DiskCache::limit_mapped_files(const CachedFile &keep)
+{
+    //Access times are only to the second, so the file just mapped may not be the most recent
+    std::vector<CachedFile*> mapped;
+    for(auto &file : files)
+    {
+        if(file.second->mapping && file.second.get() != &keep)
+            mapped.emplace_back(file.second.get());
+    }
+    if(mapped.size() < DISK_CACHE_MAX_MAPPED_FILES)
+        return;
+
+    //Readers still holding a mapping keep it alive until they're done
+    std::sort(mapped.begin(), mapped.end(), [](const CachedFile *a, const CachedFile *b) {
+        return a->last_access < b->last_access;
+    });
+    for(size_t a = 0; a < mapped.size() - (DISK_CACHE_MAX_MAPPED_FILES - 1); ++a)
+        mapped[a]->mapping = nullptr;
+}
@@ -2,6 +2,8 @@
 // Created by fred on 16/12/17.
 //
 
+#include <sstream>
+#include <iomanip>
 #include "EpisodeListingWidget.h"
 
 Glib::RefPtr<Gdk::Pixbuf> EpisodeListingWidget::watched_image = {};
@@ -35,5 +37,25 @@ void EpisodeListingWidget::update()
     label.set_text(episode_entry->get_name());
 
     set_search_string(episode_entry->get_name());
-    set_tooltip_text(episode_entry->get_name());
+    set_tooltip_text(episode_entry->get_name() + get_media_description());
+}
+
+std::string EpisodeListingWidget::get_media_description()
+{
+    if(!episode_entry->get_media_probed())
+        return std::string();
+
+    std::stringstream ss;
+    if(episode_entry->get_duration() != 0)
+    {
+        uint64_t seconds = episode_entry->get_duration() / 1000;
+        ss << "\n" << seconds / 60 << ":" << std::setw(2) << std::setfill('0') << seconds % 60;
+    }
+    if(!episode_entry->get_video_codec().empty())
+        ss << "\n" << episode_entry->get_width() << "x" << episode_entry->get_height() << " " << episode_entry->get_video_codec();
+    if(!episode_entry->get_audio_codec().empty())
+        ss << "\n" << episode_entry->get_audio_codec() << " " << episode_entry->get_audio_channels() << "ch";
+    if(episode_entry->get_bitrate() != 0)
+        ss << "\n" << std::fixed << std::setprecision(1) << episode_entry->get_bitrate() / 1000000.0 << "Mbps";
+    return ss.str();
 }
@@ -0,0 +1,102 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#include <stdexcept>
+#include "JpegEncoder.h"
+
+JpegEncoder::JpegEncoder(int quality_)
+: compressor(),
+  error_manager(),
+  destination(),
+  error_message(),
+  quality(quality_),
+  buffer(JPEG_ENCODER_INITIAL_BUFFER_SIZE, '\0'),
+  buffer_used(0)
+{
+    //Errors jump back into encode(), rather than the default of exiting the process
+    compressor.err = jpeg_std_error(&error_manager);
+    error_manager.error_exit = error_exit;
+    compressor.client_data = this;
+    jpeg_create_compress(&compressor);
+
+    destination.init_destination = init_destination;
+    destination.empty_output_buffer = empty_output_buffer;
+    destination.term_destination = term_destination;
+    compressor.dest = &destination;
+}
+
+JpegEncoder::~JpegEncoder()
+{
+    jpeg_destroy_compress(&compressor);
+}
+
+const std::string &JpegEncoder::encode(const uint8_t *pixels, size_t width, size_t height)
+{
+    if(setjmp(error_jump))
+    {
+        jpeg_abort_compress(&compressor);
+        throw std::runtime_error("Failed to encode JPEG: " + std::string(error_message));
+    }
+
+    compressor.image_width = static_cast<JDIMENSION>(width);
+    compressor.image_height = static_cast<JDIMENSION>(height);
+    compressor.input_components = 3;
+    compressor.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&compressor);
+    jpeg_set_quality(&compressor, quality, TRUE);
+    jpeg_start_compress(&compressor, TRUE);
+
+    //libjpeg doesn't take an alpha channel, so each row's converted to RGB first
+    row.resize(width * 3);
+    while(compressor.next_scanline < compressor.image_height)
+    {
+        const uint8_t *source = pixels + static_cast<size_t>(compressor.next_scanline) * width * 4;
+        for(size_t a = 0; a < width; ++a)
+        {
+            row[a * 3] = source[a * 4];
+            row[a * 3 + 1] = source[a * 4 + 1];
+            row[a * 3 + 2] = source[a * 4 + 2];
+        }
+        JSAMPROW rows[] = {row.data()};
+        jpeg_write_scanlines(&compressor, rows, 1);
+    }
+    jpeg_finish_compress(&compressor);
+
+    //The buffer's only shrunk to fit the image, so that its capacity's kept for the next
+    buffer.resize(buffer_used);
+    return buffer;
+}
+
+void JpegEncoder::init_destination(j_compress_ptr compressor)
+{
+    auto *encoder = static_cast<JpegEncoder*>(compressor->client_data);
+    encoder->buffer.resize(encoder->buffer.capacity());
+    encoder->buffer_used = 0;
+    encoder->destination.next_output_byte = reinterpret_cast<JOCTET*>(&encoder->buffer[0]);
+    encoder->destination.free_in_buffer = encoder->buffer.size();
+}
+
+boolean JpegEncoder::empty_output_buffer(j_compress_ptr compressor)
+{
+    //The whole buffer's full, so double it, and carry on after what's been written
+    auto *encoder = static_cast<JpegEncoder*>(compressor->client_data);
+    size_t used = encoder->buffer.size();
+    encoder->buffer.resize(used * 2);
+    encoder->destination.next_output_byte = reinterpret_cast<JOCTET*>(&encoder->buffer[used]);
+    encoder->destination.free_in_buffer = encoder->buffer.size() - used;
+    return TRUE;
+}
+
+void JpegEncoder::term_destination(j_compress_ptr compressor)
+{
+    auto *encoder = static_cast<JpegEncoder*>(compressor->client_data);
+    encoder->buffer_used = encoder->buffer.size() - encoder->destination.free_in_buffer;
+}
+
+void JpegEncoder::error_exit(j_common_ptr compressor)
+{
+    auto *encoder = static_cast<JpegEncoder*>(compressor->client_data);
+    compressor->err->format_message(compressor, encoder->error_message);
+    longjmp(encoder->error_jump, 1);
+}
@@ -3,15 +3,18 @@
 //
 
 #include <SFTPStream.h>
-#include <SFML/Graphics/Image.hpp>
-#include <SystemUtilities.h>
 #include <database/episode/EpisodeEntry.h>
 #include <iostream>
 #include <Log.h>
 #include <thread>
+#include <unordered_set>
+#include <map>
+#include <tuple>
+#include <iterator>
 #include "Library.h"
+#include "MediaProbe.h"
 
-Library::Library(std::shared_ptr<SFTPSession> sftp_,
+Library::Library(std::shared_ptr<SFTPSessionPool> sftp_,
                  std::string library_root_,
                  std::shared_ptr<SeasonRepository> season_table_,
                  std::shared_ptr<EpisodeRepository> episode_table_,
@@ -19,131 +22,864 @@ Library::Library(std::shared_ptr<SFTPSession> sftp_,
                  std::shared_ptr<MiscRepository> misc_table_)
 
 : library_root(std::move(library_root_)),
+  sync_running(false),
+  sync_cancelled(false),
+  sync_seasons_done(0),
+  sync_seasons_total(0),
   sftp(std::move(sftp_)),
   season_table(std::move(season_table_)),
   episode_table(std::move(episode_table_)),
   watch_history_table(std::move(watch_history_table_)),
   misc_table(std::move(misc_table_))
 {
-    sync();
+    auto thumbnail_threads = Config::get_instance().get<uint32_t>(CONFIG_LIBRARY_SYNC_THUMBNAIL_THREADS);
+    thumbnail_service = std::make_unique<ThumbnailService>(sftp, thumbnail_threads, [this](uint64_t season_id, std::string thumbnail) {
+        store_thumbnail(season_id, std::move(thumbnail));
+    });
 }
 
+Library::~Library()
+{
+    stop_sync();
+    stop_watching();
+
+    //Its workers store into the repositories, so it has to go before they do
+    thumbnail_service.reset();
+}
 
-void Library::sync()
+void Library::start_sync(bool full_rescan)
 {
-    frlog << Log::info << "Syncing library... " << Log::end;
-    auto start_sync = std::chrono::system_clock::now();
+    if(sync_running.exchange(true))
+        return;
 
-    //Get a list of files physically in the library
-    std::vector<Attributes> root_list = sftp->enumerate_directory(library_root);
+    //The last sync has finished, so this won't block
+    if(sync_thread.joinable())
+        sync_thread.join();
 
-    //Delete any database entries which are no longer on disk
-    season_table->for_each_season([&](std::shared_ptr<SeasonEntry> season) -> bool {
+    sync_cancelled = false;
+    sync_thread = std::thread([this, full_rescan]() {
+        try
+        {
+            sync(full_rescan);
+        }
+        catch(const std::exception &e)
+        {
+            frlog << Log::warn << "Library sync failed: " << e.what() << Log::end;
+        }
+        notify_sync_listener(SyncEvent::Finished);
+        sync_running = false;
+    });
+}
 
-        //Check if this season is actually on disk
-        auto season_iter = std::find_if(root_list.begin(), root_list.end(), [&](const Attributes &attr) {
-            return attr.full_name == season->get_filepath();
-        });
+void Library::stop_sync()
+{
+    sync_cancelled = true;
+    thumbnail_service->cancel_pending();
+    thumbnail_service->cancel_running();
+    if(sync_thread.joinable())
+        sync_thread.join();
+}
+
+void Library::start_watching()
+{
+    if(watcher)
+        return;
+
+    Config &config = Config::get_instance();
+    watcher = std::make_unique<RemoteWatcher>(config.get<std::string>(CONFIG_SFTP_IP), config.get<uint32_t>(CONFIG_SFTP_PORT), config.get<std::string>(CONFIG_SFTP_USERNAME),
+            library_root, [this](std::vector<RemoteWatcher::Event> events) {
+        apply_watch_events(events);
+    });
+}
+
+void Library::stop_watching()
+{
+    watcher = nullptr;
+}
+
+void Library::apply_watch_events(const std::vector<RemoteWatcher::Event> &events)
+{
+    //Work out which season each change was to. Only what happened to a season last matters:
+    //if its directory went then so does the season, otherwise it's synced again. Files are seen
+    //as soon as they're created, so one still being copied in is synced again once it's finished,
+    //which picks up its new size and modification time, and probes it again.
+    std::string root = library_root;
+    while(root.size() > 1 && root.back() == '/')
+        root.pop_back();
+    std::string prefix = root + "/";
+
+    std::vector<std::string> seasons; //In the order they were first changed
+    std::unordered_map<std::string, bool> season_deleted;
+    for(auto &event : events)
+    {
+        if(event.filepath.compare(0, prefix.size(), prefix) != 0)
+            continue;
+
+        //Files directly within the root aren't seasons, or part of one
+        std::string relative = event.filepath.substr(prefix.size());
+        auto slash = relative.find('/');
+        if(slash == std::string::npos && !event.is_directory)
+            continue;
+
+        std::string season = library_root + "/" + relative.substr(0, slash);
+        bool deleted = slash == std::string::npos && event.type == RemoteWatcher::Event::Deleted;
+        auto inserted = season_deleted.emplace(season, deleted);
+        if(inserted.second)
+            seasons.emplace_back(std::move(season));
+        else
+            inserted.first->second = deleted;
+    }
+
+    //A rename shows up as one season going and another appearing, so they're synced together
+    std::vector<std::string> to_sync;
+    std::vector<std::string> removed;
+    for(auto &season : seasons)
+    {
+        if(season_deleted[season])
+            removed.emplace_back(season);
+        else
+            to_sync.emplace_back(season);
+    }
+
+    frlog << Log::info << "Syncing " << to_sync.size() << " seasons which changed on the server, and " << removed.size() << " which were removed" << Log::end;
+    sync_seasons(to_sync, removed);
+}
 
-        //Erase from the database if it couldn't be found on disk
-        if(season_iter == root_list.end())
+void Library::set_sync_listener(sync_listener_t listener)
+{
+    std::lock_guard<std::mutex> guard(sync_listener_lock);
+    sync_listener = std::move(listener);
+}
+
+void Library::notify_sync_listener(SyncEvent::Type type, uint64_t season_id)
+{
+    std::lock_guard<std::mutex> guard(sync_listener_lock);
+    if(sync_listener)
+        sync_listener(SyncEvent{type, season_id, sync_seasons_done, sync_seasons_total});
+}
+
+
+void Library::sync(bool full_rescan)
+{
+    std::lock_guard<std::mutex> guard(sync_lock);
+    frlog << Log::info << "Syncing library" << (full_rescan ? " (full rescan)" : "") << "... " << Log::end;
+    auto start_sync = std::chrono::system_clock::now();
+
+    //Get a list of files physically in the library. If the server lets us run commands, then the root is listed
+    //in a single round trip. Full rescans list every season along with it, as they'll all be needed. Otherwise
+    //only the root is listed, and just the seasons whose modification time has changed are listed later on.
+    std::unordered_map<std::string, std::vector<Attributes>> tree; //Directory -> its entries
+    bool listed_tree = false;
+    if(Config::get_instance().get<bool>(CONFIG_LIBRARY_EXEC_LISTING))
+    {
+        try
         {
-            frlog << Log::info << "Deleting removed season: " << season->get_name() << Log::end;
-            delete_season(season->get_id());
+            auto start_listing = std::chrono::steady_clock::now();
+            auto entries = sftp->checkout().get_connection().enumerate_tree(library_root, full_rescan ? 2 : 1);
+
+            //Every season would be deleted if an empty listing were wrong, so don't trust one unless SFTP agrees
+            bool has_seasons = false;
+            season_table->for_each_season([&](std::shared_ptr<SeasonEntry>) {
+                has_seasons = true;
+                return false;
+            });
+            if(entries.empty() && has_seasons)
+                throw std::runtime_error("Listing was empty, but the library has seasons");
+
+            tree[library_root];
+            for(auto &entry : entries)
+            {
+                std::string parent = entry.full_name.substr(0, entry.full_name.size() - entry.name.size() - 1);
+                tree[parent].emplace_back(std::move(entry));
+            }
+            listed_tree = true;
+            frlog << Log::info << "Listed " << entries.size() << " library entries in " << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_listing).count() << "ms" << Log::end;
+        }
+        catch(const std::exception &e)
+        {
+            frlog << Log::info << "Couldn't list library with a remote command, falling back to SFTP: " << e.what() << Log::end;
+            tree.clear();
         }
+    }
+    std::vector<Attributes> root_list = listed_tree ? std::move(tree[library_root]) : sftp->checkout()->enumerate_directory(library_root);
+    auto *season_listings = listed_tree && full_rescan ? &tree : nullptr;
+
+    std::unordered_set<std::string> on_disk;
+    for(auto &attributes : root_list)
+        on_disk.emplace(attributes.full_name);
+
+    //Index what's in the database. Everything's diffed against the index from here on,
+    //so the database is only touched to change it.
+    SyncIndex index;
+    std::vector<uint64_t> vanished; //Seasons in the database, but no longer on disk
+    std::unordered_map<std::string, time_t> synced_mod_dates;
+    season_table->for_each_season([&](std::shared_ptr<SeasonEntry> season) -> bool {
+        index.season_ids.emplace(season->get_filepath(), season->get_id());
+        synced_mod_dates.emplace(season->get_filepath(), season->get_mod_date());
+        if(on_disk.find(season->get_filepath()) == on_disk.end())
+            vanished.emplace_back(season->get_id());
         return true;
     });
+    index_episodes(index);
 
-    //Now ensure that each season on disk has a related database entry
+    //Sync every season whose directory has changed since it was last synced.
+    //Adding, removing or renaming an episode updates its directory's modification time.
+    std::vector<Attributes> to_sync;
+    std::vector<Attributes> appeared;
     for(auto &season : root_list)
     {
-        //Check if the season is in the database, or not a directory
-        uint64_t season_id = season_table->get_season_id_from_filepath(season.full_name);
-        if(season_id != NO_SUCH_ENTRY || season.type != Attributes::Directory)
-            continue;
-
-        //It's not, so generate an entry and store it.
-        std::string thumbnail = generate_season_thumbnail(season.full_name);
-        if(thumbnail.empty())
+        if(season.type != Attributes::Directory)
             continue;
+        if(index.season_ids.find(season.full_name) == index.season_ids.end())
+            appeared.emplace_back(season);
 
-        frlog << Log::info << "Found new season: " << season.name << Log::end;
-        season_table->create(0, season.full_name, season.name, std::move(thumbnail), season.mod_date);
+        auto synced = synced_mod_dates.find(season.full_name);
+        if(full_rescan || synced == synced_mod_dates.end() || synced->second != season.mod_date)
+            to_sync.emplace_back(std::move(season));
     }
 
-    //Now ensure that each episode in each season has a related database entry
+    //Seasons which have gone may have just been renamed, otherwise they're deleted
+    match_renamed_seasons(index, vanished, appeared, season_listings);
+    delete_vanished_seasons(vanished);
+
+    size_t synced_count = run_sync_pipeline(index, to_sync, season_listings);
+
+    auto time_taken = std::chrono::system_clock::now() - start_sync;
+    frlog << Log::info << (sync_cancelled ? "Cancelled" : "Finished") << " library sync (" << std::chrono::duration_cast<std::chrono::milliseconds>(time_taken).count() << "ms, "
+          << synced_count << "/" << to_sync.size() << " seasons synced, " << root_list.size() - to_sync.size() << " unchanged)" << Log::end;
+}
+
+void Library::sync_seasons(const std::vector<std::string> &season_filepaths, const std::vector<std::string> &removed_filepaths)
+{
+    std::lock_guard<std::mutex> guard(sync_lock);
+    SyncIndex index;
     season_table->for_each_season([&](std::shared_ptr<SeasonEntry> season) -> bool {
+        index.season_ids.emplace(season->get_filepath(), season->get_id());
+        return true;
+    });
+    index_episodes(index);
+
+    std::vector<uint64_t> vanished;
+    for(auto &filepath : removed_filepaths)
+    {
+        auto season_iter = index.season_ids.find(filepath);
+        if(season_iter != index.season_ids.end())
+            vanished.emplace_back(season_iter->second);
+    }
+
+    std::vector<Attributes> to_sync;
+    std::vector<Attributes> appeared;
+    for(auto &filepath : season_filepaths)
+    {
+        try
+        {
+            Attributes season = sftp->checkout()->stat(filepath);
+            if(season.type != Attributes::Directory)
+                continue;
+            season.name = filepath.substr(filepath.find_last_of('/') + 1);
+            if(index.season_ids.find(filepath) == index.season_ids.end())
+                appeared.emplace_back(season);
+            to_sync.emplace_back(std::move(season));
+        }
+        catch(const std::exception &e)
+        {
+            frlog << Log::warn << "Failed to stat season " << filepath << ": " << e.what() << Log::end;
+        }
+    }
+
+    match_renamed_seasons(index, vanished, appeared, nullptr);
+    delete_vanished_seasons(vanished);
+    run_sync_pipeline(index, to_sync, nullptr);
+    notify_sync_listener(SyncEvent::Finished);
+}
+
+void Library::index_episodes(SyncIndex &index)
+{
+    episode_table->for_each_episode_file([&](uint64_t episode_id, uint64_t season_id, const std::string &filepath, uint64_t size, time_t date_added, uint64_t fingerprint) -> bool {
+        index.episodes[season_id].emplace(filepath, IndexedEpisode{episode_id, size, date_added, fingerprint});
+        return true;
+    });
+}
+
+void Library::match_renamed_seasons(SyncIndex &index, std::vector<uint64_t> &vanished, const std::vector<Attributes> &appeared, std::unordered_map<std::string, std::vector<Attributes>> *tree)
+{
+    if(vanished.empty() || appeared.empty())
+        return;
+
+    //List the seasons which have appeared, if they haven't been already
+    std::vector<std::vector<Attributes>> listings(appeared.size());
+    if(tree)
+    {
+        for(size_t a = 0; a < appeared.size(); ++a)
+            listings[a] = (*tree)[appeared[a].full_name];
+    }
+    else
+    {
+        std::vector<std::string> filepaths;
+        for(auto &season : appeared)
+            filepaths.emplace_back(season.full_name);
+        auto listed = sftp->checkout()->enumerate_many(filepaths);
+        for(size_t a = 0; a < appeared.size(); ++a)
+        {
+            if(listed[a])
+                listings[a] = std::move(*listed[a]);
+        }
+    }
 
-        //Enumerate the season's directory
-        std::vector<Attributes> episode_list = sftp->enumerate_directory(season->get_filepath());
-        for(auto &episode : episode_list)
+    for(size_t a = 0; a < appeared.size() && !vanished.empty(); ++a)
+    {
+        std::map<std::pair<uint64_t, time_t>, const Attributes*> files; //Size and modification time -> file
+        for(auto &file : listings[a])
         {
-            //Skip anything that isn't an episode (regular video file)
-            if(episode.type != Attributes::Regular)
+            if(file.type == Attributes::Regular)
+                files.emplace(std::make_pair(static_cast<uint64_t>(file.size), file.mod_date), &file);
+        }
+
+        //A vanished season is a candidate if at least half of its episodes look to be here
+        for(auto vanished_iter = vanished.begin(); vanished_iter != vanished.end(); ++vanished_iter)
+        {
+            auto episodes_iter = index.episodes.find(*vanished_iter);
+            if(episodes_iter == index.episodes.end())
+                continue;
+
+            size_t matches = 0;
+            const IndexedEpisode *sample_episode = nullptr;
+            const Attributes *sample_file = nullptr;
+            for(auto &episode : episodes_iter->second)
+            {
+                auto file = files.find(std::make_pair(episode.second.size, episode.second.mod_date));
+                if(episode.second.size == 0 || file == files.end())
+                    continue;
+                ++matches;
+                if(!sample_file && episode.second.fingerprint != 0)
+                {
+                    sample_episode = &episode.second;
+                    sample_file = file->second;
+                }
+            }
+            if(!sample_file || matches * 2 < episodes_iter->second.size())
                 continue;
 
-            //Skip it if it's already in the database
-            uint64_t episode_id = episode_table->get_episode_id_from_filepath(episode.full_name);
-            if(episode_id != NO_SUCH_ENTRY)
+            //Make sure by checking the content of one of them
+            auto fingerprint = sftp->checkout()->fingerprint_many({*sample_file});
+            if(!fingerprint[0] || *fingerprint[0] != sample_episode->fingerprint)
                 continue;
 
-            //Create the entry
-            frlog << Log::info << "Found new episode for " << season->get_name() << ": " << episode.name << Log::end;
-            episode_table->create(0, season->get_id(), episode.full_name, episode.name, false, 0, AUDIO_TRACK_UNSET, SUB_TRACK_UNSET, episode.mod_date);
+            //Move the season in place. Its episodes are then moved as it's synced.
+            auto season = season_table->load(*vanished_iter);
+            frlog << Log::info << "Season " << season->get_name() << " was renamed to " << appeared[a].name << Log::end;
+            index.season_ids.erase(season->get_filepath());
+            index.season_ids[appeared[a].full_name] = season->get_id();
+            season->set_filepath(appeared[a].full_name);
+            season->set_name(appeared[a].name);
+            notify_sync_listener(SyncEvent::SeasonUpdated, season->get_id());
+            vanished.erase(vanished_iter);
+            break;
         }
+    }
+    season_table->flush();
+}
 
+void Library::delete_vanished_seasons(const std::vector<uint64_t> &vanished)
+{
+    season_table->batch([&]() {
+        for(auto season_id : vanished)
+        {
+            frlog << Log::info << "Deleting removed season: " << season_table->load(season_id)->get_name() << Log::end;
+            delete_season(season_id);
+            notify_sync_listener(SyncEvent::SeasonRemoved, season_id);
+        }
+    });
+}
+
+size_t Library::run_sync_pipeline(const SyncIndex &index, std::vector<Attributes> &seasons, std::unordered_map<std::string, std::vector<Attributes>> *tree)
+{
+    //Start each stage of the pipeline
+    Config &config = Config::get_instance();
+    auto list_threads = std::max<uint32_t>(config.get<uint32_t>(CONFIG_LIBRARY_SYNC_LIST_THREADS), 1);
+    auto probe_threads = std::max<uint32_t>(config.get<uint32_t>(CONFIG_LIBRARY_SYNC_PROBE_THREADS), 1);
+    BoundedQueue<Attributes> to_list(LIBRARY_SYNC_QUEUE_SIZE);
+    BoundedQueue<SeasonListing> listed(LIBRARY_SYNC_QUEUE_SIZE);
+    BoundedQueue<SeasonChanges> changes(LIBRARY_SYNC_QUEUE_SIZE);
+    BoundedQueue<ProbeJob> probe_jobs(LIBRARY_SYNC_QUEUE_SIZE);
+
+    std::vector<std::thread> listers;
+    for(uint32_t a = 0; a < list_threads; ++a)
+        listers.emplace_back(&Library::sync_list_stage, this, std::ref(to_list), std::ref(listed));
+    std::thread differ(&Library::sync_diff_stage, this, std::cref(index), std::ref(listed), std::ref(changes));
+    std::thread writer(&Library::sync_write_stage, this, std::ref(changes), std::ref(probe_jobs));
+    std::vector<std::thread> probers;
+    for(uint32_t a = 0; a < probe_threads; ++a)
+        probers.emplace_back(&Library::sync_probe_stage, this, std::ref(probe_jobs));
+
+    //Feed in the seasons. Those already listed skip straight to being diffed.
+    sync_seasons_done = 0;
+    sync_seasons_total = seasons.size();
+    notify_sync_listener(SyncEvent::Progress);
+    for(auto &season : seasons)
+    {
+        if(sync_cancelled)
+            break;
+
+        if(tree)
+        {
+            auto entries = std::move((*tree)[season.full_name]);
+            listed.push(SeasonListing{std::move(season), std::move(entries)});
+        }
+        else
+        {
+            to_list.push(std::move(season));
+        }
+    }
+    to_list.close();
+
+    //Episodes from before probing existed, or whose probe failed, are probed alongside.
+    //They're collected first, as the probes need the database to store what they find.
+    std::vector<ProbeJob> unprobed;
+    episode_table->for_each_unprobed_episode([&](uint64_t episode_id, const std::string &filepath) -> bool {
+        unprobed.emplace_back(ProbeJob{episode_id, filepath});
         return true;
     });
+    for(auto &job : unprobed)
+    {
+        if(sync_cancelled)
+            break;
+        probe_jobs.push(std::move(job));
+    }
 
-    auto time_taken = std::chrono::system_clock::now() - start_sync;
-    frlog << Log::info << "Finished library sync (" << std::chrono::duration_cast<std::chrono::milliseconds>(time_taken).count() << "ms)" << Log::end;
+    //Then wait for each stage to finish in turn, closing the input of the next as they do
+    for(auto &thread : listers)
+        thread.join();
+    listed.close();
+    differ.join();
+    changes.close();
+    writer.join();
+    if(sync_cancelled)
+        thumbnail_service->cancel_pending(); //Any the write stage queued before it saw the cancellation
+    else
+        thumbnail_service->wait_idle();
+    probe_jobs.close();
+    for(auto &thread : probers)
+        thread.join();
+    season_table->flush();
+    return sync_seasons_done;
 }
 
-std::string Library::generate_season_thumbnail(const std::string &remote_filepath)
+void Library::sync_list_stage(BoundedQueue<Attributes> &input, BoundedQueue<SeasonListing> &output)
 {
-    //If not, try and generate a thumbnail
-    Attributes attributes = sftp->stat(remote_filepath);
-    std::string cover_source;
-    if(attributes.type == Attributes::Directory)
+    std::vector<Attributes> batch;
+    while(input.pop_many(batch, LIBRARY_SYNC_LIST_BATCH))
     {
-        //It's a directory, so find a media file which we can base a cover image on
-        auto media_list = sftp->enumerate_directory(attributes.full_name);
-        std::random_shuffle(media_list.begin(), media_list.end());
-        auto iter = std::find_if(media_list.begin(), media_list.end(), [](const Attributes &attr) {
-            return attr.type == Attributes::Regular && (attr.name.find(".mkv") != std::string::npos || attr.name.find(".mp4") != std::string::npos);
-        });
-        if(media_list.empty() || iter == media_list.end())
-            return "";
-        cover_source = iter->full_name;
+        if(sync_cancelled)
+            continue;
+
+        std::vector<std::string> filepaths;
+        for(auto &season : batch)
+            filepaths.emplace_back(season.full_name);
+
+        std::vector<std::optional<std::vector<Attributes>>> listings;
+        try
+        {
+            listings = sftp->checkout()->enumerate_many(filepaths);
+        }
+        catch(const std::exception &e)
+        {
+            frlog << Log::warn << "Failed to list " << batch.size() << " seasons: " << e.what() << Log::end;
+            continue;
+        }
+
+        for(size_t a = 0; a < batch.size(); ++a)
+        {
+            if(!listings[a])
+            {
+                frlog << Log::warn << "Failed to list season: " << batch[a].name << Log::end;
+                continue;
+            }
+            output.push(SeasonListing{std::move(batch[a]), std::move(*listings[a])});
+        }
     }
+}
 
-    if(cover_source.empty())
-        return "";
+void Library::sync_diff_stage(const SyncIndex &index, BoundedQueue<SeasonListing> &input, BoundedQueue<SeasonChanges> &output)
+{
+    SeasonListing listing;
+    while(input.pop(listing))
+    {
+        if(sync_cancelled)
+            continue;
+
+        try
+        {
+            SeasonChanges change{listing.season, NO_SUCH_ENTRY, listing.entries.size(), {}, {}, {}, {}};
+            auto season_iter = index.season_ids.find(change.season.full_name);
+            if(season_iter != index.season_ids.end())
+                change.season_id = season_iter->second;
+
+            static const std::unordered_map<std::string, IndexedEpisode> no_episodes;
+            auto episodes_iter = index.episodes.find(change.season_id);
+            const auto &known_episodes = episodes_iter != index.episodes.end() ? episodes_iter->second : no_episodes;
+
+            //Find episodes which are in the database, but no longer on disk
+            std::unordered_set<std::string> on_disk;
+            for(auto &entry : listing.entries)
+                on_disk.emplace(entry.full_name);
+            std::vector<const IndexedEpisode*> missing;
+            for(auto &episode : known_episodes)
+            {
+                if(on_disk.find(episode.first) == on_disk.end())
+                    missing.emplace_back(&episode.second);
+            }
+
+            //Find episodes (regular files) which aren't in the database, or which have changed on disk.
+            //Both need fingerprinting: the new ones might just have been moved, and the changed ones are stale.
+            std::vector<Attributes> to_fingerprint;
+            std::vector<uint64_t> fingerprinted_ids; //Of each file to fingerprint, NO_SUCH_ENTRY if it's new
+            for(auto &episode : listing.entries)
+            {
+                if(episode.type != Attributes::Regular)
+                    continue;
+
+                auto known = known_episodes.find(episode.full_name);
+                if(known == known_episodes.end())
+                {
+                    fingerprinted_ids.emplace_back(NO_SUCH_ENTRY);
+                }
+                else
+                {
+                    if(known->second.size == episode.size && known->second.mod_date == episode.mod_date && known->second.fingerprint != 0)
+                        continue;
+                    fingerprinted_ids.emplace_back(known->second.id);
+                }
+                to_fingerprint.emplace_back(std::move(episode));
+            }
+
+            std::vector<std::optional<uint64_t>> fingerprints;
+            if(!to_fingerprint.empty())
+                fingerprints = sftp->checkout()->fingerprint_many(to_fingerprint);
+
+            //Files which have the same size, modification time and content as a missing episode are that episode, moved
+            std::multimap<std::tuple<uint64_t, time_t, uint64_t>, uint64_t> moved_from;
+            for(auto *episode : missing)
+            {
+                if(episode->fingerprint != 0)
+                    moved_from.emplace(std::make_tuple(episode->size, episode->mod_date, episode->fingerprint), episode->id);
+            }
+
+            std::unordered_set<uint64_t> moved_ids;
+            for(size_t a = 0; a < to_fingerprint.size(); ++a)
+            {
+                uint64_t fingerprint = fingerprints[a] ? *fingerprints[a] : 0;
+                if(fingerprinted_ids[a] != NO_SUCH_ENTRY)
+                {
+                    change.updated_episodes.emplace_back(EpisodeUpdate{fingerprinted_ids[a], std::move(to_fingerprint[a]), fingerprint});
+                    continue;
+                }
+
+                auto moved = fingerprint != 0 ? moved_from.find(std::make_tuple(static_cast<uint64_t>(to_fingerprint[a].size), to_fingerprint[a].mod_date, fingerprint)) : moved_from.end();
+                if(moved != moved_from.end())
+                {
+                    moved_ids.emplace(moved->second);
+                    change.updated_episodes.emplace_back(EpisodeUpdate{moved->second, std::move(to_fingerprint[a]), fingerprint});
+                    moved_from.erase(moved);
+                    continue;
+                }
+
+                change.new_episodes.emplace_back(std::move(to_fingerprint[a]));
+                change.new_fingerprints.emplace_back(fingerprint);
+            }
 
-    //Generate a thumbnail.
-    auto file = std::make_unique<SFTPFile>(sftp->open(cover_source));
-    SFTPStream video_stream(std::move(file));
-    sf::Image thumbnail = thumbnailer.generate_thumbnail(video_stream, THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT);
-    thumbnail.saveToFile("tmp_thumbnail.jpg");
-    return SystemUtilities::read_binary_file("tmp_thumbnail.jpg");
+            for(auto *episode : missing)
+            {
+                if(moved_ids.find(episode->id) == moved_ids.end())
+                    change.removed_episodes.emplace_back(episode->id);
+            }
+
+            //New seasons without any video in them aren't seasons at all. Otherwise, even if nothing
+            //was added or removed, the season's sync state needs updating so it's skipped next time.
+            if(change.season_id != NO_SUCH_ENTRY || std::any_of(change.new_episodes.begin(), change.new_episodes.end(), [](const Attributes &attributes) {return attributes.is_video();}))
+                output.push(std::move(change));
+        }
+        catch(const std::exception &e)
+        {
+            frlog << Log::warn << "Failed to diff season " << listing.season.name << ": " << e.what() << Log::end;
+        }
+
+        ++sync_seasons_done;
+        notify_sync_listener(SyncEvent::Progress);
+    }
 }
 
-void Library::delete_season(uint64_t season_id)
+void Library::sync_write_stage(BoundedQueue<SeasonChanges> &input, BoundedQueue<ProbeJob> &probes)
 {
-    //Iterate through each episode of the season and delete those
-    episode_table->for_each_episode_in_season(season_id, [&](const std::shared_ptr<EpisodeEntry> &episode) -> bool {
-        delete_episode(episode->get_id());
+    std::vector<SeasonChanges> batch;
+    while(input.pop_many(batch, LIBRARY_SYNC_WRITE_BATCH))
+    {
+        //Each batch is written in a single transaction. Nothing's announced or passed on until it's
+        //committed, as the next stage needs the database, and so would wait on the transaction.
+        std::vector<ThumbnailService::Job> thumbnail_jobs;
+        std::vector<ProbeJob> probe_jobs;
+        std::vector<std::pair<SyncEvent::Type, uint64_t>> events;
+        try
+        {
+            episode_table->batch([&]() {
+                for(auto &change : batch)
+                {
+                    if(sync_cancelled)
+                        break;
+
+                    //Each season is a batch of its own within the outer one, so if it fails only its own
+                    //changes are rolled back. Its jobs are only passed on once its changes have gone in.
+                    bool new_season = change.season_id == NO_SUCH_ENTRY;
+                    std::vector<ProbeJob> season_probe_jobs;
+                    try
+                    {
+                        episode_table->batch([&]() {
+                            if(new_season)
+                            {
+                                frlog << Log::info << "Found new season: " << change.season.name << Log::end;
+                                change.season_id = season_table->create(0, change.season.full_name, change.season.name, change.season.mod_date, change.season.mod_date, change.entry_count);
+                            }
+
+                            for(auto episode_id : change.removed_episodes)
+                            {
+                                frlog << Log::info << "Deleting removed episode " << episode_id << " from " << change.season.name << Log::end;
+                                delete_episode(episode_id);
+                            }
+
+                            for(size_t a = 0; a < change.new_episodes.size(); ++a)
+                            {
+                                auto &episode = change.new_episodes[a];
+                                frlog << Log::info << "Found new episode for " << change.season.name << ": " << episode.name << Log::end;
+                                uint64_t episode_id = episode_table->create(0, change.season_id, episode.full_name, episode.name, false, 0, AUDIO_TRACK_UNSET, SUB_TRACK_UNSET, episode.mod_date, episode.size, change.new_fingerprints[a],
+                                                                            0, 0, 0, std::string(), std::string(), 0, 0, false);
+                                season_probe_jobs.emplace_back(ProbeJob{episode_id, episode.full_name});
+                            }
+
+                            //Moved episodes keep everything else, including their watch history
+                            for(auto &update : change.updated_episodes)
+                            {
+                                auto episode = episode_table->load(update.episode_id);
+                                if(episode->get_filepath() != update.file.full_name)
+                                    frlog << Log::info << "Episode " << episode->get_name() << " was moved to " << update.file.full_name << Log::end;
+                                if(episode->get_size() != static_cast<uint64_t>(update.file.size) || episode->get_date_added() != update.file.mod_date)
+                                {
+                                    //Its content has changed, so what's known about it may not be true anymore
+                                    episode->set_media_probed(false);
+                                    season_probe_jobs.emplace_back(ProbeJob{episode->get_id(), update.file.full_name});
+                                }
+                                episode->set_filepath(update.file.full_name);
+                                episode->set_name(update.file.name);
+                                episode->set_size(update.file.size);
+                                episode->set_date_added(update.file.mod_date);
+                                episode->set_fingerprint(update.fingerprint);
+                            }
+
+                            //Only now is the season up to date, so record that it's been synced
+                            if(!new_season)
+                            {
+                                auto season = season_table->load(change.season_id);
+                                season->set_mod_date(change.season.mod_date);
+                                season->set_entry_count(change.entry_count);
+                            }
+
+                            //Flushed within the season's own batch, so that nothing it changed is left to be written with the next
+                            season_table->flush();
+                            episode_table->flush();
+                        });
+                    }
+                    catch(const std::exception &e)
+                    {
+                        frlog << Log::warn << "Failed to store changes to season " << change.season.name << ": " << e.what() << Log::end;
+                        continue;
+                    }
+
+                    std::move(season_probe_jobs.begin(), season_probe_jobs.end(), std::back_inserter(probe_jobs));
+                    if(new_season)
+                    {
+                        events.emplace_back(SyncEvent::SeasonAdded, change.season_id);
+                        thumbnail_jobs.emplace_back(ThumbnailService::Job{change.season_id, std::move(change.season.name), std::move(change.season.full_name), std::move(change.new_episodes)});
+                    }
+                    else if(!change.removed_episodes.empty() || !change.new_episodes.empty() || !change.updated_episodes.empty())
+                    {
+                        events.emplace_back(SyncEvent::SeasonUpdated, change.season_id);
+                    }
+                }
+            });
+        }
+        catch(const std::exception &e)
+        {
+            frlog << Log::warn << "Failed to store changes to " << batch.size() << " seasons: " << e.what() << Log::end;
+            continue;
+        }
+
+        for(auto &event : events)
+            notify_sync_listener(event.first, event.second);
+        if(!sync_cancelled)
+            for(auto &job : thumbnail_jobs)
+                thumbnail_service->submit(std::move(job));
+        for(auto &job : probe_jobs)
+            probes.push(std::move(job));
+    }
+}
+
+void Library::sync_probe_stage(BoundedQueue<ProbeJob> &input)
+{
+    ProbeJob job;
+    while(input.pop(job))
+    {
+        if(sync_cancelled)
+            continue;
+
+        try
+        {
+            //It may have been queued twice, by the write stage and as one that's not been probed yet
+            auto episode = episode_table->load(job.episode_id);
+            if(episode->get_media_probed())
+                continue;
+
+            MediaInfo info{};
+            if(Attributes::is_video_filename(job.filepath))
+            {
+                auto session = sftp->checkout();
+                SFTPFile file = session->open(job.filepath);
+                file.enable_async();
+                MediaProbe probe(file.size(), [&](uint64_t offset, size_t length) -> std::string {
+                    //Each range is fetched with its requests all in flight at once, and nothing past it
+                    std::string data(length, '\0');
+                    file.set_read_ahead_limit(offset + length);
+                    if(!file.seekg(offset))
+                        throw std::runtime_error("Failed to seek to offset " + std::to_string(offset));
+
+                    size_t filled = 0;
+                    while(filled < length)
+                    {
+                        ssize_t bytes = file.read(&data[filled], length - filled);
+                        if(bytes < 0)
+                            throw std::runtime_error("Failed to read at offset " + std::to_string(offset + filled));
+                        if(bytes == 0)
+                            break;
+                        filled += static_cast<size_t>(bytes);
+                    }
+                    data.resize(filled);
+                    return data;
+                });
+
+                //Files which can't be parsed are left at unknown, rather than tried again every sync.
+                //Anything else, such as the connection failing, is tried again next time.
+                try
+                {
+                    info = probe.probe();
+                }
+                catch(const MediaProbe::UnsupportedError &e)
+                {
+                    frlog << Log::warn << "Failed to parse media of " << job.filepath << ": " << e.what() << Log::end;
+                }
+            }
+
+            episode->set_duration(info.duration);
+            episode->set_width(info.width);
+            episode->set_height(info.height);
+            episode->set_video_codec(std::move(info.video_codec));
+            episode->set_audio_codec(std::move(info.audio_codec));
+            episode->set_audio_channels(info.audio_channels);
+            episode->set_bitrate(info.bitrate);
+            episode->set_media_probed(true);
+            episode_table->flush();
+        }
+        catch(const std::exception &e)
+        {
+            frlog << Log::warn << "Failed to probe media of " << job.filepath << ": " << e.what() << Log::end;
+        }
+    }
+}
+
+void Library::store_thumbnail(uint64_t season_id, std::string thumbnail)
+{
+    if(thumbnail.empty())
+        return;
+    season_table->store_thumbnail(season_id, thumbnail);
+    notify_sync_listener(SyncEvent::SeasonUpdated, season_id);
+}
+
+void Library::generate_thumbnails(bool replace_existing)
+{
+    std::lock_guard<std::mutex> guard(sync_lock);
+    std::vector<std::pair<uint64_t, Attributes>> seasons;
+    auto with_thumbnails = season_table->get_seasons_with_thumbnails();
+    season_table->for_each_season([&](std::shared_ptr<SeasonEntry> season) -> bool {
+        if(replace_existing || with_thumbnails.find(season->get_id()) == with_thumbnails.end())
+        {
+            Attributes directory{};
+            directory.name = season->get_name();
+            directory.full_name = season->get_filepath();
+            seasons.emplace_back(season->get_id(), std::move(directory));
+        }
         return true;
     });
+    frlog << Log::info << "Generating thumbnails for " << seasons.size() << " seasons" << Log::end;
+    uint64_t bytes_received = thumbnail_service->get_bytes_received();
+
+    //Seasons are listed in batches on this thread, whilst the thumbnails are generated in parallel
+    for(size_t start = 0; start < seasons.size() && !sync_cancelled; start += LIBRARY_SYNC_LIST_BATCH)
+    {
+        size_t end = std::min<size_t>(start + LIBRARY_SYNC_LIST_BATCH, seasons.size());
+        try
+        {
+            std::vector<std::string> filepaths;
+            for(size_t a = start; a < end; ++a)
+                filepaths.emplace_back(seasons[a].second.full_name);
+            auto listings = sftp->checkout()->enumerate_many(filepaths);
+
+            for(size_t a = start; a < end; ++a)
+            {
+                if(!listings[a - start])
+                {
+                    frlog << Log::warn << "Failed to list season: " << seasons[a].second.name << Log::end;
+                    continue;
+                }
+                thumbnail_service->submit(ThumbnailService::Job{seasons[a].first, std::move(seasons[a].second.name), std::move(seasons[a].second.full_name), std::move(*listings[a - start])});
+            }
+        }
+        catch(const std::exception &e)
+        {
+            frlog << Log::warn << "Failed to list " << end - start << " seasons: " << e.what() << Log::end;
+        }
+    }
 
-    //Now the season itself
-    season_table->erase(season_id);
+    if(sync_cancelled)
+        thumbnail_service->cancel_pending();
+    else
+        thumbnail_service->wait_idle();
+    bytes_received = thumbnail_service->get_bytes_received() - bytes_received;
+    frlog << Log::info << "Received " << bytes_received << " bytes generating thumbnails, " << (seasons.empty() ? 0 : bytes_received / seasons.size()) << " per season" << Log::end;
+}
+
+void Library::regenerate_season_thumbnail(uint64_t season_id)
+{
+    auto season = season_table->load(season_id);
+    thumbnail_service->submit(ThumbnailService::Job{season_id, season->get_name(), season->get_filepath(), {}});
+}
+
+void Library::delete_season(uint64_t season_id)
+{
+    season_table->batch([&]() {
+        //Iterate through each episode of the season and delete those
+        episode_table->for_each_episode_in_season(season_id, [&](const std::shared_ptr<EpisodeEntry> &episode) -> bool {
+            delete_episode(episode->get_id());
+            return true;
+        });
+
+        //Now the season itself
+        season_table->erase(season_id);
+    });
 }
 
 void Library::delete_episode(uint64_t episode_id)
 {
-    watch_history_table->erase_for_episode(episode_id);
-    episode_table->erase(episode_id);
+    episode_table->batch([&]() {
+        watch_history_table->erase_for_episode(episode_id);
+        episode_table->erase(episode_id);
+    });
 }
 
 
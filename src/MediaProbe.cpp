@@ -0,0 +1,733 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+#include "MediaProbe.h"
+
+//Matroska element IDs, see https://www.matroska.org/technical/elements.html
+#define MKV_EBML 0x1A45DFA3
+#define MKV_SEGMENT 0x18538067
+#define MKV_SEEK_HEAD 0x114D9B74
+#define MKV_SEEK 0x4DBB
+#define MKV_SEEK_ID 0x53AB
+#define MKV_SEEK_POSITION 0x53AC
+#define MKV_INFO 0x1549A966
+#define MKV_TIMECODE_SCALE 0x2AD7B1
+#define MKV_DURATION 0x4489
+#define MKV_TRACKS 0x1654AE6B
+#define MKV_TRACK_ENTRY 0xAE
+#define MKV_TRACK_NUMBER 0xD7
+#define MKV_TRACK_TYPE 0x83
+#define MKV_CODEC_ID 0x86
+#define MKV_VIDEO 0xE0
+#define MKV_PIXEL_WIDTH 0xB0
+#define MKV_PIXEL_HEIGHT 0xBA
+#define MKV_AUDIO 0xE1
+#define MKV_CHANNELS 0x9F
+#define MKV_CLUSTER 0x1F43B675
+#define MKV_CUES 0x1C53BB6B
+#define MKV_CUE_POINT 0xBB
+#define MKV_CUE_TIME 0xB3
+#define MKV_CUE_TRACK_POSITIONS 0xB7
+#define MKV_CUE_TRACK 0xF7
+#define MKV_CUE_CLUSTER_POSITION 0xF1
+#define MKV_CUE_RELATIVE_POSITION 0xF0
+#define MKV_ATTACHMENTS 0x1941A469
+#define MKV_TRACK_TYPE_VIDEO 1
+#define MKV_TRACK_TYPE_AUDIO 2
+
+static const uint64_t unknown_size = std::numeric_limits<uint64_t>::max();
+
+static uint64_t read_big_endian(const std::string &data, size_t position, size_t length)
+{
+    if(data.size() < position + length)
+        throw MediaProbe::UnsupportedError("Container field is truncated");
+
+    uint64_t value = 0;
+    for(size_t a = 0; a < length; ++a)
+        value = (value << 8u) | static_cast<uint8_t>(data[position + a]);
+    return value;
+}
+
+static std::string matroska_codec_name(const std::string &codec_id)
+{
+    static const std::unordered_map<std::string, std::string> names = {
+            {"V_MPEG4/ISO/AVC", "h264"}, {"V_MPEGH/ISO/HEVC", "hevc"}, {"V_VP8", "vp8"}, {"V_VP9", "vp9"}, {"V_AV1", "av1"},
+            {"A_AAC", "aac"}, {"A_AC3", "ac3"}, {"A_EAC3", "eac3"}, {"A_DTS", "dts"}, {"A_OPUS", "opus"},
+            {"A_VORBIS", "vorbis"}, {"A_FLAC", "flac"}, {"A_MPEG/L3", "mp3"}, {"A_TRUEHD", "truehd"}};
+
+    //AAC may have a profile suffix, such as A_AAC/MPEG4/LC
+    auto name = names.find(codec_id.compare(0, 5, "A_AAC") == 0 ? "A_AAC" : codec_id);
+    if(name != names.end())
+        return name->second;
+    return codec_id.size() > 2 ? codec_id.substr(2) : codec_id;
+}
+
+static std::string mp4_codec_name(const std::string &format)
+{
+    static const std::unordered_map<std::string, std::string> names = {
+            {"avc1", "h264"}, {"avc3", "h264"}, {"hvc1", "hevc"}, {"hev1", "hevc"}, {"vp09", "vp9"}, {"av01", "av1"},
+            {"mp4a", "aac"}, {"ac-3", "ac3"}, {"ec-3", "eac3"}, {"Opus", "opus"}, {"fLaC", "flac"}};
+
+    auto name = names.find(format);
+    return name != names.end() ? name->second : format;
+}
+
+MediaProbe::MediaProbe(uint64_t size_, read_t read_)
+: size(size_),
+  read(std::move(read_)),
+  buffer_offset(0),
+  total_read(0),
+  timecode_scale(1000000),
+  video_track(0)
+{
+
+}
+
+MediaInfo MediaProbe::probe()
+{
+    std::string magic = read_range(0, 8);
+    MediaInfo info = read_big_endian(magic, 0, 4) == MKV_EBML ? probe_matroska() : probe_mp4();
+    if(info.duration != 0)
+        info.bitrate = size * 8 * 1000 / info.duration;
+    return info;
+}
+
+KeyframeLocation MediaProbe::locate_keyframe(double position)
+{
+    std::string magic = read_range(0, 8);
+    KeyframeLocation location = read_big_endian(magic, 0, 4) == MKV_EBML ? locate_matroska_keyframe(position) : locate_mp4_keyframe(position);
+
+    //Sort and merge the ranges, so that nothing's fetched twice
+    std::sort(location.ranges.begin(), location.ranges.end(), [](const ByteRange &a, const ByteRange &b) {return a.offset < b.offset;});
+    std::vector<ByteRange> merged;
+    for(auto &range : location.ranges)
+    {
+        if(range.length == 0 || range.offset >= size)
+            continue;
+
+        uint64_t end = range.offset + std::min(range.length, size - range.offset);
+        if(!merged.empty() && range.offset <= merged.back().offset + merged.back().length)
+            merged.back().length = std::max(merged.back().offset + merged.back().length, end) - merged.back().offset;
+        else
+            merged.push_back(ByteRange{range.offset, end - range.offset});
+    }
+    location.ranges = std::move(merged);
+    return location;
+}
+
+std::string MediaProbe::read_range(uint64_t offset, size_t length)
+{
+    if(offset >= size)
+        return std::string();
+
+    //Serve it from the buffer if it's all there, or the buffer runs to the end of the file
+    uint64_t buffer_end = buffer_offset + buffer.size();
+    if(offset >= buffer_offset && (offset + length <= buffer_end || (buffer_end == size && offset < buffer_end)))
+        return buffer.substr(offset - buffer_offset, length);
+
+    size_t wanted = static_cast<size_t>(std::min<uint64_t>(std::max<size_t>(length, MEDIA_PROBE_READ_SIZE), size - offset));
+    total_read += wanted;
+    if(total_read > MEDIA_PROBE_MAX_READ)
+        throw UnsupportedError("Read too much of the file without finding its headers");
+
+    buffer = read(offset, wanted);
+    buffer_offset = offset;
+    return buffer.substr(0, length);
+}
+
+uint64_t MediaProbe::read_element_header(uint64_t &offset, uint64_t end, uint64_t &length)
+{
+    uint64_t id = read_vint(offset, true);
+    length = read_vint(offset, false);
+    if(offset > end || length > end - offset)
+        length = offset > end ? 0 : end - offset;
+    return id;
+}
+
+uint64_t MediaProbe::read_integer(uint64_t offset, size_t length)
+{
+    return read_big_endian(read_range(offset, length), 0, length);
+}
+
+uint64_t MediaProbe::read_vint(uint64_t &offset, bool keep_marker)
+{
+    std::string data = read_range(offset, 8);
+    if(data.empty() || data[0] == 0)
+        throw UnsupportedError("Malformed Matroska element");
+
+    //The number of leading zeros in the first byte says how many more bytes follow
+    auto first = static_cast<uint8_t>(data[0]);
+    size_t length = 1;
+    while(!(first & (0x80u >> (length - 1))))
+        ++length;
+
+    uint64_t value = read_big_endian(data, 0, length);
+    offset += length;
+    if(keep_marker)
+        return value;
+
+    uint64_t mask = (uint64_t(1) << (7 * length)) - 1;
+    value &= mask;
+    return value == mask ? unknown_size : value;
+}
+
+void MediaProbe::scan_matroska_segment(uint64_t &segment_start, uint64_t &segment_end, std::unordered_map<uint64_t, uint64_t> &elements, std::vector<ByteRange> &headers)
+{
+    //Find the segment, which everything else is within
+    uint64_t offset = 0;
+    segment_start = 0;
+    segment_end = 0;
+    while(offset < size)
+    {
+        uint64_t id = read_vint(offset, true);
+        uint64_t length = read_vint(offset, false);
+        if(id == MKV_SEGMENT)
+        {
+            segment_start = offset;
+            segment_end = length == unknown_size ? size : std::min(offset + length, size);
+            break;
+        }
+        if(length == unknown_size || length > size - offset)
+            break;
+        offset += length;
+    }
+    if(segment_start == 0)
+        throw UnsupportedError("Matroska file has no segment");
+
+    //Walk the elements up to the first cluster. Anything after the clusters is found
+    //through the seek head instead, rather than reading past the media.
+    std::unordered_map<uint64_t, uint64_t> seek_positions; //Element ID -> offset from segment_start
+    headers.push_back(ByteRange{0, segment_start});
+    offset = segment_start;
+    while(offset < segment_end)
+    {
+        uint64_t element_start = offset;
+        uint64_t id = read_vint(offset, true);
+        uint64_t length = read_vint(offset, false);
+        if(id == MKV_CLUSTER || length == unknown_size)
+            break;
+
+        //Attachments are normally fonts, which can be megabytes, and aren't needed to decode anything
+        uint64_t end = std::min(offset + length, segment_end);
+        elements.emplace(id, element_start);
+        headers.push_back(ByteRange{element_start, (id == MKV_ATTACHMENTS ? offset : end) - element_start});
+        if(id == MKV_SEEK_HEAD)
+        {
+            for(uint64_t seek = offset; seek < end;)
+            {
+                uint64_t seek_length;
+                uint64_t seek_id = read_element_header(seek, end, seek_length);
+                uint64_t seek_end = std::min(seek + seek_length, end);
+                if(seek_id == MKV_SEEK)
+                {
+                    uint64_t target_id = 0, target_position = unknown_size;
+                    for(uint64_t field = seek; field < seek_end;)
+                    {
+                        uint64_t field_length;
+                        uint64_t field_id = read_element_header(field, seek_end, field_length);
+                        if(field_id == MKV_SEEK_ID || field_id == MKV_SEEK_POSITION)
+                        {
+                            uint64_t value = read_big_endian(read_range(field, field_length), 0, std::min<uint64_t>(field_length, 8));
+                            (field_id == MKV_SEEK_ID ? target_id : target_position) = value;
+                        }
+                        field += field_length;
+                    }
+                    if(target_position != unknown_size)
+                        seek_positions.emplace(target_id, target_position);
+                }
+                seek = seek_end;
+            }
+        }
+        offset = end;
+    }
+
+    //Elements found by walking take precedence, as the seek head could be stale
+    for(auto &position : seek_positions)
+        elements.emplace(position.first, segment_start + position.second);
+}
+
+bool MediaProbe::find_matroska_element(const std::unordered_map<uint64_t, uint64_t> &elements, uint64_t id, uint64_t segment_end, uint64_t &body_start, uint64_t &body_end)
+{
+    auto position = elements.find(id);
+    if(position == elements.end() || position->second >= segment_end)
+        return false;
+
+    body_start = position->second;
+    uint64_t length;
+    if(read_element_header(body_start, segment_end, length) != id)
+        return false;
+    body_end = body_start + length;
+    return true;
+}
+
+MediaInfo MediaProbe::probe_matroska()
+{
+    uint64_t segment_start, segment_end;
+    std::unordered_map<uint64_t, uint64_t> elements;
+    std::vector<ByteRange> headers;
+    scan_matroska_segment(segment_start, segment_end, elements, headers);
+
+    MediaInfo info{};
+    uint64_t body_start, body_end;
+    if(find_matroska_element(elements, MKV_INFO, segment_end, body_start, body_end))
+        parse_matroska_info(body_start, body_end, info);
+    if(!find_matroska_element(elements, MKV_TRACKS, segment_end, body_start, body_end))
+        throw UnsupportedError("Failed to find the Matroska tracks");
+    parse_matroska_tracks(body_start, body_end, info);
+    return info;
+}
+
+KeyframeLocation MediaProbe::locate_matroska_keyframe(double position)
+{
+    KeyframeLocation location{};
+    uint64_t segment_start, segment_end;
+    std::unordered_map<uint64_t, uint64_t> elements;
+    scan_matroska_segment(segment_start, segment_end, elements, location.ranges);
+
+    MediaInfo info{};
+    uint64_t body_start, body_end;
+    if(find_matroska_element(elements, MKV_INFO, segment_end, body_start, body_end))
+        parse_matroska_info(body_start, body_end, info);
+    if(!find_matroska_element(elements, MKV_TRACKS, segment_end, body_start, body_end))
+        throw UnsupportedError("Failed to find the Matroska tracks");
+    parse_matroska_tracks(body_start, body_end, info);
+    if(info.video_codec.empty())
+        throw UnsupportedError("Matroska file has no video track");
+
+    //The cues are normally after the clusters, in which case they need fetching too
+    if(!find_matroska_element(elements, MKV_CUES, segment_end, body_start, body_end))
+        throw UnsupportedError("Matroska file has no cues");
+    location.ranges.push_back(ByteRange{elements.at(MKV_CUES), body_end - elements.at(MKV_CUES)});
+
+    //Find the last cue point of the video track at or before the wanted time. They're in time order.
+    auto target = static_cast<uint64_t>(static_cast<double>(info.duration) * position * 1000000 / timecode_scale);
+    bool found = false;
+    uint64_t cue_time = 0, cluster_position = 0, relative_position = unknown_size;
+    for(uint64_t point = body_start; point < body_end;)
+    {
+        uint64_t point_length;
+        uint64_t point_id = read_element_header(point, body_end, point_length);
+        uint64_t point_end = point + point_length;
+        uint64_t time = 0, cluster = unknown_size, relative = unknown_size;
+        for(uint64_t field = point; point_id == MKV_CUE_POINT && field < point_end;)
+        {
+            uint64_t field_length;
+            uint64_t field_id = read_element_header(field, point_end, field_length);
+            if(field_id == MKV_CUE_TIME)
+            {
+                time = read_big_endian(read_range(field, field_length), 0, std::min<uint64_t>(field_length, 8));
+            }
+            else if(field_id == MKV_CUE_TRACK_POSITIONS && cluster == unknown_size)
+            {
+                uint64_t nested_end = field + field_length;
+                uint64_t track = 0, track_cluster = unknown_size, track_relative = unknown_size;
+                for(uint64_t nested = field; nested < nested_end;)
+                {
+                    uint64_t nested_length;
+                    uint64_t nested_id = read_element_header(nested, nested_end, nested_length);
+                    if(nested_id == MKV_CUE_TRACK || nested_id == MKV_CUE_CLUSTER_POSITION || nested_id == MKV_CUE_RELATIVE_POSITION)
+                    {
+                        uint64_t value = read_big_endian(read_range(nested, nested_length), 0, std::min<uint64_t>(nested_length, 8));
+                        (nested_id == MKV_CUE_TRACK ? track : nested_id == MKV_CUE_CLUSTER_POSITION ? track_cluster : track_relative) = value;
+                    }
+                    nested += nested_length;
+                }
+                if(track == video_track)
+                {
+                    cluster = track_cluster;
+                    relative = track_relative;
+                }
+            }
+            field += field_length;
+        }
+
+        if(cluster != unknown_size)
+        {
+            if(found && time > target)
+                break;
+            found = true;
+            cue_time = time;
+            cluster_position = cluster;
+            relative_position = relative;
+        }
+        point = point_end;
+    }
+    if(!found)
+        throw UnsupportedError("Matroska file has no cues for its video track");
+
+    //Only the cluster up to the end of the keyframe's block is needed, if the cue says where that is
+    uint64_t cluster_start = segment_start + cluster_position;
+    uint64_t offset = cluster_start;
+    uint64_t cluster_length;
+    if(cluster_start >= segment_end || read_element_header(offset, segment_end, cluster_length) != MKV_CLUSTER)
+        throw UnsupportedError("Matroska cue doesn't point at a cluster");
+
+    uint64_t keyframe_end = offset + cluster_length;
+    if(relative_position != unknown_size && relative_position < cluster_length)
+    {
+        uint64_t block = offset + relative_position;
+        uint64_t block_length;
+        read_element_header(block, keyframe_end, block_length);
+        keyframe_end = block + block_length;
+    }
+    keyframe_end = std::min<uint64_t>(keyframe_end, cluster_start + MEDIA_PROBE_MAX_KEYFRAME_RANGE);
+
+    location.ranges.push_back(ByteRange{cluster_start, keyframe_end - cluster_start});
+    location.time = cue_time * timecode_scale / 1000000;
+    return location;
+}
+
+void MediaProbe::parse_matroska_info(uint64_t offset, uint64_t end, MediaInfo &info)
+{
+    double duration = 0; //In timecodes
+    while(offset < end)
+    {
+        uint64_t length;
+        uint64_t id = read_element_header(offset, end, length);
+        if(id == MKV_TIMECODE_SCALE)
+        {
+            timecode_scale = std::max<uint64_t>(read_big_endian(read_range(offset, length), 0, std::min<uint64_t>(length, 8)), 1);
+        }
+        else if(id == MKV_DURATION && (length == 4 || length == 8))
+        {
+            uint64_t bits = read_big_endian(read_range(offset, length), 0, length);
+            if(length == 4)
+            {
+                auto bits32 = static_cast<uint32_t>(bits);
+                float value;
+                memcpy(&value, &bits32, sizeof(value));
+                duration = value;
+            }
+            else
+            {
+                memcpy(&duration, &bits, sizeof(duration));
+            }
+        }
+        offset += length;
+    }
+
+    if(duration > 0)
+        info.duration = static_cast<uint64_t>(duration * timecode_scale / 1000000);
+}
+
+void MediaProbe::parse_matroska_tracks(uint64_t offset, uint64_t end, MediaInfo &info)
+{
+    while(offset < end)
+    {
+        uint64_t length;
+        uint64_t id = read_element_header(offset, end, length);
+        uint64_t entry_end = offset + length;
+        if(id != MKV_TRACK_ENTRY)
+        {
+            offset = entry_end;
+            continue;
+        }
+
+        uint64_t number = 0, type = 0, width = 0, height = 0, channels = 1;
+        std::string codec;
+        for(uint64_t field = offset; field < entry_end;)
+        {
+            uint64_t field_length;
+            uint64_t field_id = read_element_header(field, entry_end, field_length);
+            if(field_id == MKV_TRACK_NUMBER)
+            {
+                number = read_big_endian(read_range(field, field_length), 0, std::min<uint64_t>(field_length, 8));
+            }
+            else if(field_id == MKV_TRACK_TYPE)
+            {
+                type = read_big_endian(read_range(field, field_length), 0, std::min<uint64_t>(field_length, 8));
+            }
+            else if(field_id == MKV_CODEC_ID)
+            {
+                codec = read_range(field, field_length);
+                codec = codec.substr(0, codec.find('\0'));
+            }
+            else if(field_id == MKV_VIDEO || field_id == MKV_AUDIO)
+            {
+                //Their fields are nested within
+                uint64_t nested_end = std::min(field + field_length, entry_end);
+                for(uint64_t nested = field; nested < nested_end;)
+                {
+                    uint64_t nested_length;
+                    uint64_t nested_id = read_element_header(nested, nested_end, nested_length);
+                    if(nested_id == MKV_PIXEL_WIDTH || nested_id == MKV_PIXEL_HEIGHT || nested_id == MKV_CHANNELS)
+                    {
+                        uint64_t value = read_big_endian(read_range(nested, nested_length), 0, std::min<uint64_t>(nested_length, 8));
+                        (nested_id == MKV_PIXEL_WIDTH ? width : nested_id == MKV_PIXEL_HEIGHT ? height : channels) = value;
+                    }
+                    nested += nested_length;
+                }
+            }
+            field += field_length;
+        }
+
+        if(type == MKV_TRACK_TYPE_VIDEO && info.video_codec.empty())
+        {
+            info.video_codec = matroska_codec_name(codec);
+            video_track = number;
+            info.width = width;
+            info.height = height;
+        }
+        else if(type == MKV_TRACK_TYPE_AUDIO && info.audio_codec.empty())
+        {
+            info.audio_codec = matroska_codec_name(codec);
+            info.audio_channels = channels;
+        }
+        offset = entry_end;
+    }
+}
+
+void MediaProbe::check_mp4_signature()
+{
+    //Files which don't start with a box we'd expect aren't MP4s at all
+    std::string first_type = read_range(4, 4);
+    if(first_type != "ftyp" && first_type != "moov" && first_type != "mdat" && first_type != "free" && first_type != "wide" && first_type != "skip")
+        throw UnsupportedError("Unrecognised container");
+}
+
+MediaInfo MediaProbe::probe_mp4()
+{
+    check_mp4_signature();
+
+    //The movie box is either before or after the media. Either way, the media's skipped over.
+    uint64_t moov_start, moov_end;
+    if(!find_mp4_box(0, size, "moov", moov_start, moov_end))
+        throw UnsupportedError("MP4 file has no movie box");
+
+    MediaInfo info{};
+    uint64_t body_start, body_end;
+    if(find_mp4_box(moov_start, moov_end, "mvhd", body_start, body_end))
+    {
+        //Version 1 has 64-bit times and duration
+        std::string mvhd = read_range(body_start, 32);
+        bool version_1 = read_big_endian(mvhd, 0, 1) == 1;
+        uint64_t timescale = read_big_endian(mvhd, version_1 ? 20 : 12, 4);
+        uint64_t duration = read_big_endian(mvhd, version_1 ? 24 : 16, version_1 ? 8 : 4);
+        if(timescale != 0)
+            info.duration = duration * 1000 / timescale;
+    }
+
+    for(uint64_t offset = moov_start; find_mp4_box(offset, moov_end, "trak", body_start, body_end); offset = body_end)
+        parse_mp4_trak(body_start, body_end, info);
+    return info;
+}
+
+KeyframeLocation MediaProbe::locate_mp4_keyframe(double position)
+{
+    check_mp4_signature();
+
+    //Every top level box is needed to open the file, bar the media data, of which only the header is
+    KeyframeLocation location{};
+    std::string type;
+    uint64_t body_start, body_end, moov_start = 0, moov_end = 0;
+    for(uint64_t offset = 0; next_mp4_box(offset, size, type, body_start, body_end); offset = body_end)
+    {
+        location.ranges.push_back(ByteRange{offset, (type == "mdat" ? body_start : body_end) - offset});
+        if(type == "moov")
+        {
+            moov_start = body_start;
+            moov_end = body_end;
+        }
+    }
+    if(moov_end == 0)
+        throw UnsupportedError("MP4 file has no movie box");
+
+    //Find the first video track's sample tables
+    uint64_t trak_start, trak_end, stbl_start = 0, stbl_end = 0, timescale = 0, duration = 0;
+    for(uint64_t offset = moov_start; stbl_end == 0 && find_mp4_box(offset, moov_end, "trak", trak_start, trak_end); offset = trak_end)
+    {
+        uint64_t mdia_start, mdia_end, hdlr_start, hdlr_end, mdhd_start, mdhd_end, minf_start, minf_end;
+        if(!find_mp4_box(trak_start, trak_end, "mdia", mdia_start, mdia_end) || !find_mp4_box(mdia_start, mdia_end, "hdlr", hdlr_start, hdlr_end) ||
+           read_range(hdlr_start + 8, 4) != "vide" || !find_mp4_box(mdia_start, mdia_end, "mdhd", mdhd_start, mdhd_end) ||
+           !find_mp4_box(mdia_start, mdia_end, "minf", minf_start, minf_end) || !find_mp4_box(minf_start, minf_end, "stbl", stbl_start, stbl_end))
+        {
+            stbl_end = 0;
+            continue;
+        }
+
+        //Laid out as mvhd is, with version 1 having 64-bit times and duration
+        std::string mdhd = read_range(mdhd_start, 32);
+        bool version_1 = read_big_endian(mdhd, 0, 1) == 1;
+        timescale = read_big_endian(mdhd, version_1 ? 20 : 12, 4);
+        duration = read_big_endian(mdhd, version_1 ? 24 : 16, version_1 ? 8 : 4);
+    }
+    if(stbl_end == 0 || timescale == 0)
+        throw UnsupportedError("MP4 file has no video track");
+
+    uint64_t stts, stss, stsc, stsz, stco, table_end;
+    bool all_sync = !find_mp4_box(stbl_start, stbl_end, "stss", stss, table_end);
+    bool co64 = !find_mp4_box(stbl_start, stbl_end, "stco", stco, table_end);
+    if(!find_mp4_box(stbl_start, stbl_end, "stts", stts, table_end) || !find_mp4_box(stbl_start, stbl_end, "stsc", stsc, table_end) ||
+       !find_mp4_box(stbl_start, stbl_end, "stsz", stsz, table_end) || (co64 && !find_mp4_box(stbl_start, stbl_end, "co64", stco, table_end)))
+        throw UnsupportedError("MP4 video track has no sample tables");
+
+    //Find the sample playing at the wanted time, through the time to sample table.
+    //Each of its entries is a run of samples with the same duration.
+    auto target = static_cast<uint64_t>(static_cast<double>(duration) * position);
+    uint64_t stts_count = read_integer(stts + 4, 4);
+    uint64_t sample = 0;
+    for(uint64_t a = 0, time = 0; a < stts_count; ++a)
+    {
+        uint64_t count = read_integer(stts + 8 + a * 8, 4);
+        uint64_t delta = read_integer(stts + 12 + a * 8, 4);
+        if(delta != 0 && target < time + count * delta)
+        {
+            sample += (target - time) / delta;
+            break;
+        }
+        sample += count;
+        time += count * delta;
+    }
+
+    uint64_t sample_count = read_integer(stsz + 8, 4);
+    if(sample_count == 0)
+        throw UnsupportedError("MP4 video track has no samples");
+    sample = std::min(sample, sample_count - 1);
+
+    //Find the last sync sample at or before it. They're listed in order, numbered from 1.
+    uint64_t keyframe = sample;
+    if(!all_sync)
+    {
+        uint64_t stss_count = read_integer(stss + 4, 4);
+        if(stss_count == 0)
+            throw UnsupportedError("MP4 video track has no sync samples");
+
+        uint64_t low = 0, high = stss_count;
+        while(high - low > 1)
+        {
+            uint64_t middle = (low + high) / 2;
+            if(read_integer(stss + 8 + middle * 4, 4) <= sample + 1)
+                low = middle;
+            else
+                high = middle;
+        }
+        keyframe = std::min(std::max<uint64_t>(read_integer(stss + 8 + low * 4, 4), 1) - 1, sample_count - 1);
+    }
+
+    uint64_t keyframe_time = 0;
+    for(uint64_t a = 0, counted = 0; a < stts_count && counted < keyframe; ++a)
+    {
+        uint64_t taken = std::min(read_integer(stts + 8 + a * 8, 4), keyframe - counted);
+        keyframe_time += taken * read_integer(stts + 12 + a * 8, 4);
+        counted += taken;
+    }
+
+    //Find the chunk it's in, through the sample to chunk table. Each of its entries
+    //covers the chunks from its first chunk (numbered from 1) up to the next entry's.
+    uint64_t stsc_count = read_integer(stsc + 4, 4);
+    uint64_t chunk = 0, chunk_first_sample = 0;
+    bool found = false;
+    for(uint64_t a = 0, samples_before = 0; a < stsc_count && !found; ++a)
+    {
+        uint64_t first_chunk = read_integer(stsc + 8 + a * 12, 4);
+        uint64_t per_chunk = read_integer(stsc + 12 + a * 12, 4);
+        if(first_chunk == 0 || per_chunk == 0)
+            throw UnsupportedError("Malformed MP4 sample to chunk table");
+
+        if(a + 1 < stsc_count)
+        {
+            uint64_t next_chunk = read_integer(stsc + 8 + (a + 1) * 12, 4);
+            uint64_t run_samples = (std::max(next_chunk, first_chunk) - first_chunk) * per_chunk;
+            if(keyframe >= samples_before + run_samples)
+            {
+                samples_before += run_samples;
+                continue;
+            }
+        }
+
+        chunk = first_chunk - 1 + (keyframe - samples_before) / per_chunk;
+        chunk_first_sample = keyframe - (keyframe - samples_before) % per_chunk;
+        found = true;
+    }
+
+    if(!found || chunk >= read_integer(stco + 4, 4))
+        throw UnsupportedError("MP4 keyframe isn't in any chunk");
+
+    //Samples within a chunk are stored back to back
+    uint64_t fixed_size = read_integer(stsz + 4, 4);
+    auto sample_size = [&](uint64_t index) {
+        return fixed_size != 0 ? fixed_size : read_integer(stsz + 12 + index * 4, 4);
+    };
+    uint64_t keyframe_offset = co64 ? read_integer(stco + 8 + chunk * 8, 8) : read_integer(stco + 8 + chunk * 4, 4);
+    for(uint64_t a = chunk_first_sample; a < keyframe; ++a)
+        keyframe_offset += sample_size(a);
+
+    location.ranges.push_back(ByteRange{keyframe_offset, std::min<uint64_t>(sample_size(keyframe), MEDIA_PROBE_MAX_KEYFRAME_RANGE)});
+    location.time = keyframe_time * 1000 / timescale;
+    return location;
+}
+
+void MediaProbe::parse_mp4_trak(uint64_t offset, uint64_t end, MediaInfo &info)
+{
+    uint64_t mdia_start, mdia_end, hdlr_start, hdlr_end, minf_start, minf_end, stbl_start, stbl_end, stsd_start, stsd_end;
+    if(!find_mp4_box(offset, end, "mdia", mdia_start, mdia_end) || !find_mp4_box(mdia_start, mdia_end, "hdlr", hdlr_start, hdlr_end) ||
+       !find_mp4_box(mdia_start, mdia_end, "minf", minf_start, minf_end) || !find_mp4_box(minf_start, minf_end, "stbl", stbl_start, stbl_end) ||
+       !find_mp4_box(stbl_start, stbl_end, "stsd", stsd_start, stsd_end))
+        return;
+
+    std::string handler = read_range(hdlr_start + 8, 4);
+    bool video = handler == "vide" && info.video_codec.empty();
+    bool audio = handler == "soun" && info.audio_codec.empty();
+    if(!video && !audio)
+        return;
+
+    //The first sample entry describes the stream. It starts after the version, flags and entry count.
+    std::string entry = read_range(stsd_start + 8, 36);
+    if(entry.size() < 36)
+        return;
+
+    if(video)
+    {
+        info.video_codec = mp4_codec_name(entry.substr(4, 4));
+        info.width = read_big_endian(entry, 32, 2);
+        info.height = read_big_endian(entry, 34, 2);
+    }
+    else
+    {
+        info.audio_codec = mp4_codec_name(entry.substr(4, 4));
+        info.audio_channels = read_big_endian(entry, 24, 2);
+    }
+}
+
+bool MediaProbe::find_mp4_box(uint64_t offset, uint64_t end, const char *type, uint64_t &body_start, uint64_t &body_end)
+{
+    std::string box_type;
+    for(; next_mp4_box(offset, end, box_type, body_start, body_end); offset = body_end)
+    {
+        if(box_type == type)
+            return true;
+    }
+    return false;
+}
+
+bool MediaProbe::next_mp4_box(uint64_t offset, uint64_t end, std::string &type, uint64_t &body_start, uint64_t &body_end)
+{
+    if(offset + 8 > end)
+        return false;
+
+    std::string header = read_range(offset, 16);
+    uint64_t box_size = read_big_endian(header, 0, 4);
+    uint64_t header_size = 8;
+    if(box_size == 1)
+    {
+        box_size = read_big_endian(header, 8, 8);
+        header_size = 16;
+    }
+    else if(box_size == 0)
+    {
+        box_size = end - offset; //Runs to the end
+    }
+
+    if(box_size < header_size)
+        throw UnsupportedError("Malformed MP4 box");
+
+    type = header.substr(4, 4);
+    body_start = offset + header_size;
+    body_end = box_size > end - offset ? end : offset + box_size;
+    return true;
+}
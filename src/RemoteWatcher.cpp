@@ -0,0 +1,135 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#include <chrono>
+#include <Log.h>
+#include "RemoteWatcher.h"
+#include "SSHConnection.h"
+
+RemoteWatcher::RemoteWatcher(std::string hostname_, int port_, std::string username_, std::string root_, callback_t callback_)
+: hostname(std::move(hostname_)),
+  port(port_),
+  username(std::move(username_)),
+  root(std::move(root_)),
+  callback(std::move(callback_)),
+  running(true),
+  gave_up(false)
+{
+    thread = std::thread(&RemoteWatcher::watcher_thread, this);
+}
+
+RemoteWatcher::~RemoteWatcher()
+{
+    stop();
+}
+
+void RemoteWatcher::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running = false;
+    }
+    stop_cv.notify_all();
+
+    if(thread.joinable())
+        thread.join();
+}
+
+void RemoteWatcher::watcher_thread()
+{
+    while(true)
+    {
+        try
+        {
+            frlog << Log::info << "Watching " << root << " for changes" << Log::end;
+            watch();
+        }
+        catch(const std::exception &e)
+        {
+            frlog << Log::warn << "Remote watcher stopped: " << e.what() << Log::end;
+        }
+
+        std::unique_lock<std::mutex> guard(lock);
+        if(gave_up)
+        {
+            frlog << Log::warn << "Giving up on watching " << root << " for changes" << Log::end;
+            return;
+        }
+        if(stop_cv.wait_for(guard, std::chrono::seconds(REMOTE_WATCHER_RETRY_SECONDS), [this]() {return !running;}))
+            return;
+    }
+}
+
+void RemoteWatcher::watch()
+{
+    SSHConnection connection;
+    connection.connect(hostname, port, username);
+
+    std::string command = "inotifywait -m -r -q -e create -e close_write -e delete -e moved_from -e moved_to --format '%e %w%f' " + SSHConnection::shell_quote(root);
+    std::string pending;
+    std::vector<Event> events;
+    auto last_event = std::chrono::steady_clock::now();
+    try
+    {
+        connection.execute(command, [&](const char *data, size_t length) {
+            //Events are a line each
+            pending.append(data, length);
+            size_t start = 0, end;
+            while((end = pending.find('\n', start)) != std::string::npos)
+            {
+                parse_event(pending.substr(start, end - start), events);
+                start = end + 1;
+            }
+            pending.erase(0, start);
+            last_event = std::chrono::steady_clock::now();
+        }, REMOTE_WATCHER_POLL_MS, [&]() {
+            //Pass changes on once things have settled down
+            if(!events.empty() && std::chrono::steady_clock::now() - last_event >= std::chrono::milliseconds(REMOTE_WATCHER_DEBOUNCE_MS))
+            {
+                callback(std::move(events));
+                events.clear();
+            }
+
+            std::lock_guard<std::mutex> guard(lock);
+            return running;
+        });
+    }
+    catch(const SSHConnection::ExitStatusError &e)
+    {
+        if(e.status == 127)
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            gave_up = true;
+            throw std::runtime_error("inotifywait isn't installed on the server");
+        }
+        throw std::runtime_error("inotifywait exited with status " + std::to_string(e.status));
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    if(running)
+        throw std::runtime_error("inotifywait exited");
+}
+
+void RemoteWatcher::parse_event(const std::string &line, std::vector<Event> &events)
+{
+    //Lines are a comma separated list of what happened, then the filepath
+    auto space = line.find(' ');
+    if(space == std::string::npos)
+        return;
+    std::string what = "," + line.substr(0, space) + ",";
+
+    Event event{};
+    if(what.find(",CREATE,") != std::string::npos || what.find(",MOVED_TO,") != std::string::npos)
+        event.type = Event::Created;
+    else if(what.find(",DELETE,") != std::string::npos || what.find(",MOVED_FROM,") != std::string::npos)
+        event.type = Event::Deleted;
+    else if(what.find(",CLOSE_WRITE,") != std::string::npos)
+        event.type = Event::Modified;
+    else
+        return;
+
+    event.is_directory = what.find(",ISDIR,") != std::string::npos;
+    event.filepath = line.substr(space + 1);
+    events.emplace_back(std::move(event));
+}
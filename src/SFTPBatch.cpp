@@ -0,0 +1,306 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#include <cstring>
+#include <stdexcept>
+#include <sys/stat.h>
+#include "SFTPBatch.h"
+
+//SFTP v3 attribute flags and open flags
+#define SFTP_BATCH_ATTR_SIZE 0x00000001u
+#define SFTP_BATCH_ATTR_UIDGID 0x00000002u
+#define SFTP_BATCH_ATTR_PERMISSIONS 0x00000004u
+#define SFTP_BATCH_ATTR_ACMODTIME 0x00000008u
+#define SFTP_BATCH_ATTR_EXTENDED 0x80000000u
+#define SFTP_BATCH_FXF_READ 0x00000001u
+#define SFTP_BATCH_VERSION 3
+
+SFTPBatch::SFTPBatch(ssh_session session_)
+: session(session_),
+  channel(nullptr),
+  next_id(0),
+  in_flight(0)
+{
+    channel = ssh_channel_new(session);
+    if(channel == nullptr)
+        throw std::runtime_error("ssh_channel_new() failed: " + std::string(ssh_get_error(session)));
+
+    try
+    {
+        if(ssh_channel_open_session(channel) != SSH_OK)
+            throw std::runtime_error("Failed to open SFTP batch channel: " + std::string(ssh_get_error(session)));
+        if(ssh_channel_request_subsystem(channel, "sftp") != SSH_OK)
+            throw std::runtime_error("Server refused the SFTP subsystem: " + std::string(ssh_get_error(session)));
+
+        //Agree on a version. INIT is the only packet without a request ID.
+        std::string init;
+        write_uint32(init, 5);
+        init += static_cast<char>(SFTP_BATCH_FXP_INIT);
+        write_uint32(init, SFTP_BATCH_VERSION);
+        write_packet(init);
+
+        Reply version = receive_packet();
+        if(version.type != SFTP_BATCH_FXP_VERSION)
+            throw std::runtime_error("Server sent packet type " + std::to_string(version.type) + " instead of its SFTP version");
+        if(version.read_uint32() < SFTP_BATCH_VERSION)
+            throw std::runtime_error("Server doesn't support SFTP v3");
+    }
+    catch(...)
+    {
+        ssh_channel_close(channel);
+        ssh_channel_free(channel);
+        throw;
+    }
+}
+
+SFTPBatch::~SFTPBatch()
+{
+    ssh_channel_close(channel);
+    ssh_channel_free(channel);
+}
+
+uint32_t SFTPBatch::send_open(const std::string &filepath)
+{
+    std::string body;
+    write_string(body, filepath);
+    write_uint32(body, SFTP_BATCH_FXF_READ);
+    write_uint32(body, 0); //No attributes
+    return send(SFTP_BATCH_FXP_OPEN, body);
+}
+
+uint32_t SFTPBatch::send_close(const std::string &handle)
+{
+    std::string body;
+    write_string(body, handle);
+    return send(SFTP_BATCH_FXP_CLOSE, body);
+}
+
+uint32_t SFTPBatch::send_read(const std::string &handle, uint64_t offset, uint32_t length)
+{
+    std::string body;
+    write_string(body, handle);
+    write_uint32(body, static_cast<uint32_t>(offset >> 32u));
+    write_uint32(body, static_cast<uint32_t>(offset & 0xFFFFFFFFu));
+    write_uint32(body, length);
+    return send(SFTP_BATCH_FXP_READ, body);
+}
+
+uint32_t SFTPBatch::send_opendir(const std::string &filepath)
+{
+    std::string body;
+    write_string(body, filepath);
+    return send(SFTP_BATCH_FXP_OPENDIR, body);
+}
+
+uint32_t SFTPBatch::send_readdir(const std::string &handle)
+{
+    std::string body;
+    write_string(body, handle);
+    return send(SFTP_BATCH_FXP_READDIR, body);
+}
+
+uint32_t SFTPBatch::send_stat(const std::string &filepath)
+{
+    std::string body;
+    write_string(body, filepath);
+    return send(SFTP_BATCH_FXP_STAT, body);
+}
+
+SFTPBatch::Reply SFTPBatch::receive(uint32_t id)
+{
+    auto stash = stashed.find(id);
+    if(stash != stashed.end())
+    {
+        Reply reply = std::move(stash->second);
+        stashed.erase(stash);
+        return reply;
+    }
+
+    while(true)
+    {
+        Reply reply = receive_packet();
+        uint32_t reply_id = reply.read_uint32();
+        --in_flight;
+
+        if(reply_id == id)
+            return reply;
+        stashed.emplace(reply_id, std::move(reply));
+    }
+}
+
+void SFTPBatch::stash_reply()
+{
+    Reply reply = receive_packet();
+    uint32_t reply_id = reply.read_uint32();
+    --in_flight;
+    stashed.emplace(reply_id, std::move(reply));
+}
+
+SFTPBatch::Reply SFTPBatch::receive_packet()
+{
+    //Packets are a 32-bit length, followed by a type, then the payload
+    char header[4];
+    read_exact(header, 4);
+    uint32_t length = (static_cast<uint8_t>(header[0]) << 24u) | (static_cast<uint8_t>(header[1]) << 16u) | (static_cast<uint8_t>(header[2]) << 8u) | static_cast<uint8_t>(header[3]);
+    if(length < 5)
+        throw std::runtime_error("Received malformed SFTP packet of length " + std::to_string(length));
+
+    Reply reply{0, std::string(length, '\0'), 0};
+    read_exact(&reply.payload[0], length);
+    reply.type = static_cast<uint8_t>(reply.payload[0]);
+    reply.position = 1;
+    return reply;
+}
+
+uint32_t SFTPBatch::send(uint8_t type, const std::string &body)
+{
+    uint32_t id = next_id++;
+    std::string packet;
+    packet.reserve(9 + body.size());
+    write_uint32(packet, static_cast<uint32_t>(5 + body.size()));
+    packet += static_cast<char>(type);
+    write_uint32(packet, id);
+    packet += body;
+
+    //The server stops reading requests once its replies fill our side of the channel's window, so its window
+    //stops reopening. Writing into a full window would then wait forever, so read replies to make it room instead.
+    //Otherwise as many requests are in flight as the window allows, rather than waiting a round trip every few.
+    while(in_flight > 0 && ssh_channel_window_size(channel) < packet.size())
+        stash_reply();
+    write_packet(packet);
+
+    ++in_flight;
+    return id;
+}
+
+void SFTPBatch::write_packet(const std::string &packet)
+{
+    size_t written = 0;
+    while(written < packet.size())
+    {
+        int ret = ssh_channel_write(channel, packet.data() + written, static_cast<uint32_t>(packet.size() - written));
+        if(ret <= 0)
+            throw std::runtime_error("Failed to send SFTP request: " + std::string(ssh_get_error(session)));
+        written += static_cast<size_t>(ret);
+    }
+}
+
+void SFTPBatch::read_exact(char *buffer, size_t length)
+{
+    size_t received = 0;
+    while(received < length)
+    {
+        int ret = ssh_channel_read(channel, buffer + received, static_cast<uint32_t>(length - received), 0);
+        if(ret < 0)
+            throw std::runtime_error("Failed to receive SFTP reply: " + std::string(ssh_get_error(session)));
+        if(ret == 0)
+            throw std::runtime_error("SFTP channel closed whilst waiting for a reply");
+        received += static_cast<size_t>(ret);
+    }
+}
+
+void SFTPBatch::write_uint32(std::string &buffer, uint32_t value)
+{
+    buffer += static_cast<char>((value >> 24u) & 0xFFu);
+    buffer += static_cast<char>((value >> 16u) & 0xFFu);
+    buffer += static_cast<char>((value >> 8u) & 0xFFu);
+    buffer += static_cast<char>(value & 0xFFu);
+}
+
+void SFTPBatch::write_string(std::string &buffer, const std::string &value)
+{
+    write_uint32(buffer, static_cast<uint32_t>(value.size()));
+    buffer += value;
+}
+
+uint32_t SFTPBatch::Reply::read_uint32()
+{
+    if(payload.size() - position < 4)
+        throw std::runtime_error("SFTP reply is truncated");
+
+    auto *data = reinterpret_cast<const uint8_t*>(payload.data() + position);
+    position += 4;
+    return (static_cast<uint32_t>(data[0]) << 24u) | (static_cast<uint32_t>(data[1]) << 16u) | (static_cast<uint32_t>(data[2]) << 8u) | data[3];
+}
+
+uint64_t SFTPBatch::Reply::read_uint64()
+{
+    uint64_t high = read_uint32();
+    return (high << 32u) | read_uint32();
+}
+
+std::string SFTPBatch::Reply::read_string()
+{
+    uint32_t length = read_uint32();
+    if(payload.size() - position < length)
+        throw std::runtime_error("SFTP reply is truncated");
+
+    std::string value = payload.substr(position, length);
+    position += length;
+    return value;
+}
+
+Attributes SFTPBatch::Reply::read_attributes(const std::string &filepath)
+{
+    Attributes attr{};
+    attr.name = filepath;
+    attr.full_name = filepath;
+    attr.type = Attributes::Unknown;
+
+    uint32_t flags = read_uint32();
+    if(flags & SFTP_BATCH_ATTR_SIZE)
+        attr.size = read_uint64();
+    if(flags & SFTP_BATCH_ATTR_UIDGID)
+    {
+        read_uint32();
+        read_uint32();
+    }
+    if(flags & SFTP_BATCH_ATTR_PERMISSIONS)
+    {
+        //v3 has no type field, so it comes from the permissions, as libssh does it
+        uint32_t permissions = read_uint32();
+        switch(permissions & S_IFMT)
+        {
+            case S_IFREG:
+                attr.type = Attributes::Regular;
+                break;
+            case S_IFDIR:
+                attr.type = Attributes::Directory;
+                break;
+            case S_IFLNK:
+                attr.type = Attributes::Symlink;
+                break;
+            default:
+                attr.type = Attributes::Special;
+                break;
+        }
+    }
+    if(flags & SFTP_BATCH_ATTR_ACMODTIME)
+    {
+        attr.access_date = read_uint32();
+        attr.mod_date = read_uint32();
+    }
+    if(flags & SFTP_BATCH_ATTR_EXTENDED)
+    {
+        uint32_t count = read_uint32();
+        for(uint32_t a = 0; a < count; ++a)
+        {
+            read_string();
+            read_string();
+        }
+    }
+    return attr;
+}
+
+bool SFTPBatch::Reply::is_status(uint32_t code)
+{
+    if(type != SFTP_BATCH_FXP_STATUS || payload.size() < 9)
+        return false;
+
+    size_t start = position;
+    position = 5;
+    bool matches = read_uint32() == code;
+    position = start;
+    return matches;
+}
@@ -5,13 +5,24 @@
 #include <iostream>
 #include <utility>
 #include <cstring>
+#include <cmath>
+#include <algorithm>
 #include <Log.h>
 #include "SFTPFile.h"
 
 SFTPFile::SFTPFile(sftp_file file_, Attributes attributes_)
 : file(file_),
   attributes(std::move(attributes_)),
-  open(true)
+  open(true),
+  stats(std::make_shared<TransferStats>()),
+  async_buffer_offset(0),
+  async_buffer_length(0),
+  read_offset(0),
+  request_offset(0),
+  read_ahead_limit(std::numeric_limits<uint64_t>::max()),
+  target_depth(SFTP_READ_AHEAD_MIN_DEPTH),
+  bandwidth_estimate(0),
+  min_rtt(0)
 {
 
 }
@@ -25,46 +36,254 @@ SFTPFile::~SFTPFile()
 SFTPFile::SFTPFile(SFTPFile &&other) noexcept
 : file(other.file),
   attributes(other.attributes),
-  async_buffer(std::move(other.async_buffer)),
   open(other.open),
-  async_request(other.async_request)
+  stats(other.stats),
+  in_flight(std::move(other.in_flight)),
+  abandoned(std::move(other.abandoned)),
+  discard_buffer(std::move(other.discard_buffer)),
+  async_buffer(std::move(other.async_buffer)),
+  async_buffer_offset(other.async_buffer_offset),
+  async_buffer_length(other.async_buffer_length),
+  read_offset(other.read_offset),
+  request_offset(other.request_offset),
+  read_ahead_limit(other.read_ahead_limit),
+  target_depth(other.target_depth),
+  bandwidth_estimate(other.bandwidth_estimate),
+  min_rtt(other.min_rtt),
+  last_completion(other.last_completion)
 {
     other.open = false;
     other.file = nullptr;
+    other.in_flight.clear();
+    other.abandoned.clear();
 }
 
 
 size_t SFTPFile::read_async(void *buff)
 {
-    int32_t bytes = sftp_async_read(file,
-                                    &async_buffer[0],
-                                    static_cast<uint32_t>(async_buffer.size()),
-                                    static_cast<uint32_t>(async_request));
+    if(!open)
+        return 0;
 
-    if((bytes != SSH_AGAIN && bytes <= 0) || bytes == SSH_EOF)
-    {
-        close();
-    }
-    else if(bytes > 0)
+    //If there's nothing buffered at the cursor, see if the next chunk has arrived
+    if(read_offset < async_buffer_offset || read_offset >= async_buffer_offset + async_buffer_length)
     {
-        if(buff == nullptr)
+        reposition_pipeline();
+        if(in_flight.empty())
+            fill_pipeline();
+        if(in_flight.empty())
+        {
+            close(); //Nothing left to request, we're at the end of the file
             return 0;
-        memcpy(buff, async_buffer.c_str(), bytes);
-        async_request = sftp_async_read_begin(file, static_cast<uint32_t>(async_buffer.size()));
-        return bytes;
+        }
+
+        int ret = receive_head(false);
+        if(ret == SSH_AGAIN)
+            return 0;
+        if(ret != SSH_OK)
+        {
+            close();
+            return 0;
+        }
     }
 
-    return 0;
+    if(buff == nullptr)
+        return 0;
+
+    size_t bytes = async_buffer_offset + async_buffer_length - read_offset;
+    memcpy(buff, &async_buffer[read_offset - async_buffer_offset], bytes);
+    read_offset += bytes;
+    return bytes;
 }
 
 void SFTPFile::enable_async(size_t buffersz)
 {
+    drain_pipeline();
     async_buffer.resize(buffersz);
-    sftp_file_set_nonblocking(file);
+    async_buffer_length = 0;
+    read_offset = sftp_tell64(file);
+    request_offset = read_offset;
+    fill_pipeline();
+}
 
-    async_request = sftp_async_read_begin(file, static_cast<uint32_t>(buffersz));
+void SFTPFile::fill_pipeline()
+{
+    uint64_t end = std::min<uint64_t>(attributes.size, read_ahead_limit);
+    while(in_flight.size() < target_depth && request_offset < end)
+    {
+        auto length = static_cast<uint32_t>(std::min<uint64_t>(async_buffer.size(), end - request_offset));
+
+        //libssh assumes a single outstanding request when adjusting its own offset, so always set it explicitly
+        sftp_seek64(file, request_offset);
+        int id = sftp_async_read_begin(file, length);
+        if(id < 0)
+        {
+            frlog << Log::warn << "Failed to issue read request for " << attributes.full_name << ": " << ssh_get_error(file->sftp->session) << Log::end;
+            break;
+        }
+
+        in_flight.emplace_back(ReadRequest{request_offset, length, static_cast<uint32_t>(id), std::chrono::steady_clock::now()});
+        request_offset += length;
+        stats->add_request_issued();
+    }
 }
 
+int SFTPFile::receive_head(bool block, char *destination)
+{
+    ReadRequest request = in_flight.front();
+    if(!block)
+        sftp_file_set_nonblocking(file);
+    int bytes = sftp_async_read(file, destination ? destination : &async_buffer[0], request.length, request.id);
+    if(!block)
+        sftp_file_set_blocking(file);
+
+    if(bytes == SSH_AGAIN)
+        return SSH_AGAIN;
+    in_flight.pop_front();
+    stats->add_request_completed(std::chrono::steady_clock::now() - request.issue_time, bytes > 0 ? static_cast<uint64_t>(bytes) : 0);
+
+    if(bytes == SSH_EOF || bytes == 0)
+    {
+        //The file is shorter than we thought. Anything requested past here is useless.
+        drain_pipeline();
+        attributes.size = request.offset;
+        request_offset = request.offset;
+        async_buffer_length = 0;
+        return SSH_EOF;
+    }
+    if(bytes < 0)
+    {
+        frlog << Log::crit << "Error while reading file: " << ssh_get_error(file->sftp->session) << Log::end;
+        drain_pipeline();
+        return SSH_ERROR;
+    }
+
+    if(destination)
+    {
+        async_buffer_length = 0;
+        read_offset = request.offset + bytes;
+    }
+    else
+    {
+        async_buffer_offset = request.offset;
+        async_buffer_length = static_cast<size_t>(bytes);
+    }
+
+    //The server may return less than we asked for. Request the remainder before anything else.
+    if(static_cast<uint32_t>(bytes) < request.length)
+    {
+        uint64_t remainder_offset = request.offset + bytes;
+        sftp_seek64(file, remainder_offset);
+        int id = sftp_async_read_begin(file, request.length - bytes);
+        if(id < 0)
+        {
+            frlog << Log::crit << "Failed to re-request short read for " << attributes.full_name << ": " << ssh_get_error(file->sftp->session) << Log::end;
+            drain_pipeline();
+            return SSH_ERROR;
+        }
+        in_flight.emplace_front(ReadRequest{remainder_offset, request.length - static_cast<uint32_t>(bytes), static_cast<uint32_t>(id), std::chrono::steady_clock::now()});
+        stats->add_request_issued();
+    }
+
+    update_pipeline_estimates(request, static_cast<size_t>(bytes));
+    reap_abandoned(false);
+    fill_pipeline();
+    return SSH_OK;
+}
+
+void SFTPFile::reposition_pipeline()
+{
+    //Skip over requests for data the cursor has moved past, they'll be collected later
+    if(read_offset < request_offset)
+    {
+        while(!in_flight.empty() && in_flight.front().offset + in_flight.front().length <= read_offset)
+        {
+            abandon_request(in_flight.front());
+            in_flight.pop_front();
+        }
+    }
+
+    //Nothing to do if the cursor's data has been requested already
+    if(!in_flight.empty() && read_offset >= in_flight.front().offset && read_offset < request_offset)
+        return;
+    if(in_flight.empty() && read_offset == request_offset)
+        return;
+
+    //Else start again from the cursor, without waiting on the old window to arrive
+    for(auto &request : in_flight)
+        abandon_request(request);
+    in_flight.clear();
+    async_buffer_length = 0;
+    request_offset = read_offset;
+    last_completion = {};
+    fill_pipeline();
+}
+
+void SFTPFile::abandon_request(const ReadRequest &request)
+{
+    abandoned.emplace_back(request);
+    stats->add_request_abandoned();
+
+    //Each one holds on to a response within libssh until collected, so don't let too many build up
+    if(abandoned.size() > SFTP_MAX_ABANDONED_REQUESTS)
+        reap_abandoned(true);
+}
+
+void SFTPFile::reap_abandoned(bool block)
+{
+    if(!block)
+        sftp_file_set_nonblocking(file);
+    while(!abandoned.empty())
+    {
+        //Seeking clears libssh's EOF flag, which would otherwise stop it from collecting the response
+        const ReadRequest &request = abandoned.front();
+        discard_buffer.resize(std::max<size_t>(discard_buffer.size(), request.length));
+        sftp_seek64(file, request.offset);
+        if(sftp_async_read(file, &discard_buffer[0], request.length, request.id) == SSH_AGAIN)
+            break;
+        abandoned.pop_front();
+    }
+    if(!block)
+        sftp_file_set_blocking(file);
+}
+
+void SFTPFile::drain_pipeline()
+{
+    for(auto &request : in_flight)
+    {
+        abandoned.emplace_back(request);
+        stats->add_request_abandoned();
+    }
+    in_flight.clear();
+    reap_abandoned(true);
+    last_completion = {};
+}
+
+void SFTPFile::update_pipeline_estimates(const ReadRequest &request, size_t bytes)
+{
+    const double ewma_weight = 0.125;
+    auto now = std::chrono::steady_clock::now();
+
+    //Lowest latency seen approximates the RTT, as later requests queue behind earlier ones
+    double latency = std::chrono::duration<double>(now - request.issue_time).count();
+    if(min_rtt == 0 || latency < min_rtt)
+        min_rtt = latency;
+
+    //Completions arrive at link speed whilst the reader is waiting on us
+    if(last_completion != std::chrono::steady_clock::time_point{})
+    {
+        double interval = std::chrono::duration<double>(now - last_completion).count();
+        if(interval > 0)
+        {
+            double sample = bytes / interval;
+            bandwidth_estimate = bandwidth_estimate == 0 ? sample : bandwidth_estimate + ewma_weight * (sample - bandwidth_estimate);
+        }
+    }
+    last_completion = now;
+
+    //Keep a bandwidth-delay product's worth of requests in flight, plus some headroom to allow growth
+    auto bdp_depth = static_cast<size_t>(std::ceil(bandwidth_estimate * min_rtt / async_buffer.size())) + 2;
+    target_depth = std::clamp<size_t>(bdp_depth, SFTP_READ_AHEAD_MIN_DEPTH, SFTP_READ_AHEAD_MAX_DEPTH);
+}
 
 bool SFTPFile::is_open()
 {
@@ -74,7 +293,10 @@ bool SFTPFile::is_open()
 void SFTPFile::close()
 {
     if(file)
+    {
+        drain_pipeline();
         sftp_close(file);
+    }
     file = nullptr;
     open = false;
 }
@@ -83,6 +305,8 @@ size_t SFTPFile::tellg()
 {
     if(!open)
         return 0;
+    if(!async_buffer.empty())
+        return read_offset;
     return sftp_tell64(file);
 }
 
@@ -90,9 +314,12 @@ bool SFTPFile::seekg(size_t offset)
 {
     if(!open)
         return false;
-    bool ret = sftp_seek64(file, offset) == SSH_OK;
-    async_request = sftp_async_read_begin(file, static_cast<uint32_t>(async_buffer.size()));
-    return ret;
+    if(async_buffer.empty())
+        return sftp_seek64(file, offset) == SSH_OK;
+
+    //The window is brought in line on the next read, so that bursts of seeks cost nothing
+    read_offset = offset;
+    return true;
 }
 
 size_t SFTPFile::size()
@@ -100,21 +327,88 @@ size_t SFTPFile::size()
     return attributes.size;
 }
 
+const Attributes &SFTPFile::get_attributes()
+{
+    return attributes;
+}
+
 size_t SFTPFile::get_async_buffer_size()
 {
     return async_buffer.size();
 }
 
+void SFTPFile::set_read_ahead_limit(uint64_t offset)
+{
+    read_ahead_limit = offset;
+}
+
+size_t SFTPFile::get_pipeline_depth()
+{
+    return in_flight.size();
+}
+
+const std::shared_ptr<TransferStats> &SFTPFile::get_stats()
+{
+    return stats;
+}
+
+void SFTPFile::set_stats(std::shared_ptr<TransferStats> stats_)
+{
+    stats = std::move(stats_);
+}
+
 ssize_t SFTPFile::read(void *buff, size_t buffsz)
 {
     if(!is_open())
         return -1;
 
-    ssize_t actual = sftp_read(file, buff, buffsz);
-    if(actual < 0)
+    if(async_buffer.empty())
     {
-        frlog << Log::crit << "Error while reading file: " + std::string(ssh_get_error(file)) << Log::end;
+        ssize_t actual = sftp_read(file, buff, buffsz);
+        if(actual < 0)
+        {
+            frlog << Log::crit << "Error while reading file: " + std::string(ssh_get_error(file->sftp->session)) << Log::end;
+        }
+
+        return actual;
     }
 
-    return actual;
-}
\ No newline at end of file
+    auto *out = static_cast<char*>(buff);
+    size_t copied = 0;
+    while(copied < buffsz && read_offset < attributes.size)
+    {
+        //Serve what we can from the last received chunk
+        if(read_offset >= async_buffer_offset && read_offset < async_buffer_offset + async_buffer_length)
+        {
+            size_t available = std::min<size_t>(async_buffer_offset + async_buffer_length - read_offset, buffsz - copied);
+            memcpy(out + copied, &async_buffer[read_offset - async_buffer_offset], available);
+            copied += available;
+            read_offset += available;
+            continue;
+        }
+
+        //Else wait for the next one to arrive
+        reposition_pipeline();
+        if(in_flight.empty())
+            fill_pipeline();
+        if(in_flight.empty())
+            break;
+
+        //If the next chunk fits in what's left of the caller's buffer then skip the copy and have libssh write it there
+        char *destination = nullptr;
+        const ReadRequest &head = in_flight.front();
+        if(head.offset == read_offset && head.length <= buffsz - copied)
+            destination = out + copied;
+
+        uint64_t offset_before = read_offset;
+        int ret = receive_head(true, destination);
+        if(ret == SSH_EOF)
+            break;
+        if(ret != SSH_OK)
+            return copied > 0 ? static_cast<ssize_t>(copied) : -1;
+        if(destination)
+            copied += read_offset - offset_before;
+    }
+
+    return static_cast<ssize_t>(copied);
+}
@@ -4,7 +4,9 @@
 
 #include <stdexcept>
 #include <fcntl.h>
+#include <array>
 #include "../include/SFTPSession.h"
+#include "SFTPBatch.h"
 
 SFTPSession::SFTPSession(SSHConnection *ssh_)
 : ssh(ssh_),
@@ -22,6 +24,7 @@ SFTPSession::SFTPSession(SSHConnection *ssh_)
 
 SFTPSession::~SFTPSession()
 {
+    batch = nullptr;
     if(sftp)
         sftp_free(sftp);
 }
@@ -40,13 +43,9 @@ std::vector<Attributes> SFTPSession::enumerate_directory(const std::string &file
 
     while((attributes = sftp_readdir(sftp, dir)) != nullptr)
     {
-        Attributes object;
-        object.name = attributes->name;
-        object.full_name = filepath + "/" + object.name;
-        object.type = static_cast<Attributes::Type>(attributes->type);
-        object.mod_date = attributes->mtime;
-        object.access_date = attributes->atime;
-        sftp_attributes_free(attributes);
+        std::string name = attributes->name;
+        Attributes object = convert_attributes(filepath + "/" + name, attributes);
+        object.name = std::move(name);
         if(object.name != "." && object.name != "..")
             ret.emplace_back(std::move(object));
     }
@@ -72,7 +71,23 @@ SFTPFile SFTPSession::open(const std::string &filepath)
     if(file == nullptr)
         throw std::runtime_error("Failed to open " + filepath + ": " + ssh_get_error(ssh->get()));
 
-    Attributes attributes = stat(filepath);
+    //Stat the handle rather than the path, so that the server needn't look it up again
+    sftp_attributes attributes = sftp_fstat(file);
+    if(attributes == nullptr)
+    {
+        std::string error = ssh_get_error(ssh->get());
+        sftp_close(file);
+        throw std::runtime_error("Failed to stat " + filepath + ": " + error);
+    }
+
+    return SFTPFile(file, convert_attributes(filepath, attributes));
+}
+
+SFTPFile SFTPSession::open(const Attributes &attributes)
+{
+    sftp_file file = sftp_open(sftp, attributes.full_name.c_str(), O_RDONLY, 0);
+    if(file == nullptr)
+        throw std::runtime_error("Failed to open " + attributes.full_name + ": " + ssh_get_error(ssh->get()));
 
     return SFTPFile(file, attributes);
 }
@@ -83,14 +98,178 @@ Attributes SFTPSession::stat(const std::string &filepath)
     if((attributes = sftp_stat(sftp, filepath.c_str())) == nullptr)
         throw std::runtime_error("Failed to stat " + filepath + ": " + ssh_get_error(ssh->get()));
 
+    return convert_attributes(filepath, attributes);
+}
+
+Attributes SFTPSession::convert_attributes(const std::string &filepath, sftp_attributes attributes)
+{
     Attributes attr;
     attr.name = filepath;
     attr.full_name = filepath;
     attr.size = attributes->size;
-    attr.mod_date = attributes->mtime64;
-    attr.access_date = attributes->atime64;
+    //Only SFTP v4 and later have 64-bit times, so fall back to the v3 ones. Listings and stats must agree, as cached data is keyed on them.
+    attr.mod_date = attributes->mtime64 != 0 ? attributes->mtime64 : attributes->mtime;
+    attr.access_date = attributes->atime64 != 0 ? attributes->atime64 : attributes->atime;
     attr.type = static_cast<Attributes::Type>(attributes->type);
 
     sftp_attributes_free(attributes);
     return attr;
 }
+
+template<typename Operations>
+auto SFTPSession::run_batch(Operations &&operations)
+{
+    try
+    {
+        if(!batch)
+            batch = std::make_unique<SFTPBatch>(ssh->get());
+        return operations(*batch);
+    }
+    catch(...)
+    {
+        batch = nullptr;
+        throw;
+    }
+}
+
+std::vector<std::optional<Attributes>> SFTPSession::stat_many(const std::vector<std::string> &filepaths)
+{
+    return run_batch([&](SFTPBatch &batch) {
+        std::vector<uint32_t> ids;
+        ids.reserve(filepaths.size());
+        for(auto &filepath : filepaths)
+            ids.emplace_back(batch.send_stat(filepath));
+
+        std::vector<std::optional<Attributes>> ret(filepaths.size());
+        for(size_t a = 0; a < filepaths.size(); ++a)
+        {
+            auto reply = batch.receive(ids[a]);
+            if(reply.type == SFTP_BATCH_FXP_ATTRS)
+                ret[a] = reply.read_attributes(filepaths[a]);
+        }
+        return ret;
+    });
+}
+
+std::vector<std::optional<std::vector<Attributes>>> SFTPSession::enumerate_many(const std::vector<std::string> &filepaths)
+{
+    return run_batch([&](SFTPBatch &batch) {
+        std::vector<std::optional<std::vector<Attributes>>> ret(filepaths.size());
+
+        //Open every directory
+        std::vector<uint32_t> ids;
+        ids.reserve(filepaths.size());
+        for(auto &filepath : filepaths)
+            ids.emplace_back(batch.send_opendir(filepath));
+
+        std::vector<std::pair<size_t, std::string>> open_handles; //Index into filepaths, handle
+        for(size_t a = 0; a < filepaths.size(); ++a)
+        {
+            auto reply = batch.receive(ids[a]);
+            if(reply.type != SFTP_BATCH_FXP_HANDLE)
+                continue;
+            open_handles.emplace_back(a, reply.read_string());
+            ret[a].emplace();
+        }
+
+        //Read a batch of entries from each directory per round trip, until they've all ended
+        std::vector<uint32_t> close_ids;
+        while(!open_handles.empty())
+        {
+            ids.clear();
+            for(auto &handle : open_handles)
+                ids.emplace_back(batch.send_readdir(handle.second));
+
+            std::vector<std::pair<size_t, std::string>> still_open;
+            for(size_t a = 0; a < open_handles.size(); ++a)
+            {
+                size_t index = open_handles[a].first;
+                auto reply = batch.receive(ids[a]);
+                if(reply.type != SFTP_BATCH_FXP_NAME)
+                {
+                    //Either the end of the directory, or an error part way through it
+                    if(!reply.is_status(SSH_FX_EOF))
+                        ret[index].reset();
+                    close_ids.emplace_back(batch.send_close(open_handles[a].second));
+                    continue;
+                }
+
+                uint32_t count = reply.read_uint32();
+                for(uint32_t b = 0; b < count; ++b)
+                {
+                    std::string name = reply.read_string();
+                    reply.read_string(); //Long name
+                    Attributes object = reply.read_attributes(filepaths[index] + "/" + name);
+                    object.name = std::move(name);
+                    if(object.name != "." && object.name != "..")
+                        ret[index]->emplace_back(std::move(object));
+                }
+                still_open.emplace_back(std::move(open_handles[a]));
+            }
+            open_handles = std::move(still_open);
+        }
+
+        for(auto id : close_ids)
+            batch.receive(id);
+        return ret;
+    });
+}
+
+std::vector<std::optional<uint64_t>> SFTPSession::fingerprint_many(const std::vector<Attributes> &files)
+{
+    return run_batch([&](SFTPBatch &batch) {
+        std::vector<uint32_t> ids;
+        ids.reserve(files.size());
+        for(auto &file : files)
+            ids.emplace_back(batch.send_open(file.full_name));
+
+        std::vector<std::pair<size_t, std::string>> handles;
+        for(size_t a = 0; a < files.size(); ++a)
+        {
+            auto reply = batch.receive(ids[a]);
+            if(reply.type == SFTP_BATCH_FXP_HANDLE)
+                handles.emplace_back(a, reply.read_string());
+        }
+
+        //Request every sample of every file, then hash them as they come back
+        std::vector<std::array<uint32_t, SFTP_FINGERPRINT_SAMPLE_COUNT>> read_ids(handles.size());
+        for(size_t a = 0; a < handles.size(); ++a)
+        {
+            uint64_t size = files[handles[a].first].size;
+            uint64_t last = size > SFTP_FINGERPRINT_SAMPLE_SIZE ? size - SFTP_FINGERPRINT_SAMPLE_SIZE : 0;
+            for(size_t b = 0; b < SFTP_FINGERPRINT_SAMPLE_COUNT; ++b)
+                read_ids[a][b] = batch.send_read(handles[a].second, last * b / (SFTP_FINGERPRINT_SAMPLE_COUNT - 1), SFTP_FINGERPRINT_SAMPLE_SIZE);
+        }
+
+        std::vector<std::optional<uint64_t>> ret(files.size());
+        std::vector<uint32_t> close_ids;
+        for(size_t a = 0; a < handles.size(); ++a)
+        {
+            uint64_t hash = 14695981039346656037ull; //FNV-1a
+            bool failed = false;
+            for(size_t b = 0; b < SFTP_FINGERPRINT_SAMPLE_COUNT; ++b)
+            {
+                auto reply = batch.receive(read_ids[a][b]);
+                if(reply.type != SFTP_BATCH_FXP_DATA)
+                {
+                    //Reading past the end of an empty file is fine, anything else isn't
+                    failed |= !reply.is_status(SSH_FX_EOF);
+                    continue;
+                }
+
+                for(unsigned char c : reply.read_string())
+                {
+                    hash ^= c;
+                    hash *= 1099511628211ull;
+                }
+            }
+            close_ids.emplace_back(batch.send_close(handles[a].second));
+            if(!failed)
+                ret[handles[a].first] = hash != 0 ? hash : 1;
+        }
+
+        for(auto id : close_ids)
+            batch.receive(id);
+        return ret;
+    });
+}
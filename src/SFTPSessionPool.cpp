@@ -0,0 +1,204 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#include <Log.h>
+#include "SFTPSessionPool.h"
+
+SFTPSessionPool::Handle::Handle()
+: pool(nullptr)
+{
+
+}
+
+SFTPSessionPool::Handle::Handle(SFTPSessionPool *pool_, std::unique_ptr<Entry> entry_)
+: pool(pool_),
+  entry(std::move(entry_))
+{
+
+}
+
+SFTPSessionPool::Handle::~Handle()
+{
+    release();
+}
+
+SFTPSessionPool::Handle::Handle(Handle &&other) noexcept
+: pool(other.pool),
+  entry(std::move(other.entry))
+{
+    other.pool = nullptr;
+}
+
+SFTPSessionPool::Handle &SFTPSessionPool::Handle::operator=(Handle &&other) noexcept
+{
+    if(this != &other)
+    {
+        release();
+        pool = other.pool;
+        entry = std::move(other.entry);
+        other.pool = nullptr;
+    }
+    return *this;
+}
+
+SFTPSession *SFTPSessionPool::Handle::operator->()
+{
+    return entry->session.get();
+}
+
+SFTPSession &SFTPSessionPool::Handle::operator*()
+{
+    return *entry->session;
+}
+
+SSHConnection &SFTPSessionPool::Handle::get_connection()
+{
+    return *entry->connection;
+}
+
+void SFTPSessionPool::Handle::release()
+{
+    if(pool && entry)
+        pool->release(std::move(entry));
+    pool = nullptr;
+}
+
+SFTPSessionPool::Handle::operator bool() const
+{
+    return entry != nullptr;
+}
+
+SFTPSessionPool::SFTPSessionPool(std::string hostname_, int port_, std::string username_, size_t max_size_)
+: hostname(std::move(hostname_)),
+  port(port_),
+  username(std::move(username_)),
+  max_size(std::max<size_t>(max_size_, 1)),
+  background_max_size(max_size > SFTP_POOL_INTERACTIVE_RESERVED ? max_size - SFTP_POOL_INTERACTIVE_RESERVED : max_size),
+  open_count(0),
+  background_count(0)
+{
+
+}
+
+SFTPSessionPool::Handle SFTPSessionPool::checkout()
+{
+    return checkout(false);
+}
+
+SFTPSessionPool::Handle SFTPSessionPool::checkout_interactive()
+{
+    return checkout(true);
+}
+
+SFTPSessionPool::Handle SFTPSessionPool::checkout(bool interactive)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    while(true)
+    {
+        //Background work waits whilst it has all the sessions it's allowed
+        if(interactive || background_count < background_max_size)
+        {
+            //Prefer an idle session, if there's one which still works
+            while(!idle.empty())
+            {
+                auto entry = std::move(idle.back());
+                idle.pop_back();
+                if(!interactive)
+                    ++background_count;
+
+                guard.unlock();
+                bool healthy = is_healthy(*entry);
+                if(healthy)
+                {
+                    entry->interactive = interactive;
+                    return Handle(this, std::move(entry));
+                }
+                entry = nullptr;
+                guard.lock();
+
+                frlog << Log::warn << "Discarding dropped SFTP session" << Log::end;
+                --open_count;
+                if(!interactive)
+                    --background_count;
+            }
+
+            //Else make a new one if there's room, or wait for one to come back
+            if(open_count < max_size)
+                break;
+        }
+        released_cv.wait(guard);
+    }
+
+    //Connecting takes a while, so don't hold up everybody else whilst doing it
+    ++open_count;
+    if(!interactive)
+        ++background_count;
+    guard.unlock();
+    try
+    {
+        auto entry = create_entry();
+        entry->interactive = interactive;
+        return Handle(this, std::move(entry));
+    }
+    catch(...)
+    {
+        guard.lock();
+        --open_count;
+        if(!interactive)
+            --background_count;
+        guard.unlock();
+        released_cv.notify_all();
+        throw;
+    }
+}
+
+size_t SFTPSessionPool::get_max_size()
+{
+    return max_size;
+}
+
+std::unique_ptr<SFTPSessionPool::Entry> SFTPSessionPool::create_entry()
+{
+    auto entry = std::make_unique<Entry>();
+    entry->connection = std::make_unique<SSHConnection>();
+    entry->connection->connect(hostname, port, username);
+    entry->session = std::make_unique<SFTPSession>(entry->connection.get());
+    entry->last_used = std::chrono::steady_clock::now();
+    frlog << Log::info << "Opened a new pooled SFTP session" << Log::end;
+    return entry;
+}
+
+bool SFTPSessionPool::is_healthy(Entry &entry)
+{
+    if(!entry.connection->connected())
+        return false;
+
+    //A connection can look open long after the server has gone, so check ones which have sat unused
+    if(std::chrono::steady_clock::now() - entry.last_used > std::chrono::seconds(SFTP_POOL_IDLE_CHECK_SECONDS))
+    {
+        try
+        {
+            entry.session->stat(".");
+        }
+        catch(const std::exception&)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void SFTPSessionPool::release(std::unique_ptr<Entry> entry)
+{
+    entry->last_used = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if(!entry->interactive)
+            --background_count;
+        idle.emplace_back(std::move(entry));
+    }
+
+    //Waiting background work may not be able to take it, so wake everyone
+    released_cv.notify_all();
+}
@@ -4,30 +4,210 @@
 
 #include <iostream>
 #include <cstring>
+#include <algorithm>
+#include <Log.h>
 #include "SFTPStream.h"
+#include "DiskCache.h"
 
-SFTPStream::SFTPStream(std::unique_ptr<SFTPFile>file_)
-: file(std::move(file_))
+SFTPStream::SFTPStream(std::unique_ptr<SFTPFile>file_, std::unique_ptr<SFTPStripedReader> striped_reader_)
+: file(std::move(file_)),
+  stats(file->get_stats()),
+  log_stats(false),
+  stats_interval(std::chrono::seconds(Config::get_instance().get<uint32_t>(CONFIG_LOG_TRANSFER_STATS_INTERVAL))),
+  last_stats_log(std::chrono::steady_clock::now()),
+  striped_reader(std::move(striped_reader_)),
+  read_ahead_blocks(SFTP_STRIPED_READ_AHEAD_BLOCKS),
+  position(0)
 {
 
 }
 
+SFTPStream::~SFTPStream()
+{
+    if(log_stats)
+        frlog << Log::info << "Transfer summary for " << file->get_attributes().full_name << ": " << stats->get_snapshot().to_string() << Log::end;
+}
+
+void SFTPStream::enable_stats_logging()
+{
+    log_stats = true;
+}
+
+void SFTPStream::set_bitrate(uint64_t bitrate)
+{
+    uint64_t bytes = bitrate / 8 * SFTP_STRIPED_READ_AHEAD_SECONDS;
+    read_ahead_blocks = std::clamp<uint64_t>((bytes + BLOCK_CACHE_BLOCK_SIZE - 1) / BLOCK_CACHE_BLOCK_SIZE, SFTP_STRIPED_READ_AHEAD_BLOCKS, SFTP_STRIPED_MAX_READ_AHEAD_BLOCKS);
+}
+
 sf::Int64 SFTPStream::read(void *data, sf::Int64 size)
 {
-    return file->read(data, static_cast<size_t>(size));
+    //Time spent in here is time the reader spent blocked on us
+    auto start = std::chrono::steady_clock::now();
+    sf::Int64 bytes = read_blocks(static_cast<char*>(data), static_cast<size_t>(size));
+    auto now = std::chrono::steady_clock::now();
+    stats->add_read_call(now - start);
+    if(bytes > 0)
+        stats->add_bytes_read(static_cast<uint64_t>(bytes));
+
+    if(log_stats && stats_interval.count() > 0 && now - last_stats_log >= stats_interval)
+    {
+        frlog << Log::info << "Transfer stats for " << file->get_attributes().full_name << ": " << stats->get_snapshot().to_string() << Log::end;
+        last_stats_log = now;
+    }
+    return bytes;
+}
+
+TransferStats::Snapshot SFTPStream::get_stats()
+{
+    return stats->get_snapshot();
+}
+
+sf::Int64 SFTPStream::read_blocks(char *out, size_t wanted)
+{
+    size_t copied = 0;
+
+    //With nowhere to keep blocks, there's no point staging data in them
+    if(!striped_reader && !BlockCache::get_instance().is_enabled() && !DiskCache::get_instance().is_enabled())
+        return read_direct(out, wanted);
+
+    try
+    {
+        while(copied < wanted && position < file->size())
+        {
+            uint64_t block_index = position / BLOCK_CACHE_BLOCK_SIZE;
+            auto block = BlockCache::get_instance().get(file->get_attributes(), block_index, [&](std::string &block_data) {
+                fetch_block(block_index, block_data);
+            });
+
+            size_t block_offset = position % BLOCK_CACHE_BLOCK_SIZE;
+            if(block_offset >= block->size())
+                break;
+
+            size_t available = std::min(block->size() - block_offset, wanted - copied);
+            memcpy(out + copied, block->data() + block_offset, available);
+            copied += available;
+            position += available;
+        }
+    }
+    catch(const std::exception &e)
+    {
+        frlog << Log::crit << "Failed to read " << file->get_attributes().full_name << ": " << e.what() << Log::end;
+        if(copied == 0)
+            return -1;
+    }
+
+    return static_cast<sf::Int64>(copied);
+}
+
+sf::Int64 SFTPStream::read_direct(char *data, size_t size)
+{
+    if(position >= file->size())
+        return 0;
+
+    //Serve reads from a read-ahead window, rather than a round trip per read. It's only
+    //started here, as requests made ahead of blocks which the caches serve are wasted.
+    if(!file->seekg(position))
+        return -1;
+    if(file->get_async_buffer_size() == 0)
+        file->enable_async(SFTP_READ_AHEAD_CHUNK_SIZE);
+
+    ssize_t bytes = file->read(data, size);
+    if(bytes > 0)
+        position += static_cast<uint64_t>(bytes);
+    return bytes;
+}
+
+void SFTPStream::fetch_block(uint64_t block_index, std::string &block)
+{
+    //Try the disk cache first
+    DiskCache &disk_cache = DiskCache::get_instance();
+    if(disk_cache.read_block(file->get_attributes(), block_index, block))
+        return;
+
+    uint64_t block_start = block_index * BLOCK_CACHE_BLOCK_SIZE;
+    if(striped_reader)
+    {
+        fetch_striped_block(block_index, block);
+        if(block.size() == std::min<uint64_t>(BLOCK_CACHE_BLOCK_SIZE, file->size() - block_start))
+            disk_cache.write_block(file->get_attributes(), block_index, block);
+        return;
+    }
+
+    //Let the read-ahead window run on through the blocks after this one which neither cache has,
+    //so that it stays full across block boundaries. Requests for blocks a cache would serve are wasted.
+    block.resize(std::min<uint64_t>(BLOCK_CACHE_BLOCK_SIZE, file->size() - block_start));
+    uint64_t block_count = (file->size() + BLOCK_CACHE_BLOCK_SIZE - 1) / BLOCK_CACHE_BLOCK_SIZE;
+    uint64_t read_ahead_end = block_index + 1;
+    while(read_ahead_end < block_count && read_ahead_end <= block_index + SFTP_READ_AHEAD_BLOCKS &&
+          !BlockCache::get_instance().contains(file->get_attributes(), read_ahead_end) &&
+          !disk_cache.contains(file->get_attributes(), read_ahead_end))
+        ++read_ahead_end;
+    file->set_read_ahead_limit(std::min<uint64_t>(read_ahead_end * BLOCK_CACHE_BLOCK_SIZE, file->size()));
+    if(!file->seekg(block_start))
+        throw std::runtime_error("Failed to seek to offset " + std::to_string(block_start));
+    if(file->get_async_buffer_size() == 0)
+        file->enable_async(SFTP_READ_AHEAD_CHUNK_SIZE);
+
+    size_t filled = 0;
+    while(filled < block.size())
+    {
+        ssize_t bytes = file->read(&block[filled], block.size() - filled);
+        if(bytes < 0)
+            throw std::runtime_error("Failed to read block at offset " + std::to_string(block_start));
+        if(bytes == 0)
+            break;
+        filled += static_cast<size_t>(bytes);
+    }
+    block.resize(filled);
+
+    //Only whole blocks are stored, so that a present block is always complete
+    if(block_start + filled == std::min<uint64_t>(block_start + BLOCK_CACHE_BLOCK_SIZE, file->size()))
+        disk_cache.write_block(file->get_attributes(), block_index, block);
+}
+
+void SFTPStream::fetch_striped_block(uint64_t block_index, std::string &block)
+{
+    uint64_t block_count = (file->size() + BLOCK_CACHE_BLOCK_SIZE - 1) / BLOCK_CACHE_BLOCK_SIZE;
+    uint64_t window_end = std::min<uint64_t>(block_index + read_ahead_blocks, block_count);
+
+    //Forget fetches outside of the window, the reader has seeked away from them
+    for(auto iter = striped_blocks.begin(); iter != striped_blocks.end();)
+    {
+        if(iter->first < block_index || iter->first >= window_end)
+            iter = striped_blocks.erase(iter);
+        else
+            ++iter;
+    }
+
+    //Keep the window full, so that every connection has something to be getting on with
+    for(uint64_t index = block_index; index < window_end; ++index)
+    {
+        if(striped_blocks.find(index) == striped_blocks.end())
+            striped_blocks.emplace(index, striped_reader->read(index * BLOCK_CACHE_BLOCK_SIZE, BLOCK_CACHE_BLOCK_SIZE));
+    }
+
+    auto fetch = striped_blocks.find(block_index);
+    auto pending = std::move(fetch->second);
+    striped_blocks.erase(fetch);
+    block = pending.get();
 }
 
-sf::Int64 SFTPStream::seek(sf::Int64 position)
+sf::Int64 SFTPStream::seek(sf::Int64 position_)
 {
-    return file->seekg(static_cast<size_t>(position)) ? 0 : -1;
+    if(position_ < 0)
+        return -1;
+    auto target = static_cast<uint64_t>(position_);
+    stats->add_seek(target > position ? target - position : position - target);
+    position = target;
+    return 0;
 }
 
 sf::Int64 SFTPStream::tell()
 {
-    return static_cast<sf::Int64>(file->tellg());
+    return static_cast<sf::Int64>(position);
 }
 
 sf::Int64 SFTPStream::getSize()
 {
     return static_cast<sf::Int64>(file->size());
-}
\ No newline at end of file
+}
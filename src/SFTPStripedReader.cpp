@@ -0,0 +1,133 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#include <Log.h>
+#include "SFTPStripedReader.h"
+#include "SSHConnection.h"
+#include "SFTPSession.h"
+
+SFTPStripedReader::SFTPStripedReader(std::string hostname_, int port_, std::string username_, Attributes file_, size_t connection_count, std::shared_ptr<TransferStats> stats_)
+: hostname(std::move(hostname_)),
+  port(port_),
+  username(std::move(username_)),
+  file(std::move(file_)),
+  stats(std::move(stats_)),
+  live_workers(connection_count),
+  running(true)
+{
+    for(size_t a = 0; a < connection_count; ++a)
+        workers.emplace_back(&SFTPStripedReader::worker_thread, this, a);
+}
+
+SFTPStripedReader::~SFTPStripedReader()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        running = false;
+    }
+    jobs_cv.notify_all();
+
+    for(auto &worker : workers)
+        worker.join();
+}
+
+std::future<std::string> SFTPStripedReader::read(uint64_t offset, size_t length)
+{
+    Job job{offset, length, {}};
+    auto result = job.result.get_future();
+
+    std::unique_lock<std::mutex> guard(lock);
+    if(live_workers == 0)
+    {
+        job.result.set_exception(std::make_exception_ptr(std::runtime_error("No striped connections are available")));
+        return result;
+    }
+    jobs.emplace_back(std::move(job));
+    guard.unlock();
+
+    jobs_cv.notify_one();
+    return result;
+}
+
+size_t SFTPStripedReader::get_connection_count()
+{
+    return workers.size();
+}
+
+void SFTPStripedReader::worker_thread(size_t worker_index)
+{
+    //Each worker has a connection of its own, so that their transfers really do run side by side
+    SSHConnection connection;
+    std::unique_ptr<SFTPSession> session;
+    std::unique_ptr<SFTPFile> remote;
+    try
+    {
+        connection.connect(hostname, port, username);
+        session = std::make_unique<SFTPSession>(&connection);
+        remote = std::make_unique<SFTPFile>(session->open(file.full_name));
+        remote->set_stats(stats);
+        remote->enable_async(SFTP_READ_AHEAD_CHUNK_SIZE);
+    }
+    catch(const std::exception &e)
+    {
+        frlog << Log::warn << "Striped connection " << worker_index << " failed to start: " << e.what() << Log::end;
+        worker_exited();
+        return;
+    }
+
+    while(true)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            jobs_cv.wait(guard, [this]() {return !running || !jobs.empty();});
+            if(!running)
+                break;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        try
+        {
+            //Don't let the read-ahead window wander past the range, as the next job is likely elsewhere
+            uint64_t end = std::min<uint64_t>(job.offset + job.length, remote->size());
+            std::string data(end > job.offset ? end - job.offset : 0, '\0');
+            remote->set_read_ahead_limit(end);
+            if(!remote->seekg(job.offset))
+                throw std::runtime_error("Failed to seek to offset " + std::to_string(job.offset));
+
+            size_t filled = 0;
+            while(filled < data.size())
+            {
+                ssize_t bytes = remote->read(&data[filled], data.size() - filled);
+                if(bytes < 0)
+                    throw std::runtime_error("Failed to read range at offset " + std::to_string(job.offset));
+                if(bytes == 0)
+                    break;
+                filled += static_cast<size_t>(bytes);
+            }
+            data.resize(filled);
+            job.result.set_value(std::move(data));
+        }
+        catch(const std::exception &e)
+        {
+            //The connection is probably unusable now, so leave the rest of the work to the others
+            frlog << Log::warn << "Striped connection " << worker_index << " failed: " << e.what() << Log::end;
+            job.result.set_exception(std::current_exception());
+            worker_exited();
+            return;
+        }
+    }
+}
+
+void SFTPStripedReader::worker_exited()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if(--live_workers > 0)
+        return;
+
+    for(auto &job : jobs)
+        job.result.set_exception(std::make_exception_ptr(std::runtime_error("All striped connections have failed")));
+    jobs.clear();
+}
@@ -5,6 +5,7 @@
 #include <libssh/libssh.h>
 #include <iostream>
 #include <cstring>
+#include <memory>
 #include "../include/SSHConnection.h"
 
 SSHConnection::SSHConnection()
@@ -181,3 +182,144 @@ ssh_session SSHConnection::get()
 {
     return session;
 }
+
+void SSHConnection::execute(const std::string &command, const output_t &output)
+{
+    execute(command, output, 0, nullptr);
+}
+
+void SSHConnection::execute(const std::string &command, const output_t &output, int poll_ms, const std::function<bool()> &poll)
+{
+    ssh_channel channel = ssh_channel_new(session);
+    if(channel == nullptr)
+        throw std::runtime_error("ssh_channel_new() failed: " + std::string(ssh_get_error(session)));
+    std::unique_ptr<ssh_channel_struct, void(*)(ssh_channel)> channel_guard(channel, [](ssh_channel to_free) {
+        ssh_channel_close(to_free);
+        ssh_channel_free(to_free);
+    });
+
+    if(ssh_channel_open_session(channel) != SSH_OK)
+        throw std::runtime_error("Failed to open exec channel: " + std::string(ssh_get_error(session)));
+    if(ssh_channel_request_exec(channel, command.c_str()) != SSH_OK)
+        throw std::runtime_error("Server refused to run command: " + std::string(ssh_get_error(session)));
+
+    //Read until the command closes its output. Without a poll, reads block until there's output or it's closed.
+    char buffer[32768];
+    while(true)
+    {
+        int ret = poll ? ssh_channel_read_timeout(channel, buffer, sizeof(buffer), 0, poll_ms) : ssh_channel_read(channel, buffer, sizeof(buffer), 0);
+        if(ret < 0)
+            throw std::runtime_error("Failed to read command output: " + std::string(ssh_get_error(session)));
+        if(ret > 0)
+            output(buffer, static_cast<size_t>(ret));
+        else if(!poll || ssh_channel_is_eof(channel))
+            break;
+
+        if(poll && !poll())
+            return;
+    }
+
+    int status = ssh_channel_get_exit_status(channel);
+    if(status != 0)
+        throw ExitStatusError(status);
+}
+
+std::string SSHConnection::shell_quote(const std::string &argument)
+{
+    //Nothing's special within single quotes, so only single quotes themselves need escaping, by closing and reopening them
+    std::string quoted = "'";
+    for(char c : argument)
+    {
+        if(c == '\'')
+            quoted += "'\\''";
+        else
+            quoted += c;
+    }
+    quoted += "'";
+    return quoted;
+}
+
+std::vector<Attributes> SSHConnection::enumerate_tree(const std::string &root, uint32_t max_depth)
+{
+    //Each entry is its type, size, mtime, atime then path relative to root. The path
+    //comes last and entries are NUL terminated, as names can contain anything else.
+    //-H follows root if it's a symlink, otherwise find would list only the link itself.
+    std::string command = "find -H " + shell_quote(root) + " -mindepth 1 -maxdepth " + std::to_string(max_depth) + " -printf '%y %s %T@ %A@ %P\\0'";
+
+    std::vector<Attributes> entries;
+    std::string pending;
+    execute(command, [&](const char *data, size_t length) {
+        pending.append(data, length);
+
+        size_t start = 0, end;
+        while((end = pending.find('\0', start)) != std::string::npos)
+        {
+            entries.emplace_back(parse_find_record(pending.substr(start, end - start), root));
+            start = end + 1;
+        }
+        pending.erase(0, start);
+    });
+
+    if(!pending.empty())
+        throw std::runtime_error("find output ended mid-entry");
+    return entries;
+}
+
+Attributes SSHConnection::parse_find_record(const std::string &record, const std::string &root)
+{
+    //Splits off the next space separated field. The path is last and is everything left, as it can contain spaces.
+    size_t position = 0;
+    auto next_field = [&]() {
+        size_t space = record.find(' ', position);
+        if(space == std::string::npos)
+            throw std::runtime_error("Malformed find output: " + record);
+        std::string field = record.substr(position, space - position);
+        position = space + 1;
+        return field;
+    };
+
+    //Only the whole part of a number is taken. Times have a fraction, and whether it's
+    //separated by a '.' or a ',' depends on the locale, so it's skipped rather than parsed.
+    auto parse_integer = [&](const std::string &field) {
+        if(!field.empty() && field[0] == '-') //Times before 1970
+            return uint64_t(0);
+        uint64_t value = 0;
+        size_t a = 0;
+        for(; a < field.size() && field[a] >= '0' && field[a] <= '9'; ++a)
+            value = value * 10 + static_cast<uint64_t>(field[a] - '0');
+        if(a == 0 || (a < field.size() && field[a] != '.' && field[a] != ','))
+            throw std::runtime_error("Malformed find output: " + record);
+        return value;
+    };
+
+    Attributes attr{};
+    std::string type = next_field();
+    if(type.size() != 1)
+        throw std::runtime_error("Malformed find output: " + record);
+    switch(type[0])
+    {
+        case 'f':
+            attr.type = Attributes::Regular;
+            break;
+        case 'd':
+            attr.type = Attributes::Directory;
+            break;
+        case 'l':
+            attr.type = Attributes::Symlink;
+            break;
+        default:
+            attr.type = Attributes::Special;
+            break;
+    }
+    attr.size = parse_integer(next_field());
+    attr.mod_date = static_cast<time_t>(parse_integer(next_field()));
+    attr.access_date = static_cast<time_t>(parse_integer(next_field()));
+
+    std::string relative = record.substr(position);
+    if(relative.empty())
+        throw std::runtime_error("Malformed find output: " + record);
+    auto slash = relative.find_last_of('/');
+    attr.name = slash == std::string::npos ? relative : relative.substr(slash + 1);
+    attr.full_name = root + "/" + relative;
+    return attr;
+}
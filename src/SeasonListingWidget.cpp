@@ -8,8 +8,9 @@
 #include <gdkmm.h>
 #include "SeasonListingWidget.h"
 
-SeasonListingWidget::SeasonListingWidget(std::shared_ptr<SeasonEntry> season_)
-: season_entry(std::move(season_))
+SeasonListingWidget::SeasonListingWidget(std::shared_ptr<SeasonEntry> season_, thumbnail_loader_t load_thumbnail_)
+: season_entry(std::move(season_)),
+  load_thumbnail(std::move(load_thumbnail_))
 {
     //Setup widgets
     entry_label.set_ellipsize(Pango::EllipsizeMode::ELLIPSIZE_MIDDLE);
@@ -37,9 +38,12 @@ void SeasonListingWidget::update()
     set_tooltip_text(season_entry->get_name());
     entry_label.set_text(season_entry->get_name());
 
-    //Load thumbnail
+    //Load thumbnail. Newly found seasons may not have one yet.
+    std::string thumbnail = load_thumbnail(season_entry->get_id());
+    if(thumbnail.empty())
+        return;
     auto thumbnail_loader = Gdk::PixbufLoader::create();
-    thumbnail_loader->write(reinterpret_cast<const guint8 *>(season_entry->get_thumbnail().data()), season_entry->get_thumbnail().size());
+    thumbnail_loader->write(reinterpret_cast<const guint8 *>(thumbnail.data()), thumbnail.size());
     thumbnail_loader->close();
     season_cover.set(thumbnail_loader->get_pixbuf());
 }
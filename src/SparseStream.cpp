@@ -0,0 +1,69 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#include <algorithm>
+#include <cstring>
+#include "SparseStream.h"
+
+SparseStream::SparseStream(sf::InputStream &stream_, std::vector<ByteRange> ranges_)
+: stream(stream_),
+  ranges(std::move(ranges_)),
+  position(0),
+  end(ranges.empty() ? 0 : ranges.back().offset + ranges.back().length)
+{
+
+}
+
+sf::Int64 SparseStream::read(void *data, sf::Int64 size)
+{
+    auto *out = static_cast<char*>(data);
+    uint64_t wanted = size > 0 ? static_cast<uint64_t>(size) : 0;
+    uint64_t copied = 0;
+    while(copied < wanted && position < end)
+    {
+        //Find the first range which ends after the position. There's always one, as it's before the end of the last.
+        auto range = std::upper_bound(ranges.begin(), ranges.end(), position, [](uint64_t offset, const ByteRange &range) {
+            return offset < range.offset + range.length;
+        });
+
+        if(position < range->offset)
+        {
+            uint64_t gap = std::min(wanted - copied, range->offset - position);
+            memset(out + copied, 0, gap);
+            copied += gap;
+            position += gap;
+            continue;
+        }
+
+        uint64_t available = std::min(wanted - copied, range->offset + range->length - position);
+        if(stream.seek(static_cast<sf::Int64>(position)) < 0)
+            return copied > 0 ? static_cast<sf::Int64>(copied) : -1;
+
+        sf::Int64 bytes = stream.read(out + copied, static_cast<sf::Int64>(available));
+        if(bytes <= 0)
+            return copied > 0 ? static_cast<sf::Int64>(copied) : bytes;
+        copied += static_cast<uint64_t>(bytes);
+        position += static_cast<uint64_t>(bytes);
+    }
+
+    return static_cast<sf::Int64>(copied);
+}
+
+sf::Int64 SparseStream::seek(sf::Int64 position_)
+{
+    if(position_ < 0)
+        return -1;
+    position = static_cast<uint64_t>(position_);
+    return position_;
+}
+
+sf::Int64 SparseStream::tell()
+{
+    return static_cast<sf::Int64>(position);
+}
+
+sf::Int64 SparseStream::getSize()
+{
+    return stream.getSize();
+}
@@ -0,0 +1,199 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#include <algorithm>
+#include <Log.h>
+#include "ThumbnailService.h"
+#include "SFTPStream.h"
+#include "SparseStream.h"
+#include "MediaProbe.h"
+
+/*!
+ * Reads a range of a stream, for probing it
+ *
+ * @throws An std::exception on failure
+ * @param stream The stream to read
+ * @param offset Where to read from
+ * @param length The number of bytes wanted
+ * @return The bytes read. Shorter than 'length' only at the end of the stream.
+ */
+static std::string read_stream_range(sf::InputStream &stream, uint64_t offset, size_t length)
+{
+    if(stream.seek(static_cast<sf::Int64>(offset)) == -1)
+        throw std::runtime_error("Failed to seek to offset " + std::to_string(offset));
+
+    std::string data(length, '\0');
+    size_t filled = 0;
+    while(filled < length)
+    {
+        sf::Int64 bytes = stream.read(&data[filled], static_cast<sf::Int64>(length - filled));
+        if(bytes < 0)
+            throw std::runtime_error("Failed to read at offset " + std::to_string(offset + filled));
+        if(bytes == 0)
+            break;
+        filled += static_cast<size_t>(bytes);
+    }
+    data.resize(filled);
+    return data;
+}
+
+ThumbnailService::ThumbnailService(std::shared_ptr<SFTPSessionPool> sftp_, size_t worker_count, completion_t on_complete_)
+: sftp(std::move(sftp_)),
+  on_complete(std::move(on_complete_)),
+  running(0),
+  bytes_received(0),
+  stopping(false)
+{
+    thumbnailers.resize(std::max<size_t>(worker_count, 1));
+    for(size_t a = 0; a < thumbnailers.size(); ++a)
+        workers.emplace_back(&ThumbnailService::worker_main, this, a);
+}
+
+ThumbnailService::~ThumbnailService()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        jobs.clear();
+
+        //Workers part way through a thumbnail would otherwise wait for it to finish
+        for(auto &thumbnailer : thumbnailers)
+            if(thumbnailer)
+                thumbnailer->cancel();
+    }
+    job_available.notify_all();
+    for(auto &worker : workers)
+        worker.join();
+}
+
+void ThumbnailService::submit(Job job)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        jobs.emplace_back(std::move(job));
+    }
+    job_available.notify_one();
+}
+
+void ThumbnailService::wait_idle()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    idle.wait(guard, [this]() {return jobs.empty() && running == 0;});
+}
+
+void ThumbnailService::cancel_pending()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        jobs.clear();
+    }
+    idle.notify_all();
+}
+
+void ThumbnailService::cancel_running()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    for(auto &thumbnailer : thumbnailers)
+        if(thumbnailer)
+            thumbnailer->cancel();
+}
+
+uint64_t ThumbnailService::get_bytes_received()
+{
+    return bytes_received;
+}
+
+void ThumbnailService::worker_main(size_t index)
+{
+    Thumbnailer *thumbnailer = nullptr;
+    JpegEncoder encoder(THUMBNAIL_JPEG_QUALITY);
+    std::mt19937 random(std::random_device{}()); //std::rand() isn't thread-safe
+    while(true)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            job_available.wait(guard, [this]() {return stopping || !jobs.empty();});
+            if(stopping)
+                return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+            ++running;
+
+            //It may have been cancelled along with the last job, but that shouldn't stop this one
+            if(thumbnailer)
+                thumbnailer->resume();
+        }
+
+        std::string thumbnail;
+        try
+        {
+            if(!thumbnailer)
+            {
+                auto created = std::make_unique<Thumbnailer>();
+                std::lock_guard<std::mutex> guard(lock);
+                if(stopping)
+                    created->cancel();
+                thumbnailer = created.get();
+                thumbnailers[index] = std::move(created);
+            }
+            thumbnail = generate(*thumbnailer, encoder, random, job);
+        }
+        catch(const std::exception &e)
+        {
+            frlog << Log::warn << "Failed to generate thumbnail for " << job.name << ": " << e.what() << Log::end;
+        }
+
+        try
+        {
+            on_complete(job.season_id, std::move(thumbnail));
+        }
+        catch(const std::exception &e)
+        {
+            frlog << Log::warn << "Failed to store thumbnail for " << job.name << ": " << e.what() << Log::end;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            --running;
+        }
+        idle.notify_all();
+    }
+}
+
+std::string ThumbnailService::generate(Thumbnailer &thumbnailer, JpegEncoder &encoder, std::mt19937 &random, Job &job)
+{
+    auto session = sftp->checkout();
+    if(job.media.empty())
+        job.media = session->enumerate_directory(job.filepath);
+
+    std::shuffle(job.media.begin(), job.media.end(), random);
+    auto iter = std::find_if(job.media.begin(), job.media.end(), [](const Attributes &attributes) {return attributes.is_video();});
+    if(iter == job.media.end())
+        return "";
+
+    //Generate a thumbnail. The session is held until the stream is done with.
+    auto file = std::make_unique<SFTPFile>(session->open(*iter));
+    SFTPStream video_stream(std::move(file));
+    sf::Image thumbnail;
+    try
+    {
+        //Decode just the keyframe nearest before a random point, giving the decoder nothing but it and the headers.
+        //The index is read through the same stream, so the headers are already cached by the time the decoder wants them.
+        MediaProbe probe(static_cast<uint64_t>(video_stream.getSize()), [&](uint64_t offset, size_t length) {
+            return read_stream_range(video_stream, offset, length);
+        });
+        KeyframeLocation keyframe = probe.locate_keyframe(std::uniform_real_distribution<double>(0.2, 0.8)(random));
+        SparseStream keyframe_stream(video_stream, std::move(keyframe.ranges));
+        thumbnail = thumbnailer.generate_keyframe_thumbnail(keyframe_stream, THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT, keyframe.time);
+    }
+    catch(const std::exception &e)
+    {
+        frlog << Log::warn << "Failed to thumbnail a keyframe of " << iter->full_name << ", seeking through playback instead: " << e.what() << Log::end;
+        video_stream.seek(0);
+        thumbnail = thumbnailer.generate_thumbnail(video_stream, THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT);
+    }
+    bytes_received += video_stream.get_stats().bytes_received;
+    return encoder.encode(thumbnail.getPixelsPtr(), thumbnail.getSize().x, thumbnail.getSize().y);
+}
@@ -7,28 +7,64 @@
 #include <stdexcept>
 #include <cstring>
 #include <zconf.h>
-#include <thread>
+#include <chrono>
 #include <iostream>
 
 Thumbnailer::Thumbnailer()
+: random(std::random_device{}())
 {
     vlc = libvlc_new(0, nullptr);
     if(!vlc)
         throw std::runtime_error("Failed to initialise libVLC");
+
+    //The player renders into the context, whichever media it's been given
+    player = libvlc_media_player_new(vlc);
+    if(!player)
+    {
+        libvlc_release(vlc);
+        throw std::runtime_error("Failed to create libVLC media player");
+    }
+    libvlc_video_set_callbacks(player, lock_callback, unlock_callback, nullptr, &context);
+
+    //Generation's driven by the player's events, rather than by polling its state
+    libvlc_event_manager_t *events = libvlc_media_player_event_manager(player);
+    for(libvlc_event_type_t type : {libvlc_MediaPlayerVout, libvlc_MediaPlayerPositionChanged, libvlc_MediaPlayerEncounteredError, libvlc_MediaPlayerEndReached})
+        libvlc_event_attach(events, type, event_callback, &context);
 }
 
 Thumbnailer::~Thumbnailer()
 {
+    libvlc_media_player_release(player);
     libvlc_release(vlc);
 }
 
 sf::Image Thumbnailer::generate_thumbnail(sf::InputStream &stream, size_t width, size_t height)
 {
-    //Setup
-    ThumbnailContext context;
-    context.frame_data_size = width * height * 4;
+    return grab(stream, width, height, -1);
+}
+
+sf::Image Thumbnailer::generate_keyframe_thumbnail(sf::InputStream &stream, size_t width, size_t height, uint64_t time)
+{
+    return grab(stream, width, height, static_cast<int64_t>(time));
+}
+
+sf::Image Thumbnailer::grab(sf::InputStream &stream, size_t width, size_t height, int64_t start_time)
+{
+    //Setup. The frame buffer's kept between thumbnails, as they're normally all the same size.
+    frame_buffer.resize(width * height * 4);
+    context.frame_data_size = frame_buffer.size();
+    context.frame_data = frame_buffer.data();
     context.stream = &stream;
-    context.frame_data = new uint8_t[context.frame_data_size];
+    {
+        std::lock_guard<std::mutex> guard(context.lock);
+        if(context.cancelled)
+            throw std::runtime_error("Thumbnail generation was cancelled");
+        context.video_started = false;
+        context.frame_rendered = false;
+        context.thumbnail_completed = false;
+        context.seek_complete = start_time >= 0; //Playback starts at the frame wanted
+        context.failed = false;
+    }
 
     //Open the media from the stream, disabling audio/subtitles etc
     libvlc_media_t *media = libvlc_media_new_callbacks(vlc, open_callback, read_callback, seek_callback, close_callback, &context);
@@ -40,51 +76,92 @@ sf::Image Thumbnailer::generate_thumbnail(sf::InputStream &stream, size_t width,
     libvlc_media_add_option(media, ":no-video-title-show");
     libvlc_media_add_option(media, ":no-disable-screensaver");
     libvlc_media_add_option(media, ":no-snapshot-preview");
+    if(start_time >= 0)
+    {
+        //Jump straight to the keyframe when opening, rather than decoding anything before it
+        std::string start_option = ":start-time=" + std::to_string(start_time / 1000) + "." + std::to_string(start_time % 1000 + 1000).substr(1);
+        libvlc_media_add_option(media, start_option.c_str());
+        libvlc_media_add_option(media, ":input-fast-seek");
+    }
 
     //Render to an internal buffer
-    libvlc_media_player_t *player = libvlc_media_player_new_from_media(media);
+    libvlc_media_player_set_media(player, media);
     libvlc_media_release(media);
     libvlc_video_set_format(player, "RGBA", static_cast<unsigned int>(width), static_cast<unsigned int>(height), static_cast<unsigned int>(width * 4));
-    libvlc_video_set_callbacks(player, lock_callback, unlock_callback, nullptr, &context);
 
-    //Play media and seek to position
-    float gen_offset = 0;
-    while(gen_offset >= 0.8F || gen_offset <= 0.2F)
-        gen_offset = ((float) rand() / (RAND_MAX));
+    //Play the media, and once there's video, seek to somewhere within it. It's not seekable
+    //until then. The frame's taken by the first render after playback reaches that position.
+    //If it started at a keyframe, then the first frame rendered is taken instead.
+    float gen_offset = std::uniform_real_distribution<float>(0.2F, 0.8F)(random);
     libvlc_media_player_play(player);
-    libvlc_media_player_set_position(player, gen_offset);
-    const std::chrono::milliseconds wait_time(50);
-    const uint32_t max_attempts = 1000;
-    for(uint32_t a = 0; a < max_attempts; ++a)
+
+    bool completed = false;
+    try
     {
-        if(libvlc_media_player_is_playing(player) != 0)
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(THUMBNAILER_TIMEOUT_SECONDS);
+        std::unique_lock<std::mutex> guard(context.lock);
+        if(start_time >= 0)
         {
-            auto play_offset = libvlc_media_player_get_position(player);
-            if((play_offset >= 0.2 && play_offset <= 0.8F))
-                break;
+            completed = wait_for(guard, deadline, [this]() {return context.thumbnail_completed;});
+        }
+        else if(wait_for(guard, deadline, [this]() {return context.video_started;}))
+        {
+            guard.unlock();
+            libvlc_media_player_set_position(player, gen_offset);
+            guard.lock();
+            completed = wait_for(guard, deadline, [this]() {return context.thumbnail_completed;});
         }
-        std::this_thread::sleep_for(wait_time);
-    }
-    context.seek_complete = true;
 
-    //Wait for thumbnail to be generated
-    for(uint32_t a = 0; a < max_attempts; ++a)
+        //If playback never got to the position, then any frame's better than none
+        if(!completed && !context.frame_rendered)
+            throw std::runtime_error("Timed out waiting for a frame to be rendered");
+    }
+    catch(...)
     {
-        if(context.thumbnail_completed)
-           break;
-        std::this_thread::sleep_for(wait_time);
+        libvlc_media_player_stop(player);
+        context.stream = nullptr;
+        throw;
     }
 
+    //Stop, ready for the next. This waits for playback to end, so neither the stream
+    //nor the frame are touched by libVLC once it returns.
+    libvlc_media_player_stop(player);
+    context.stream = nullptr;
+
     //Save it
     sf::Image thumbnail;
     thumbnail.create(static_cast<unsigned int>(width), static_cast<unsigned int>(height), context.frame_data);
-
-    //Exit
-    libvlc_media_player_release(player);
-    delete[] context.frame_data;
     return thumbnail;
 }
 
+void Thumbnailer::cancel()
+{
+    {
+        std::lock_guard<std::mutex> guard(context.lock);
+        context.cancelled = true;
+    }
+    context.changed.notify_all();
+}
+
+void Thumbnailer::resume()
+{
+    std::lock_guard<std::mutex> guard(context.lock);
+    context.cancelled = false;
+}
+
+template<typename Predicate>
+bool Thumbnailer::wait_for(std::unique_lock<std::mutex> &guard, std::chrono::steady_clock::time_point deadline, Predicate done)
+{
+    bool finished = context.changed.wait_until(guard, deadline, [&]() {
+        return context.cancelled || context.failed || done();
+    });
+    if(context.cancelled)
+        throw std::runtime_error("Thumbnail generation was cancelled");
+    if(context.failed && !done())
+        throw std::runtime_error("Playback failed before a frame could be taken");
+    return finished;
+}
+
 int Thumbnailer::open_callback(void *opaque, void **datap, uint64_t *sizep)
 {
     auto *ctx = static_cast<ThumbnailContext*>(opaque);
@@ -107,7 +184,7 @@ ssize_t Thumbnailer::read_callback(void *opaque, unsigned char *buf, size_t len)
 int Thumbnailer::seek_callback (void *opaque, uint64_t offset)
 {
     auto *ctx = static_cast<ThumbnailContext*>(opaque);
-    return ctx->stream->seek(static_cast<sf::Int64>(offset));
+    return ctx->stream->seek(static_cast<sf::Int64>(offset)) == -1 ? -1 : 0;
 }
 
 void *Thumbnailer::lock_callback(void *opaque, void **pixels)
@@ -120,8 +197,41 @@ void *Thumbnailer::lock_callback(void *opaque, void **pixels)
 void Thumbnailer::unlock_callback(void *opaque, void * /*picture */, void *const * /*pixels */)
 {
     auto *context = static_cast<ThumbnailContext *>(opaque);
-    if(!context->seek_complete || context->thumbnail_completed)
-        return;
-    context->thumbnail_completed = true;
+    {
+        std::lock_guard<std::mutex> guard(context->lock);
+        if(context->frame_rendered && (!context->seek_complete || context->thumbnail_completed))
+            return;
+        context->frame_rendered = true;
+        context->thumbnail_completed = context->seek_complete;
+    }
+    context->changed.notify_all();
+}
+
+void Thumbnailer::event_callback(const libvlc_event_t *event, void *opaque)
+{
+    //Called from libVLC's event thread, which mustn't call back into the player
+    auto *context = static_cast<ThumbnailContext *>(opaque);
+    {
+        std::lock_guard<std::mutex> guard(context->lock);
+        switch(event->type)
+        {
+            case libvlc_MediaPlayerVout:
+                context->video_started |= event->u.media_player_vout.new_count > 0;
+                break;
+            case libvlc_MediaPlayerPositionChanged:
+            {
+                float position = event->u.media_player_position_changed.new_position;
+                context->seek_complete |= context->video_started && position >= 0.2F && position <= 0.8F;
+                break;
+            }
+            case libvlc_MediaPlayerEncounteredError:
+            case libvlc_MediaPlayerEndReached:
+                context->failed = true;
+                break;
+            default:
+                return;
+        }
+    }
+    context->changed.notify_all();
 }
 
@@ -0,0 +1,116 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#include <sstream>
+#include <iomanip>
+#include "TransferStats.h"
+
+TransferStats::TransferStats()
+: bytes_read(0),
+  bytes_received(0),
+  requests_issued(0),
+  requests_completed(0),
+  requests_abandoned(0),
+  read_calls(0),
+  stall_nanoseconds(0),
+  seek_count(0),
+  seek_distance(0),
+  created(std::chrono::steady_clock::now())
+{
+    for(auto &bucket : latency_histogram)
+        bucket.store(0, std::memory_order_relaxed);
+}
+
+void TransferStats::add_bytes_read(uint64_t bytes)
+{
+    bytes_read.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void TransferStats::add_request_issued()
+{
+    requests_issued.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TransferStats::add_request_completed(std::chrono::steady_clock::duration latency, uint64_t bytes)
+{
+    requests_completed.fetch_add(1, std::memory_order_relaxed);
+    bytes_received.fetch_add(bytes, std::memory_order_relaxed);
+
+    auto milliseconds = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(latency).count());
+    size_t bucket = 0;
+    while(milliseconds > 0 && bucket < TRANSFER_STATS_LATENCY_BUCKETS - 1)
+    {
+        milliseconds >>= 1;
+        ++bucket;
+    }
+    latency_histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void TransferStats::add_request_abandoned()
+{
+    requests_abandoned.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TransferStats::add_read_call(std::chrono::steady_clock::duration duration)
+{
+    read_calls.fetch_add(1, std::memory_order_relaxed);
+    stall_nanoseconds.fetch_add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()), std::memory_order_relaxed);
+}
+
+void TransferStats::add_seek(uint64_t distance)
+{
+    seek_count.fetch_add(1, std::memory_order_relaxed);
+    seek_distance.fetch_add(distance, std::memory_order_relaxed);
+}
+
+TransferStats::Snapshot TransferStats::get_snapshot() const
+{
+    Snapshot snapshot{};
+    snapshot.bytes_read = bytes_read.load(std::memory_order_relaxed);
+    snapshot.bytes_received = bytes_received.load(std::memory_order_relaxed);
+    snapshot.requests_issued = requests_issued.load(std::memory_order_relaxed);
+    snapshot.requests_completed = requests_completed.load(std::memory_order_relaxed);
+    snapshot.requests_abandoned = requests_abandoned.load(std::memory_order_relaxed);
+    for(size_t a = 0; a < TRANSFER_STATS_LATENCY_BUCKETS; ++a)
+        snapshot.latency_histogram[a] = latency_histogram[a].load(std::memory_order_relaxed);
+    snapshot.read_calls = read_calls.load(std::memory_order_relaxed);
+    snapshot.stall_time = stall_nanoseconds.load(std::memory_order_relaxed) / 1e9;
+    snapshot.seek_count = seek_count.load(std::memory_order_relaxed);
+    snapshot.seek_distance = seek_distance.load(std::memory_order_relaxed);
+    snapshot.elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - created).count();
+    return snapshot;
+}
+
+double TransferStats::Snapshot::get_latency_percentile(double percentile) const
+{
+    uint64_t total = 0;
+    for(auto count : latency_histogram)
+        total += count;
+    if(total == 0)
+        return 0;
+
+    auto wanted = static_cast<uint64_t>(percentile * total);
+    uint64_t seen = 0;
+    for(size_t a = 0; a < TRANSFER_STATS_LATENCY_BUCKETS; ++a)
+    {
+        seen += latency_histogram[a];
+        if(seen > wanted)
+            return static_cast<double>(uint64_t(1) << a);
+    }
+    return static_cast<double>(uint64_t(1) << (TRANSFER_STATS_LATENCY_BUCKETS - 1));
+}
+
+std::string TransferStats::Snapshot::to_string() const
+{
+    const double megabyte = 1024.0 * 1024.0;
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(2);
+    ss << "read " << bytes_read / megabyte << "MB (" << (elapsed > 0 ? bytes_read / megabyte / elapsed : 0) << "MB/s)"
+       << ", received " << bytes_received / megabyte << "MB"
+       << ", " << requests_completed << "/" << requests_issued << " requests (" << requests_abandoned << " abandoned)"
+       << ", latency p50 <" << get_latency_percentile(0.5) << "ms p99 <" << get_latency_percentile(0.99) << "ms"
+       << ", stalled " << stall_time << "s over " << read_calls << " reads"
+       << ", " << seek_count << " seeks (avg " << (seek_count > 0 ? seek_distance / megabyte / seek_count : 0) << "MB)";
+    return ss.str();
+}
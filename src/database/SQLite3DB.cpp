@@ -93,6 +93,7 @@ SQLite3DB::query_t SQLite3DB::query(const std::string &query, const std::vector<
 
     //Compile the statement
     CompiledStatement stmt = compile_statement(query);
+    auto guard = lock_if_writing(stmt);
 
     //Bind parameters
     stmt.bind_parameters(parameters);
@@ -106,6 +107,7 @@ SQLite3DB::query_t SQLite3DB::query(const std::string &query, const std::vector<
 void SQLite3DB::query(SQLite3DB::CompiledStatement &query, const std::vector<DBType> &values,
                                 query_t &results, size_t batch_size, const std::function<bool()> &callback)
 {
+    auto guard = lock_if_writing(query);
     query.bind_parameters(values);
 
     size_t queries_made = 0;
@@ -136,6 +138,7 @@ void SQLite3DB::query(SQLite3DB::CompiledStatement &query, const std::vector<DBT
 SQLite3DB::query_t SQLite3DB::query(SQLite3DB::CompiledStatement &query, const std::vector<DBType> &values)
 {
     query_t results;
+    auto guard = lock_if_writing(query);
     query.bind_parameters(values);
     while(query.step(database, results));
     query.reset();
@@ -144,12 +147,15 @@ SQLite3DB::query_t SQLite3DB::query(SQLite3DB::CompiledStatement &query, const s
 
 uint64_t SQLite3DB::insert_query(const std::string &query_str, const std::vector<DBType> &values)
 {
+    //Hold the lock until we've read the row ID, so another thread's insert can't replace it first
+    std::lock_guard<std::recursive_mutex> guard(transaction_lock);
     query(query_str, values);
     return static_cast<uint64_t>(sqlite3_last_insert_rowid(database));
 }
 
 void SQLite3DB::unsafe_query(const std::string &query)
 {
+    std::lock_guard<std::recursive_mutex> guard(transaction_lock);
     int ret = sqlite3_exec(database, query.c_str(), nullptr, nullptr, nullptr);
     if(ret != SQLITE_OK)
     {
@@ -157,6 +163,20 @@ void SQLite3DB::unsafe_query(const std::string &query)
     }
 }
 
+bool SQLite3DB::add_column_if_missing(const std::string &table, const std::string &column, const std::string &definition)
+{
+    query_t columns = query("PRAGMA table_info(" + table + ")", {});
+    for(auto &name : columns["name"])
+    {
+        if(name.get<std::string>() == column)
+            return false;
+    }
+
+    frlog << Log::info << "Adding missing column '" << column << "' to table '" << table << "'" << Log::end;
+    unsafe_query("ALTER TABLE " + table + " ADD COLUMN " + column + " " + definition);
+    return true;
+}
+
 SQLite3DB::CompiledStatement SQLite3DB::compile_statement(const std::string &query)
 {
     CompiledStatement stmt;
@@ -168,6 +188,85 @@ SQLite3DB::CompiledStatement SQLite3DB::compile_statement(const std::string &que
     return stmt;
 }
 
+std::unique_lock<std::recursive_mutex> SQLite3DB::lock_if_writing(CompiledStatement &statement)
+{
+    if(sqlite3_stmt_readonly(statement.statement))
+        return std::unique_lock<std::recursive_mutex>(transaction_lock, std::defer_lock);
+    return std::unique_lock<std::recursive_mutex>(transaction_lock);
+}
+
+SQLite3DB::Transaction::Transaction(SQLite3DB &database_)
+: database(database_),
+  level(0),
+  finished(false)
+{
+    database.transaction_lock.lock();
+    level = database.transaction_depth;
+    try
+    {
+        if(level == 0)
+            database.lock();
+        else
+            database.unsafe_query("SAVEPOINT " + savepoint_name());
+    }
+    catch(...)
+    {
+        database.transaction_lock.unlock();
+        throw;
+    }
+    ++database.transaction_depth;
+}
+
+SQLite3DB::Transaction::~Transaction()
+{
+    if(!finished)
+    {
+        --database.transaction_depth;
+        try
+        {
+            //Rolling back to a savepoint leaves it open, so it's released too
+            if(level == 0)
+            {
+                database.rollback();
+            }
+            else
+            {
+                database.unsafe_query("ROLLBACK TO " + savepoint_name());
+                database.unsafe_query("RELEASE " + savepoint_name());
+            }
+        }
+        catch(const std::exception &e)
+        {
+            frlog << Log::warn << "Rolling back transaction threw: " << e.what() << Log::end;
+        }
+        ++database.rollback_count;
+    }
+    database.transaction_lock.unlock();
+}
+
+void SQLite3DB::Transaction::commit()
+{
+    if(finished)
+        return;
+
+    if(level == 0)
+        database.unlock();
+    else
+        database.unsafe_query("RELEASE " + savepoint_name());
+    finished = true;
+    --database.transaction_depth;
+}
+
+std::string SQLite3DB::Transaction::savepoint_name()
+{
+    return "nested_transaction_" + std::to_string(level);
+}
+
+uint64_t SQLite3DB::get_rollback_count()
+{
+    return rollback_count;
+}
+
 void SQLite3DB::CompiledStatement::bind_parameters(const std::vector<DBType> &parameters)
 {
     //Clear the statement first
@@ -0,0 +1,70 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include "SSHConnection.h"
+
+#define CHECK(condition) \
+    do { \
+        if(!(condition)) \
+        { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": Check failed: " #condition << std::endl; \
+            return 1; \
+        } \
+    } while(false)
+
+//True if parsing the record throws, as malformed records should
+static bool rejected(const std::string &record)
+{
+    try
+    {
+        SSHConnection::parse_find_record(record, "/library");
+    }
+    catch(const std::runtime_error &)
+    {
+        return true;
+    }
+    return false;
+}
+
+int main()
+{
+    Attributes season = SSHConnection::parse_find_record("d 4096 1700000000.1234567890 1700000100.5 Some Season", "/library");
+    CHECK(season.type == Attributes::Directory);
+    CHECK(season.size == 4096);
+    CHECK(season.mod_date == 1700000000);
+    CHECK(season.access_date == 1700000100);
+    CHECK(season.name == "Some Season");
+    CHECK(season.full_name == "/library/Some Season");
+
+    //Servers in locales with a comma as their decimal separator print times with one
+    Attributes episode = SSHConnection::parse_find_record("f 123456789012 1700000000,25 1700000001,0 Some Season/Episode 1.mkv", "/library");
+    CHECK(episode.type == Attributes::Regular);
+    CHECK(episode.size == 123456789012ull);
+    CHECK(episode.mod_date == 1700000000);
+    CHECK(episode.access_date == 1700000001);
+    CHECK(episode.name == "Episode 1.mkv");
+    CHECK(episode.full_name == "/library/Some Season/Episode 1.mkv");
+
+    CHECK(SSHConnection::parse_find_record("l 7 1700000000 1700000000 link", "/library").type == Attributes::Symlink);
+    CHECK(SSHConnection::parse_find_record("p 0 1700000000 1700000000 fifo", "/library").type == Attributes::Special);
+    CHECK(SSHConnection::parse_find_record("f 0 -86400.0 -86400.0 old", "/library").mod_date == 0);
+
+    CHECK(rejected(""));
+    CHECK(rejected("f 10 1700000000.0 1700000000.0 "));
+    CHECK(rejected("f 10 1700000000.0"));
+    CHECK(rejected("f ten 1700000000.0 1700000000.0 name"));
+    CHECK(rejected("f 10 17e8 1700000000.0 name"));
+    CHECK(rejected("fd 10 1700000000.0 1700000000.0 name"));
+
+    //Paths reach find through the server's shell, so nothing in them should be interpreted
+    CHECK(SSHConnection::shell_quote("/library") == "'/library'");
+    CHECK(SSHConnection::shell_quote("/it's $HOME") == "'/it'\\''s $HOME'");
+    CHECK(SSHConnection::shell_quote("") == "''");
+
+    std::cout << "Parsed find listing records" << std::endl;
+    return 0;
+}
@@ -0,0 +1,372 @@
+//
+// Created by fred on 16/10/26.
+//
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include "MediaProbe.h"
+#include "SparseStream.h"
+
+#define TEST_SAMPLE_COUNT 100 //Frames in the generated video
+#define TEST_SAMPLE_DELTA 40 //Length of each frame, in timescale units
+#define TEST_TIMESCALE 1000 //Timescale units per second
+#define TEST_KEYFRAME_INTERVAL 25 //Every this many frames is a keyframe
+#define TEST_WIDTH 1920
+#define TEST_HEIGHT 1080
+
+//Matroska element IDs, as in MediaProbe.cpp
+#define MKV_EBML 0x1A45DFA3
+#define MKV_DOC_TYPE 0x4282
+#define MKV_SEGMENT 0x18538067
+#define MKV_SEEK_HEAD 0x114D9B74
+#define MKV_SEEK 0x4DBB
+#define MKV_SEEK_ID 0x53AB
+#define MKV_SEEK_POSITION 0x53AC
+#define MKV_INFO 0x1549A966
+#define MKV_TIMECODE_SCALE 0x2AD7B1
+#define MKV_DURATION 0x4489
+#define MKV_TRACKS 0x1654AE6B
+#define MKV_TRACK_ENTRY 0xAE
+#define MKV_TRACK_NUMBER 0xD7
+#define MKV_TRACK_TYPE 0x83
+#define MKV_CODEC_ID 0x86
+#define MKV_VIDEO 0xE0
+#define MKV_PIXEL_WIDTH 0xB0
+#define MKV_PIXEL_HEIGHT 0xBA
+#define MKV_CLUSTER 0x1F43B675
+#define MKV_CLUSTER_TIMECODE 0xE7
+#define MKV_SIMPLE_BLOCK 0xA3
+#define MKV_CUES 0x1C53BB6B
+#define MKV_CUE_POINT 0xBB
+#define MKV_CUE_TIME 0xB3
+#define MKV_CUE_TRACK_POSITIONS 0xB7
+#define MKV_CUE_TRACK 0xF7
+#define MKV_CUE_CLUSTER_POSITION 0xF1
+#define MKV_CUE_RELATIVE_POSITION 0xF0
+
+#define CHECK(condition) \
+    do { \
+        if(!(condition)) \
+        { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": Check failed: " #condition << std::endl; \
+            return 1; \
+        } \
+    } while(false)
+
+static std::string big_endian(uint64_t value, size_t length)
+{
+    std::string out(length, '\0');
+    for(size_t a = 0; a < length; ++a)
+        out[length - a - 1] = static_cast<char>((value >> (a * 8u)) & 0xFFu);
+    return out;
+}
+
+static std::string box(const char *type, const std::string &body)
+{
+    return big_endian(body.size() + 8, 4) + type + body;
+}
+
+//Each frame is a different size, so that they can be told apart
+static uint64_t sample_size(uint64_t index)
+{
+    return 20000 + index * 100;
+}
+
+/*!
+ * Builds an MP4 with a single video track, one frame per chunk,
+ * and its movie box before the media data
+ *
+ * @param sample_offsets Filled with the offset of each frame in the file. Each frame is filled with its index.
+ * @return The file
+ */
+static std::string make_mp4(std::vector<uint64_t> &sample_offsets)
+{
+    std::string ftyp = box("ftyp", std::string("isom") + big_endian(0, 4));
+
+    //Times are laid out the same in mvhd and mdhd: version and flags, creation, modification, timescale, duration
+    std::string times = big_endian(0, 4) + big_endian(0, 4) + big_endian(0, 4) + big_endian(TEST_TIMESCALE, 4) + big_endian(TEST_SAMPLE_COUNT * TEST_SAMPLE_DELTA, 4);
+    std::string mvhd = box("mvhd", times + std::string(80, '\0'));
+    std::string mdhd = box("mdhd", times + std::string(4, '\0'));
+    std::string hdlr = box("hdlr", big_endian(0, 4) + big_endian(0, 4) + "vide" + std::string(13, '\0'));
+
+    std::string entry = std::string(24, '\0') + big_endian(TEST_WIDTH, 2) + big_endian(TEST_HEIGHT, 2) + std::string(50, '\0');
+    std::string stsd = box("stsd", big_endian(0, 4) + big_endian(1, 4) + box("avc1", entry));
+    std::string stts = box("stts", big_endian(0, 4) + big_endian(1, 4) + big_endian(TEST_SAMPLE_COUNT, 4) + big_endian(TEST_SAMPLE_DELTA, 4));
+    std::string stss_body;
+    for(uint64_t a = 0; a < TEST_SAMPLE_COUNT; a += TEST_KEYFRAME_INTERVAL)
+        stss_body += big_endian(a + 1, 4);
+    std::string stss = box("stss", big_endian(0, 4) + big_endian(stss_body.size() / 4, 4) + stss_body);
+    std::string stsc = box("stsc", big_endian(0, 4) + big_endian(1, 4) + big_endian(1, 4) + big_endian(1, 4) + big_endian(1, 4));
+    std::string stsz_body;
+    for(uint64_t a = 0; a < TEST_SAMPLE_COUNT; ++a)
+        stsz_body += big_endian(sample_size(a), 4);
+    std::string stsz = box("stsz", big_endian(0, 4) + big_endian(0, 4) + big_endian(TEST_SAMPLE_COUNT, 4) + stsz_body);
+
+    //The chunk offsets depend on the size of the movie box, which they're part of, but not on their values
+    std::string stco_body(TEST_SAMPLE_COUNT * 4, '\0');
+    auto make_moov = [&]() {
+        std::string stco = box("stco", big_endian(0, 4) + big_endian(TEST_SAMPLE_COUNT, 4) + stco_body);
+        std::string stbl = box("stbl", stsd + stts + stss + stsc + stsz + stco);
+        std::string trak = box("trak", box("mdia", mdhd + hdlr + box("minf", stbl)));
+        return box("moov", mvhd + trak);
+    };
+
+    uint64_t offset = ftyp.size() + make_moov().size() + 8;
+    std::string media;
+    sample_offsets.clear();
+    stco_body.clear();
+    for(uint64_t a = 0; a < TEST_SAMPLE_COUNT; ++a)
+    {
+        sample_offsets.push_back(offset + media.size());
+        stco_body += big_endian(offset + media.size(), 4);
+        media.append(sample_size(a), static_cast<char>(a));
+    }
+
+    return ftyp + make_moov() + box("mdat", media);
+}
+
+//Every size and integer is written 8 bytes long, so an element's length doesn't depend on its value
+static std::string element(uint64_t id, const std::string &body)
+{
+    size_t id_length = 1;
+    while(id >> (id_length * 8u))
+        ++id_length;
+    return big_endian(id, id_length) + big_endian((uint64_t(1) << 56u) | body.size(), 8) + body;
+}
+
+static std::string uint_element(uint64_t id, uint64_t value)
+{
+    return element(id, big_endian(value, 8));
+}
+
+//The time a frame's shown at, in milliseconds
+static uint64_t sample_time(uint64_t index)
+{
+    return index * TEST_SAMPLE_DELTA * 1000 / TEST_TIMESCALE;
+}
+
+/*!
+ * Builds a Matroska file with a single video track, a cluster per keyframe,
+ * and its cues after the clusters, found through the seek head
+ *
+ * @param cluster_offsets Filled with the offset of each cluster in the file. Each frame is filled with its index.
+ * @param keyframe_ends Filled with the end of each cluster's keyframe block
+ * @param cues_offset Set to the offset of the cues
+ * @return The file
+ */
+static std::string make_matroska(std::vector<uint64_t> &cluster_offsets, std::vector<uint64_t> &keyframe_ends, uint64_t &cues_offset)
+{
+    std::string ebml = element(MKV_EBML, element(MKV_DOC_TYPE, "matroska"));
+
+    double duration = static_cast<double>(sample_time(TEST_SAMPLE_COUNT)); //In timecodes, of a millisecond each
+    uint64_t duration_bits;
+    memcpy(&duration_bits, &duration, sizeof(duration_bits));
+    std::string info = element(MKV_INFO, uint_element(MKV_TIMECODE_SCALE, 1000000) + element(MKV_DURATION, big_endian(duration_bits, 8)));
+
+    std::string video = element(MKV_VIDEO, uint_element(MKV_PIXEL_WIDTH, TEST_WIDTH) + uint_element(MKV_PIXEL_HEIGHT, TEST_HEIGHT));
+    std::string tracks = element(MKV_TRACKS, element(MKV_TRACK_ENTRY, uint_element(MKV_TRACK_NUMBER, 1) + uint_element(MKV_TRACK_TYPE, 1) + element(MKV_CODEC_ID, "V_MPEG4/ISO/AVC") + video));
+
+    //Each keyframe starts a cluster, with its block first, after the cluster's timecode
+    std::vector<std::string> clusters;
+    std::vector<uint64_t> keyframe_relative_ends; //From the start of the cluster
+    for(uint64_t a = 0; a < TEST_SAMPLE_COUNT; a += TEST_KEYFRAME_INTERVAL)
+    {
+        std::string body = uint_element(MKV_CLUSTER_TIMECODE, sample_time(a));
+        for(uint64_t b = a; b < a + TEST_KEYFRAME_INTERVAL; ++b)
+        {
+            //Track number, timecode relative to the cluster's, and flags
+            std::string header = std::string(1, '\x81') + big_endian(sample_time(b) - sample_time(a), 2) + (b == a ? '\x80' : '\0');
+            body += element(MKV_SIMPLE_BLOCK, header + std::string(sample_size(b), static_cast<char>(b)));
+            if(b == a)
+                keyframe_relative_ends.push_back(12 + body.size());
+        }
+        clusters.emplace_back(element(MKV_CLUSTER, body));
+    }
+
+    //The seek head's positions depend on the size of the elements after it, but not on their values
+    auto make_seek = [](uint64_t id, uint64_t position) {
+        return element(MKV_SEEK, element(MKV_SEEK_ID, big_endian(id, 4)) + uint_element(MKV_SEEK_POSITION, position));
+    };
+    auto make_seek_head = [&](uint64_t cues_position) {
+        uint64_t info_position = make_seek(MKV_INFO, 0).size() * 3 + 12;
+        return element(MKV_SEEK_HEAD, make_seek(MKV_INFO, info_position) + make_seek(MKV_TRACKS, info_position + info.size()) + make_seek(MKV_CUES, cues_position));
+    };
+
+    //Positions within the segment are from the start of its body
+    uint64_t position = make_seek_head(0).size() + info.size() + tracks.size();
+    uint64_t segment_body = ebml.size() + 12;
+    std::string cue_points;
+    std::string media;
+    cluster_offsets.clear();
+    keyframe_ends.clear();
+    for(size_t a = 0; a < clusters.size(); ++a)
+    {
+        cluster_offsets.push_back(segment_body + position + media.size());
+        keyframe_ends.push_back(cluster_offsets.back() + keyframe_relative_ends[a]);
+        std::string positions = uint_element(MKV_CUE_TRACK, 1) + uint_element(MKV_CUE_CLUSTER_POSITION, position + media.size()) + uint_element(MKV_CUE_RELATIVE_POSITION, uint_element(MKV_CLUSTER_TIMECODE, 0).size());
+        cue_points += element(MKV_CUE_POINT, uint_element(MKV_CUE_TIME, sample_time(a * TEST_KEYFRAME_INTERVAL)) + element(MKV_CUE_TRACK_POSITIONS, positions));
+        media += clusters[a];
+    }
+    std::string seek_head = make_seek_head(position + media.size());
+    cues_offset = segment_body + position + media.size();
+
+    return ebml + element(MKV_SEGMENT, seek_head + info + tracks + media + element(MKV_CUES, cue_points));
+}
+
+//Serves a file from memory, counting the bytes read from it
+class CountingStream : public sf::InputStream
+{
+public:
+    explicit CountingStream(const std::string &data_)
+    : data(data_),
+      position(0),
+      bytes_read(0)
+    {}
+
+    sf::Int64 read(void *out, sf::Int64 size) override
+    {
+        uint64_t available = std::min<uint64_t>(static_cast<uint64_t>(size), data.size() - std::min<uint64_t>(position, data.size()));
+        memcpy(out, data.data() + position, available);
+        position += available;
+        bytes_read += available;
+        return static_cast<sf::Int64>(available);
+    }
+
+    sf::Int64 seek(sf::Int64 position_) override
+    {
+        position = static_cast<uint64_t>(position_);
+        return position_;
+    }
+
+    sf::Int64 tell() override
+    {
+        return static_cast<sf::Int64>(position);
+    }
+
+    sf::Int64 getSize() override
+    {
+        return static_cast<sf::Int64>(data.size());
+    }
+
+    const std::string &data;
+    uint64_t position;
+    uint64_t bytes_read;
+};
+
+static int check_mp4()
+{
+    std::vector<uint64_t> sample_offsets;
+    std::string file = make_mp4(sample_offsets);
+    uint64_t mdat_body = sample_offsets.front();
+
+    uint64_t bytes_read = 0;
+    auto read = [&](uint64_t offset, size_t length) {
+        std::string out = file.substr(offset, length);
+        bytes_read += out.size();
+        return out;
+    };
+
+    //The headers all fit in the first read, so probing shouldn't need any more
+    MediaInfo info = MediaProbe(file.size(), read).probe();
+    CHECK(info.width == TEST_WIDTH);
+    CHECK(info.height == TEST_HEIGHT);
+    CHECK(info.duration == TEST_SAMPLE_COUNT * TEST_SAMPLE_DELTA * 1000 / TEST_TIMESCALE);
+    CHECK(info.video_codec == "h264");
+    CHECK(bytes_read == MEDIA_PROBE_READ_SIZE);
+
+    //60% of the way in is frame 60, so the keyframe before it is frame 50
+    bytes_read = 0;
+    KeyframeLocation location = MediaProbe(file.size(), read).locate_keyframe(0.6);
+    uint64_t keyframe = 2 * TEST_KEYFRAME_INTERVAL;
+    CHECK(bytes_read == MEDIA_PROBE_READ_SIZE);
+    CHECK(location.time == keyframe * TEST_SAMPLE_DELTA * 1000 / TEST_TIMESCALE);
+    CHECK(location.ranges.size() == 2);
+    CHECK(location.ranges[0].offset == 0 && location.ranges[0].length == mdat_body);
+    CHECK(location.ranges[1].offset == sample_offsets[keyframe] && location.ranges[1].length == sample_size(keyframe));
+
+    //Reading the whole of the sparse stream should only touch the headers and the keyframe
+    CountingStream stream(file);
+    SparseStream sparse(stream, location.ranges);
+    std::string extracted;
+    char chunk[4096];
+    for(sf::Int64 count; (count = sparse.read(chunk, sizeof(chunk))) > 0;)
+        extracted.append(chunk, static_cast<size_t>(count));
+
+    CHECK(extracted.size() == sample_offsets[keyframe] + sample_size(keyframe));
+    CHECK(stream.bytes_read == mdat_body + sample_size(keyframe));
+    CHECK(stream.bytes_read * 10 < file.size());
+    CHECK(extracted.compare(0, mdat_body, file, 0, mdat_body) == 0);
+    CHECK(extracted.compare(sample_offsets[keyframe], sample_size(keyframe), file, sample_offsets[keyframe], sample_size(keyframe)) == 0);
+    CHECK(extracted.find_first_not_of('\0', mdat_body) == sample_offsets[keyframe]);
+
+    std::cout << "Located a keyframe by reading " << MEDIA_PROBE_READ_SIZE << " bytes, and extracted it by reading "
+              << stream.bytes_read << " of " << file.size() << " bytes" << std::endl;
+    return 0;
+}
+
+static int check_matroska()
+{
+    std::vector<uint64_t> cluster_offsets, keyframe_ends;
+    uint64_t cues_offset;
+    std::string file = make_matroska(cluster_offsets, keyframe_ends, cues_offset);
+
+    uint64_t bytes_read = 0;
+    auto read = [&](uint64_t offset, size_t length) {
+        std::string out = file.substr(offset, length);
+        bytes_read += out.size();
+        return out;
+    };
+
+    //The headers all fit in the first read, so probing shouldn't need any more
+    MediaInfo info = MediaProbe(file.size(), read).probe();
+    CHECK(info.width == TEST_WIDTH);
+    CHECK(info.height == TEST_HEIGHT);
+    CHECK(info.duration == sample_time(TEST_SAMPLE_COUNT));
+    CHECK(info.video_codec == "h264");
+    CHECK(bytes_read == MEDIA_PROBE_READ_SIZE);
+
+    //60% of the way in is frame 60, so the keyframe before it starts the third cluster. Past the headers,
+    //only the cues at the end of the file, and the start of that cluster up to the keyframe's block, should be read.
+    bytes_read = 0;
+    KeyframeLocation location = MediaProbe(file.size(), read).locate_keyframe(0.6);
+    size_t cluster = 2;
+    CHECK(bytes_read == MEDIA_PROBE_READ_SIZE * 2 + (file.size() - cues_offset));
+    CHECK(location.time == sample_time(cluster * TEST_KEYFRAME_INTERVAL));
+    CHECK(location.ranges.size() == 3);
+    CHECK(location.ranges[0].offset == 0 && location.ranges[0].length == cluster_offsets.front());
+    CHECK(location.ranges[1].offset == cluster_offsets[cluster] && location.ranges[1].length == keyframe_ends[cluster] - cluster_offsets[cluster]);
+    CHECK(location.ranges[2].offset == cues_offset && location.ranges[2].length == file.size() - cues_offset);
+
+    //Reading the whole of the sparse stream should only touch the headers, the keyframe and the cues
+    CountingStream stream(file);
+    SparseStream sparse(stream, location.ranges);
+    std::string extracted;
+    char chunk[4096];
+    for(sf::Int64 count; (count = sparse.read(chunk, sizeof(chunk))) > 0;)
+        extracted.append(chunk, static_cast<size_t>(count));
+
+    uint64_t ranges_size = 0;
+    for(auto &range : location.ranges)
+    {
+        ranges_size += range.length;
+        CHECK(extracted.compare(range.offset, range.length, file, range.offset, range.length) == 0);
+    }
+    CHECK(extracted.size() == file.size());
+    CHECK(stream.bytes_read == ranges_size);
+    CHECK(stream.bytes_read * 10 < file.size());
+    CHECK(extracted.find_first_not_of('\0', cluster_offsets.front()) == cluster_offsets[cluster]);
+
+    std::cout << "Located a Matroska keyframe by reading " << bytes_read << " bytes, and extracted it by reading "
+              << stream.bytes_read << " of " << file.size() << " bytes" << std::endl;
+    return 0;
+}
+
+int main()
+{
+    if(check_mp4() != 0 || check_matroska() != 0)
+        return 1;
+    return 0;
+}